@@ -0,0 +1,723 @@
+/*
+ * Copyright (c) 2021-2024 Wojciech Graj
+ *
+ * Licensed under the MIT license: https://opensource.org/licenses/MIT
+ * Permission is granted to use, copy, modify, and redistribute the work.
+ * Full license information available in the project LICENSE file.
+ **/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../termgl.h"
+
+// OS-specific imports used for timing and discarding output
+#ifdef TGL_OS_WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#define DEVNULL "NUL"
+#define open _open
+#define close _close
+#define lseek _lseek
+#define O_WRONLY _O_WRONLY
+#else
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#define DEVNULL "/dev/null"
+#endif
+
+#define xstr(str_) str(str_)
+#define str(str_) #str_
+
+#define MIN(a_, b_) (((a_) < (b_)) ? (a_) : (b_))
+
+#define RESULTS_MAX 32
+#define NAME_MAX_LEN 32
+#define SAMPLES 4
+#define LINES 64
+#define SPRITES 256
+#define SPRITE_W 8
+#define SPRITE_H 4
+
+static const char *HELPTEXT = "\
+TermGL v" xstr(TGL_VERSION_MAJOR) "." xstr(TGL_VERSION_MINOR) " Benchmarks\n\
+Usage: termgl_bench [options] [filter...]\n\
+    -r WxH     resolution (default 200x60)\n\
+    -m MS      minimum time of each benchmark in milliseconds (default 250)\n\
+    -s FILE    save results to FILE\n\
+    -b FILE    compare results with those saved in FILE\n\
+    -t N       render on N threads (TERMGL_THREADS only)\n\
+Only benchmarks whose names contain one of the filters are run.\
+";
+
+typedef void BenchOp(void *ctx);
+
+typedef struct Result {
+	char name[NAME_MAX_LEN];
+	double ns_op;
+	double pixels_s; // 0 if not applicable
+	double bytes_frame; // 0 if not applicable
+} Result;
+
+typedef struct TriangleContext {
+	TGL *tgl;
+	TGLVert v[3];
+	TGLPixelShader *shader;
+	const void *shader_data;
+} TriangleContext;
+
+typedef struct LineContext {
+	TGL *tgl;
+	TGLVert v[LINES][2];
+	TGLPixelShader *shader;
+	const void *shader_data;
+} LineContext;
+
+typedef struct TeapotContext {
+	TGL *tgl;
+	TGLTriangle *trigs;
+	size_t n_trigs;
+	TGLMesh mesh;
+	TGLVertexShaderSimple vertex_shader;
+	TGLPixelShader *shader;
+	const void *shader_data;
+} TeapotContext;
+
+typedef struct SpriteContext {
+	TGL *tgl;
+	unsigned frame;
+	TGLRecorder *recorder;
+	size_t recorded_bytes;
+} SpriteContext;
+
+// Same sprite drawn at each position, from chars and colors or as a TGLSprite
+typedef struct BlitContext {
+	TGL *tgl;
+	TGLSprite *sprite;
+	char chars[SPRITE_H][SPRITE_W];
+	TGLPixFmt colors[SPRITE_H][SPRITE_W];
+	int pos[SPRITES][2];
+} BlitContext;
+
+static void pixel_shader_count(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
+static void pixel_shader_callback(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
+static uint64_t time_ns(void);
+static void die(const char *msg);
+
+static unsigned long count_pixels(BenchOp *op, void *ctx, TGLPixelShader **shader, const void **shader_data);
+static void bench_run(const char *name, BenchOp *op, void *ctx, double pixels_op, double bytes_frame);
+
+static void op_clear(void *ctx);
+static void op_triangle_fill(void *ctx);
+static void op_lines(void *ctx);
+static void op_puts(void *ctx);
+static void op_sprites_putchar(void *ctx);
+static void op_sprites_blit(void *ctx);
+static void op_teapot(void *ctx);
+static void op_teapot_batch(void *ctx);
+static void op_teapot_mesh(void *ctx);
+static void op_mesh_load_stl(void *ctx);
+static void op_mesh_load_cache(void *ctx);
+static void op_flush(void *ctx);
+static void op_flush_sprite(void *ctx);
+static void op_record_sprite(void *ctx);
+static void sprite_move(SpriteContext *sprite);
+static int record_count(const char *buf, size_t len, void *ctx);
+
+static TGL *bench_tgl(uint32_t settings);
+static void teapot_transform(TGLMat mat, float camera_z, float near_plane);
+static void bench_raster(void);
+static void bench_teapot(void);
+static void bench_flush(void);
+
+static int results_save(const char *path);
+static int results_compare(const char *path);
+
+static unsigned res_x = 200, res_y = 60;
+static uint64_t min_time_ns = 250000000u;
+static unsigned n_threads;
+static char **filters;
+static int n_filters;
+
+static Result results[RESULTS_MAX];
+static unsigned n_results;
+
+static TGLPixelShaderSimple shader_simple; // set in main, since TGL_PIXFMT is not a constant expression
+
+void pixel_shader_count(const uint8_t u, const uint8_t v, TGLPixFmt *color, char *c, const void *const data)
+{
+	++*(unsigned long *)data;
+	*color = TGL_PIXFMT(TGL_IDX(TGL_WHITE));
+	*c = '#';
+	(void)u;
+	(void)v;
+}
+
+// Same as tgl_pixel_shader_simple, but not recognized by triangle fills, so it is called for each pixel
+void pixel_shader_callback(const uint8_t u, const uint8_t v, TGLPixFmt *color, char *c, const void *const data)
+{
+	tgl_pixel_shader_simple(u, v, color, c, data);
+}
+
+uint64_t time_ns(void)
+{
+#ifdef TGL_OS_WINDOWS
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000u + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000u / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+void die(const char *const msg)
+{
+	if (errno)
+		perror(msg);
+	else
+		fprintf(stderr, "%s\n", msg);
+	exit(EXIT_FAILURE);
+}
+
+// Runs op once with its pixel shader replaced by one which counts shaded pixels
+unsigned long count_pixels(BenchOp *const op, void *const ctx, TGLPixelShader **const shader, const void **const shader_data)
+{
+	unsigned long count = 0;
+	TGLPixelShader *const prev_shader = *shader;
+	const void *const prev_shader_data = *shader_data;
+	*shader = &pixel_shader_count;
+	*shader_data = &count;
+	op(ctx);
+	*shader = prev_shader;
+	*shader_data = prev_shader_data;
+	return count;
+}
+
+// Doubles the number of iterations of op until a sample takes a fraction of min_time_ns, then keeps the fastest of SAMPLES samples
+void bench_run(const char *const name, BenchOp *const op, void *const ctx, const double pixels_op, const double bytes_frame)
+{
+	int i;
+	if (n_filters) {
+		for (i = 0; i < n_filters && !strstr(name, filters[i]); i++)
+			;
+		if (i == n_filters)
+			return;
+	}
+	if (n_results == RESULTS_MAX)
+		die("Too many benchmarks");
+
+	uint64_t iterations = 1, elapsed, best = UINT64_MAX;
+	while (1) {
+		uint64_t j;
+		const uint64_t begin = time_ns();
+		for (j = 0; j < iterations; j++)
+			op(ctx);
+		elapsed = time_ns() - begin;
+		if (elapsed * SAMPLES >= min_time_ns)
+			break;
+		iterations *= 2;
+	}
+	for (i = 0; i < SAMPLES; i++) {
+		uint64_t j;
+		const uint64_t begin = time_ns();
+		for (j = 0; j < iterations; j++)
+			op(ctx);
+		elapsed = time_ns() - begin;
+		if (elapsed < best)
+			best = elapsed;
+	}
+
+	Result *const result = &results[n_results++];
+	snprintf(result->name, NAME_MAX_LEN, "%s", name);
+	result->ns_op = (double)best / iterations;
+	result->pixels_s = pixels_op * 1e9 / result->ns_op;
+	result->bytes_frame = bytes_frame;
+}
+
+void op_clear(void *const ctx)
+{
+	tgl_clear(ctx, TGL_FRAME_BUFFER | TGL_Z_BUFFER);
+}
+
+void op_triangle_fill(void *const ctx)
+{
+	const TriangleContext *const trig = ctx;
+	tgl_triangle_fill(trig->tgl, trig->v[0], trig->v[1], trig->v[2], trig->shader, trig->shader_data);
+}
+
+void op_lines(void *const ctx)
+{
+	const LineContext *const lines = ctx;
+	unsigned i;
+	for (i = 0; i < LINES; i++)
+		tgl_line(lines->tgl, lines->v[i][0], lines->v[i][1], lines->shader, lines->shader_data);
+}
+
+void op_puts(void *const ctx)
+{
+	static const char line[] = "The quick brown fox jumps over the lazy dog. 0123456789";
+	unsigned row;
+	for (row = 0; row < res_y; row++)
+		tgl_puts(ctx, 0, row, line, TGL_PIXFMT(TGL_IDX(TGL_GREEN, TGL_BOLD)));
+}
+
+// Draws opaque pixels of the sprite one by one, like a UI without sprites would
+void op_sprites_putchar(void *const ctx)
+{
+	const BlitContext *const blit = ctx;
+	unsigned i, x, y;
+	for (i = 0; i < SPRITES; i++) {
+		for (y = 0; y < SPRITE_H; y++) {
+			for (x = 0; x < SPRITE_W; x++) {
+				if (blit->chars[y][x] != ' ')
+					tgl_putchar(blit->tgl, blit->pos[i][0] + x, blit->pos[i][1] + y, blit->chars[y][x], blit->colors[y][x]);
+			}
+		}
+	}
+}
+
+void op_sprites_blit(void *const ctx)
+{
+	const BlitContext *const blit = ctx;
+	unsigned i;
+	for (i = 0; i < SPRITES; i++)
+		tgl_blit(blit->tgl, blit->sprite, blit->pos[i][0], blit->pos[i][1]);
+}
+
+void op_teapot(void *const ctx)
+{
+	const TeapotContext *const teapot = ctx;
+	// Determine UVs for triangle vertices
+	const uint8_t uv[3][2] = { { 0, 0 }, { 255, 0 }, { 0, 255 } };
+	tgl_clear(teapot->tgl, TGL_FRAME_BUFFER | TGL_Z_BUFFER);
+	size_t i;
+	for (i = 0; i < teapot->n_trigs; i++)
+		tgl_triangle_3d(teapot->tgl, (const TGLVec3 *)teapot->trigs[i], uv, true, &tgl_vertex_shader_simple, &teapot->vertex_shader, teapot->shader, teapot->shader_data);
+}
+
+void op_teapot_batch(void *const ctx)
+{
+	const TeapotContext *const teapot = ctx;
+	tgl_clear(teapot->tgl, TGL_FRAME_BUFFER | TGL_Z_BUFFER);
+	if (tgl_triangles_3d(teapot->tgl, (const TGLTriangle *)teapot->trigs, NULL, teapot->n_trigs, true, &tgl_vertex_shader_simple, &teapot->vertex_shader, teapot->shader, teapot->shader_data, 0))
+		die("tgl_triangles_3d");
+}
+
+void op_teapot_mesh(void *const ctx)
+{
+	const TeapotContext *const teapot = ctx;
+	tgl_clear(teapot->tgl, TGL_FRAME_BUFFER | TGL_Z_BUFFER);
+	if (tgl_draw_mesh(teapot->tgl, teapot->mesh.verts, teapot->mesh.n_verts, teapot->mesh.indices, teapot->mesh.n_indices, NULL, true, &tgl_vertex_shader_simple, &teapot->vertex_shader, teapot->shader, teapot->shader_data, 0))
+		die("tgl_draw_mesh");
+}
+
+// Maps and deduplicates the STL file
+void op_mesh_load_stl(void *const ctx)
+{
+	TGLMesh mesh;
+	if (tglmesh_load_stl(&mesh, ctx) || tglmesh_index(&mesh))
+		die("tglmesh_load_stl");
+	tglmesh_free(&mesh);
+}
+
+// Maps and validates the indexed cache file
+void op_mesh_load_cache(void *const ctx)
+{
+	TGLMesh mesh;
+	if (tglmesh_load_cache(&mesh, ctx))
+		die("tglmesh_load_cache");
+	tglmesh_free(&mesh);
+}
+
+void op_flush(void *const ctx)
+{
+	if (tgl_flush(ctx))
+		die("tgl_flush");
+}
+
+// Moves a small sprite over an unchanged frame and flushes
+void op_flush_sprite(void *const ctx)
+{
+	SpriteContext *const sprite = ctx;
+	sprite_move(sprite);
+	op_flush(sprite->tgl);
+}
+
+// Same frames as flush/diff_sprite, recorded instead of flushed
+void op_record_sprite(void *const ctx)
+{
+	SpriteContext *const sprite = ctx;
+	sprite_move(sprite);
+	if (tgl_recorder_frame(sprite->recorder, sprite->tgl))
+		die("tgl_recorder_frame");
+}
+
+void sprite_move(SpriteContext *const sprite)
+{
+	const int x = sprite->frame % (res_x - 3), y = sprite->frame / (res_x - 3) % res_y;
+	tgl_puts(sprite->tgl, x, y, " ", TGL_PIXFMT(TGL_IDX(TGL_WHITE)));
+	tgl_puts(sprite->tgl, x + 1, y, "<o>", TGL_PIXFMT(TGL_IDX(TGL_YELLOW, TGL_BOLD)));
+	sprite->frame++;
+}
+
+// Discards the recording, counting its size
+int record_count(const char *const buf, const size_t len, void *const ctx)
+{
+	*(size_t *)ctx += len;
+	(void)buf;
+	return 0;
+}
+
+TGL *bench_tgl(const uint32_t settings)
+{
+	TGL *const tgl = tgl_init(res_x, res_y);
+	if (!tgl)
+		die("tgl_init");
+	if (settings && tgl_enable(tgl, settings))
+		die("tgl_enable");
+#ifdef TERMGL_THREADS
+	if (tgl_set_threads(tgl, n_threads))
+		die("tgl_set_threads");
+#endif
+	return tgl;
+}
+
+void bench_raster(void)
+{
+	TGL *const tgl = bench_tgl(TGL_Z_BUFFER);
+	const unsigned frame_size = res_x * res_y;
+
+	bench_run("clear", &op_clear, tgl, frame_size, 0.);
+	if (tgl_enable(tgl, TGL_REVERSED_Z))
+		die("tgl_enable");
+	bench_run("clear/reversed_z", &op_clear, tgl, frame_size, 0.);
+	tgl_disable(tgl, TGL_REVERSED_Z);
+	if (tgl_enable(tgl, TGL_Z_BUFFER_16))
+		die("tgl_enable");
+	bench_run("clear/z16", &op_clear, tgl, frame_size, 0.);
+
+	tgl_disable(tgl, TGL_Z_BUFFER | TGL_Z_BUFFER_16);
+	// Right triangles with legs of 4, 16 and the whole screen
+	static const struct {
+		const char *name;
+		unsigned size;
+	} fills[] = {
+		{ "triangle_fill/4", 4 },
+		{ "triangle_fill/16", 16 },
+		{ "triangle_fill/screen", 0 },
+	};
+	unsigned i;
+	for (i = 0; i < sizeof(fills) / sizeof(fills[0]); i++) {
+		const int width = fills[i].size ? (int)fills[i].size * 2 : (int)res_x; // characters are about twice as tall as wide
+		const int height = fills[i].size ? (int)fills[i].size : (int)res_y;
+		TriangleContext trig = {
+			.tgl = tgl,
+			.v = {
+				{ .x = 0, .y = 0, .u = 0, .v = 0 },
+				{ .x = width - 1, .y = 0, .u = 255, .v = 0 },
+				{ .x = 0, .y = height - 1, .u = 0, .v = 255 },
+			},
+			.shader = &tgl_pixel_shader_simple,
+			.shader_data = &shader_simple,
+		};
+		const unsigned long pixels = count_pixels(&op_triangle_fill, &trig, &trig.shader, &trig.shader_data);
+		bench_run(fills[i].name, &op_triangle_fill, &trig, pixels, 0.);
+	}
+
+	// Same as triangle_fill/screen, shaded by calling a pixel shader instead of tgl_span_shader_simple
+	TriangleContext trig = {
+		.tgl = tgl,
+		.v = {
+			{ .x = 0, .y = 0, .u = 0, .v = 0 },
+			{ .x = res_x - 1, .y = 0, .u = 255, .v = 0 },
+			{ .x = 0, .y = res_y - 1, .u = 0, .v = 255 },
+		},
+		.shader = &pixel_shader_callback,
+		.shader_data = &shader_simple,
+	};
+	const unsigned long pixel_pixels = count_pixels(&op_triangle_fill, &trig, &trig.shader, &trig.shader_data);
+	bench_run("triangle_fill/screen_pixel", &op_triangle_fill, &trig, pixel_pixels, 0.);
+
+	// Lines between random points, the same for every run
+	LineContext lines = {
+		.tgl = tgl,
+		.shader = &tgl_pixel_shader_simple,
+		.shader_data = &shader_simple,
+	};
+	srand(1);
+	for (i = 0; i < LINES; i++) {
+		lines.v[i][0] = (TGLVert){ .x = rand() % res_x, .y = rand() % res_y, .u = 0 };
+		lines.v[i][1] = (TGLVert){ .x = rand() % res_x, .y = rand() % res_y, .u = 255 };
+	}
+	const unsigned long line_pixels = count_pixels(&op_lines, &lines, &lines.shader, &lines.shader_data);
+	bench_run("line", &op_lines, &lines, line_pixels, 0.);
+
+	bench_run("puts", &op_puts, tgl, (double)MIN(res_x, 55u) * res_y, 0.);
+
+	// Sprites with transparent corners at random positions on the screen, the same for every run
+	BlitContext blit = { .tgl = tgl };
+	unsigned x, y, opaque = 0;
+	for (y = 0; y < SPRITE_H; y++) {
+		for (x = 0; x < SPRITE_W; x++) {
+			const bool corner = (x == 0 || x == SPRITE_W - 1) && (y == 0 || y == SPRITE_H - 1);
+			blit.chars[y][x] = corner ? ' ' : '@';
+			blit.colors[y][x] = TGL_PIXFMT(TGL_RGB(x * 32, y * 64, 200));
+			opaque += !corner;
+		}
+	}
+	for (i = 0; i < SPRITES; i++) {
+		blit.pos[i][0] = rand() % (res_x - SPRITE_W + 1);
+		blit.pos[i][1] = rand() % (res_y - SPRITE_H + 1);
+	}
+	blit.sprite = tgl_sprite_create(SPRITE_W, SPRITE_H, &blit.chars[0][0], &blit.colors[0][0], ' ');
+	if (!blit.sprite)
+		die("tgl_sprite_create");
+	bench_run("sprites/putchar", &op_sprites_putchar, &blit, (double)opaque * SPRITES, 0.);
+	bench_run("sprites/blit", &op_sprites_blit, &blit, (double)opaque * SPRITES, 0.);
+	tgl_sprite_delete(blit.sprite);
+
+	tgl_delete(tgl);
+}
+
+void bench_teapot(void)
+{
+	TeapotContext teapot = {
+		.tgl = bench_tgl(TGL_CULL_FACE | TGL_Z_BUFFER),
+		.shader = &tgl_pixel_shader_simple,
+		.shader_data = &shader_simple,
+	};
+	tgl_cull_face(teapot.tgl, TGL_BACK | TGL_CCW);
+
+	static const char stl_path[] = "demo/utah_teapot.stl", cache_path[] = "termgl_bench.tglmesh";
+	if (tglmesh_load_stl(&teapot.mesh, stl_path))
+		die(stl_path);
+	teapot.n_trigs = teapot.mesh.n_triangles;
+	teapot.trigs = malloc(sizeof(TGLTriangle) * teapot.n_trigs);
+	if (!teapot.trigs)
+		die("malloc");
+	size_t i;
+	for (i = 0; i < teapot.n_trigs; i++)
+		tglmesh_stl_triangle(&teapot.mesh, i, teapot.trigs[i]);
+	if (tglmesh_index(&teapot.mesh))
+		die("tglmesh_index");
+	if (tglmesh_save_cache(&teapot.mesh, cache_path))
+		die(cache_path);
+
+	// Same view as teapot demo, entirely inside of the view volume
+	teapot_transform(teapot.vertex_shader.mat, 2.f, 0.1f);
+	const unsigned long pixels = count_pixels(&op_teapot, &teapot, &teapot.shader, &teapot.shader_data);
+	bench_run("triangle_3d/teapot", &op_teapot, &teapot, pixels, 0.);
+	bench_run("triangles_3d/teapot", &op_teapot_batch, &teapot, pixels, 0.);
+	bench_run("draw_mesh/teapot", &op_teapot_mesh, &teapot, pixels, 0.);
+	if (tgl_enable(teapot.tgl, TGL_Z_BUFFER_16))
+		die("tgl_enable");
+	bench_run("triangle_3d/teapot_z16", &op_teapot, &teapot, pixels, 0.);
+	tgl_disable(teapot.tgl, TGL_Z_BUFFER_16);
+
+	// Closer camera with a distant near plane, so the teapot crosses the screen edges and the near plane
+	teapot_transform(teapot.vertex_shader.mat, 1.f, 0.6f);
+	const unsigned long clipped_pixels = count_pixels(&op_teapot, &teapot, &teapot.shader, &teapot.shader_data);
+	bench_run("triangle_3d/teapot_clipped", &op_teapot, &teapot, clipped_pixels, 0.);
+
+	bench_run("mesh/load_stl", &op_mesh_load_stl, (void *)stl_path, 0., 0.);
+	bench_run("mesh/load_cache", &op_mesh_load_cache, (void *)cache_path, 0., 0.);
+	remove(cache_path);
+
+	tgl_delete(teapot.tgl);
+	tglmesh_free(&teapot.mesh);
+	free(teapot.trigs);
+}
+
+// Teapot seen from the demo's camera angle at a distance of camera_z
+void teapot_transform(TGLMat mat, const float camera_z, const float near_plane)
+{
+	TGLMat camera, temp, camera_scale, camera_rotate, camera_translate, camera_t, obj_scale, obj_rotate, obj_t, to_view;
+	tgl_camera(camera, res_x, res_y, 1.57f, near_plane, 5.f);
+	tgl_scale(camera_scale, 1.0f, 1.0f, 1.0f);
+	tgl_rotate(camera_rotate, 2.1f, 0.f, 0.f);
+	tgl_translate(camera_translate, 0.f, 0.f, camera_z);
+	tgl_mulmat((const TGLVec4 *)camera_translate, (const TGLVec4 *)camera_scale, temp);
+	tgl_mulmat((const TGLVec4 *)temp, (const TGLVec4 *)camera_rotate, camera_t);
+	tgl_scale(obj_scale, 0.12f, 0.12f, 0.12f);
+	tgl_rotate(obj_rotate, 0.f, 0.f, 0.5f);
+	tgl_mulmat((const TGLVec4 *)obj_scale, (const TGLVec4 *)obj_rotate, obj_t);
+	tgl_mulmat((const TGLVec4 *)camera_t, (const TGLVec4 *)obj_t, to_view);
+	tgl_mulmat((const TGLVec4 *)camera, (const TGLVec4 *)to_view, mat);
+}
+
+// Flushes frames of text with indexed colors and of RGB gradients to /dev/null
+void bench_flush(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t settings;
+		bool rgb;
+	} flushes[] = {
+		{ "flush/indexed", 0, false },
+		{ "flush/rgb", 0, true },
+		{ "flush/rgb_quantize_256", TGL_QUANTIZE_256, true },
+	};
+	const int null_fd = open(DEVNULL, O_WRONLY);
+	if (null_fd < 0)
+		die(DEVNULL);
+	unsigned i;
+	for (i = 0; i < sizeof(flushes) / sizeof(flushes[0]); i++) {
+		TGL *const tgl = bench_tgl(TGL_OUTPUT_BUFFER | TGL_DIRECT_WRITE | TGL_PROGRESSIVE | flushes[i].settings);
+		unsigned x, y;
+		for (y = 0; y < res_y; y++) {
+			for (x = 0; x < res_x; x++) {
+				const TGLPixFmt color = flushes[i].rgb
+					? TGL_PIXFMT(TGL_RGB(x * 255 / res_x, y * 255 / res_y, 128))
+					: TGL_PIXFMT(TGL_IDX((x / 8 + y) % 8, ((x / 16) % 2) ? TGL_BOLD : 0));
+				tgl_putchar(tgl, x, y, 'a' + (x + y) % 26, color);
+			}
+		}
+
+		// Size of output is measured by printing a frame to a temporary file
+		FILE *const file = tmpfile();
+		if (!file)
+			die("tmpfile");
+		tgl_set_output_fd(tgl, fileno(file));
+		op_flush(tgl);
+		const long bytes = lseek(fileno(file), 0, SEEK_END);
+		fclose(file);
+
+		tgl_set_output_fd(tgl, null_fd);
+		bench_run(flushes[i].name, &op_flush, tgl, res_x * res_y, bytes);
+		tgl_delete(tgl);
+	}
+
+	// Only the few pixels drawn per frame are compared with the previous frame
+	SpriteContext sprite = { .tgl = bench_tgl(TGL_OUTPUT_BUFFER | TGL_DIRECT_WRITE | TGL_DIFF_FLUSH), .frame = 0 };
+	tgl_clear(sprite.tgl, TGL_FRAME_BUFFER);
+	tgl_set_output_fd(sprite.tgl, null_fd);
+	op_flush(sprite.tgl);
+	bench_run("flush/diff_sprite", &op_flush_sprite, &sprite, 0, 0);
+
+	// Size is measured over all recorded frames, once the last one was written
+	sprite.frame = 0;
+	sprite.recorder = tgl_recorder_create(sprite.tgl, &record_count, &sprite.recorded_bytes);
+	if (!sprite.recorder)
+		die("tgl_recorder_create");
+	const size_t n_results_prev = n_results;
+	bench_run("record/diff_sprite", &op_record_sprite, &sprite, 0, 0);
+	if (tgl_recorder_delete(sprite.recorder))
+		die("tgl_recorder_delete");
+	if (n_results > n_results_prev)
+		results[n_results - 1].bytes_frame = (double)sprite.recorded_bytes / sprite.frame;
+	tgl_delete(sprite.tgl);
+	close(null_fd);
+}
+
+int results_save(const char *const path)
+{
+	FILE *const file = fopen(path, "w");
+	if (!file)
+		return -1;
+	unsigned i;
+	for (i = 0; i < n_results; i++)
+		fprintf(file, "%s %.3f %.0f %.0f\n", results[i].name, results[i].ns_op, results[i].pixels_s, results[i].bytes_frame);
+	return fclose(file) ? -1 : 0;
+}
+
+// Prints change of ns/op of each benchmark which is also in the baseline
+int results_compare(const char *const path)
+{
+	FILE *const file = fopen(path, "r");
+	if (!file)
+		return -1;
+	printf("\n%-28s %14s %14s %9s %14s\n", "vs baseline", "ns/op", "baseline", "change", "bytes change");
+	Result base;
+	while (fscanf(file, "%31s %lf %lf %lf", base.name, &base.ns_op, &base.pixels_s, &base.bytes_frame) == 4) {
+		unsigned i;
+		for (i = 0; i < n_results && strcmp(results[i].name, base.name); i++)
+			;
+		if (i == n_results)
+			continue;
+		printf("%-28s %14.1f %14.1f %+8.1f%% %+14.0f\n", base.name, results[i].ns_op, base.ns_op,
+			(results[i].ns_op / base.ns_op - 1.) * 100., results[i].bytes_frame - base.bytes_frame);
+	}
+	fclose(file);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *save_path = NULL, *baseline_path = NULL;
+	int i;
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-')
+			break;
+		if (!strcmp(argv[i], "--")) {
+			i++;
+			break;
+		}
+		if (i + 1 == argc || argv[i][1] == '\0' || argv[i][2] != '\0') {
+			puts(HELPTEXT);
+			return EXIT_FAILURE;
+		}
+		const char *const arg = argv[++i];
+		switch (argv[i - 1][1]) {
+		case 'r':
+			if (sscanf(arg, "%ux%u", &res_x, &res_y) != 2 || !res_x || !res_y) {
+				puts(HELPTEXT);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'm':
+			min_time_ns = strtoull(arg, NULL, 10) * 1000000u;
+			break;
+		case 's':
+			save_path = arg;
+			break;
+		case 'b':
+			baseline_path = arg;
+			break;
+		case 't':
+			n_threads = strtoul(arg, NULL, 10);
+			break;
+		default:
+			puts(HELPTEXT);
+			return EXIT_FAILURE;
+		}
+	}
+	filters = argv + i;
+	n_filters = argc - i;
+
+	if (tgl_boot())
+		die("tgl_boot");
+
+	shader_simple = (TGLPixelShaderSimple){
+		.color = TGL_PIXFMT(TGL_IDX(TGL_WHITE)),
+		.grad = &gradient_min,
+	};
+
+	bench_raster();
+	bench_teapot();
+	bench_flush();
+
+	printf("%-28s %14s %14s %14s\n", "benchmark", "ns/op", "Mpixels/s", "bytes/frame");
+	unsigned j;
+	for (j = 0; j < n_results; j++) {
+		printf("%-28s %14.1f %14.2f ", results[j].name, results[j].ns_op, results[j].pixels_s * 1e-6);
+		if (results[j].bytes_frame)
+			printf("%14.0f\n", results[j].bytes_frame);
+		else
+			printf("%14s\n", "-");
+	}
+
+	if (baseline_path && results_compare(baseline_path))
+		die(baseline_path);
+	if (save_path && results_save(save_path))
+		die(save_path);
+	return 0;
+}
@@ -24,12 +24,6 @@
 #include <time.h>
 #endif
 
-typedef struct STLTriangle {
-	float normal[3]; //normal is unreliable so it is not used.
-	float vertices[3][3];
-	uint16_t attribute_bytes; //attribute bytes is unreliable so it is not used.
-} __attribute__((packed)) STLTriangle;
-
 #define xstr(str_) str(str_)
 #define str(str_) #str_
 
@@ -66,7 +60,6 @@ static const uint8_t colors[] = {
 };
 
 static void teapot_pixel_shader(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
-static uint32_t stl_load(FILE *file, TGLTriangle **triangles);
 static uint8_t rgb_map_circle(const int dx, const int dy);
 static void sleep_ms(const unsigned long ms);
 
@@ -98,27 +91,6 @@ void teapot_pixel_shader(const uint8_t u, const uint8_t v, TGLPixFmt *color, cha
 	(void)v;
 }
 
-uint32_t stl_load(FILE *file, TGLTriangle **triangles)
-{
-	//ensure that file is binary instead of ascii
-	char header[5];
-	assert(fread(header, sizeof(char), 5, file) == 5);
-	assert(strncmp("solid", header, 5));
-
-	assert(fseek(file, sizeof(uint8_t[80]), SEEK_SET) == 0);
-	uint32_t num_triangles;
-	assert(fread(&num_triangles, sizeof(uint32_t), 1, file) == 1);
-	*triangles = malloc(sizeof(TGLTriangle) * num_triangles);
-
-	uint32_t i;
-	for (i = 0; i < num_triangles; i++) {
-		STLTriangle stl_triangle;
-		assert(fread(&stl_triangle, sizeof(STLTriangle), 1, file) == 1);
-		memcpy((*triangles)[i], stl_triangle.vertices, sizeof(float[3][3]));
-	}
-	return num_triangles;
-}
-
 void sleep_ms(const unsigned long ms)
 {
 #ifdef TGL_OS_WINDOWS
@@ -214,11 +186,15 @@ void demo_teapot(const unsigned res_x, const unsigned res_y, const unsigned fram
 	tgl_camera(camera, res_x, res_y, 1.57f, 0.1f, 5.f);
 
 	// Load triangles
-	TGLTriangle *trigs;
-	FILE *stl_file = fopen("demo/utah_teapot.stl", "rb");
-	assert(stl_file);
-	uint32_t n_trigs = stl_load(stl_file, &trigs);
-	fclose(stl_file);
+	TGLMesh mesh;
+	assert(!tglmesh_load_stl(&mesh, "demo/utah_teapot.stl"));
+	const size_t n_trigs = mesh.n_triangles;
+	TGLTriangle *trigs = malloc(sizeof(TGLTriangle) * n_trigs);
+	assert(trigs);
+	size_t i;
+	for (i = 0; i < n_trigs; i++)
+		tglmesh_stl_triangle(&mesh, i, trigs[i]);
+	tglmesh_free(&mesh);
 
 	TGLMat temp;
 
@@ -260,7 +236,6 @@ void demo_teapot(const unsigned res_x, const unsigned res_y, const unsigned fram
 		tgl_mulmat((const TGLVec4 *)obj_translate, (const TGLVec4 *)obj_scale, temp);
 		tgl_mulmat((const TGLVec4 *)temp, (const TGLVec4 *)obj_rotate, obj_t);
 
-		unsigned i;
 		for (i = 0; i < n_trigs; i++) {
 			// Generate final transformation matrix
 			TGLMat to_view;
@@ -747,7 +722,7 @@ void demo_mouse(const unsigned res_x, const unsigned res_y, const unsigned frame
 	TGLMouseEvent *mouse_events = calloc(count_mouse_events, sizeof(TGLMouseEvent));
 
 	assert(!tglutil_set_echo_input(false));
-	assert(!tglutil_set_mouse_tracking_enabled(true));
+	assert(!tglutil_set_mouse_tracking_ex(true, TGL_MOUSE_SGR));
 
 	tgl_puts(tgl, 0, 0, "Move the mouse.", TGL_PIXFMT(TGL_IDX(TGL_WHITE)));
 	assert(!tgl_flush(tgl));
@@ -6,15 +6,33 @@
  * Full license information available in the project LICENSE file.
  **/
 
+#if (defined(TERMGL_THREADS) || defined(TERMGL_PROFILE) || defined(TERMGL_RECORD) || defined(TERMGLUTIL) || defined(TERMGLMESH)) && !defined(_WIN32) && !defined(WIN32) && !defined(_POSIX_C_SOURCE) && !defined(_XOPEN_SOURCE)
+/* clock_gettime and nanosleep pace frames printed by TGL_ASYNC_FLUSH, time stages of TERMGL_PROFILE, and timestamp frames of TERMGL_RECORD. TERMGLUTIL handles SIGWINCH with sigaction and SA_RESTART (XSI). TERMGLMESH maps files with mmap */
+#define _XOPEN_SOURCE 600
+#endif
+
 #include "termgl.h"
 
 #include <errno.h>
+#include <float.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef TGL_OS_WINDOWS
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#if (defined(TERMGL_THREADS) || defined(TERMGL_PROFILE) || defined(TERMGL_RECORD)) && !defined(TGL_OS_WINDOWS)
+#include <time.h>
+#endif
+
 #define TGL_MALLOC malloc
+#define TGL_REALLOC realloc
 #define TGL_FREE free
 #define TGL_CLEAR_SCR                                    \
 	do {                                             \
@@ -41,10 +59,234 @@
 	} while (0)
 #endif
 
-typedef struct Pixel {
-	char v_char;
-	TGLPixFmt color;
-} Pixel;
+#ifdef TERMGL_THREADS
+#ifdef TGL_OS_WINDOWS
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Cond;
+#define THREAD_FUNC(name, arg) DWORD WINAPI name(LPVOID arg)
+#define THREAD_FUNC_RETURN return 0
+#define MUTEX_INIT(mutex) (InitializeCriticalSection(mutex), 0)
+#define MUTEX_DESTROY(mutex) DeleteCriticalSection(mutex)
+#define MUTEX_LOCK(mutex) EnterCriticalSection(mutex)
+#define MUTEX_UNLOCK(mutex) LeaveCriticalSection(mutex)
+#define COND_INIT(cond) (InitializeConditionVariable(cond), 0)
+#define COND_DESTROY(cond) ((void)(cond))
+#define COND_WAIT(cond, mutex) SleepConditionVariableCS((cond), (mutex), INFINITE)
+#define COND_BROADCAST(cond) WakeAllConditionVariable(cond)
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+#define THREAD_FUNC(name, arg) void *name(void *arg)
+#define THREAD_FUNC_RETURN return NULL
+#define MUTEX_INIT(mutex) pthread_mutex_init((mutex), NULL)
+#define MUTEX_DESTROY(mutex) pthread_mutex_destroy(mutex)
+#define MUTEX_LOCK(mutex) pthread_mutex_lock(mutex)
+#define MUTEX_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+#define COND_INIT(cond) pthread_cond_init((cond), NULL)
+#define COND_DESTROY(cond) pthread_cond_destroy(cond)
+#define COND_WAIT(cond, mutex) pthread_cond_wait((cond), (mutex))
+#define COND_BROADCAST(cond) pthread_cond_broadcast(cond)
+#endif
+
+typedef void PoolJob(void *ctx, unsigned thread);
+
+typedef struct PoolThread {
+	Thread handle;
+	struct Pool *pool;
+	unsigned index;
+} PoolThread;
+
+/* Persistent worker threads which all run the same job, together with the calling thread */
+typedef struct Pool {
+	Mutex mutex;
+	Cond cond_start;
+	Cond cond_done;
+	PoolJob *job;
+	void *ctx;
+	unsigned generation;
+	unsigned n_busy;
+	unsigned counter;
+	bool quit;
+	unsigned n_threads; /* including calling thread */
+	PoolThread threads[];
+} Pool;
+#endif /* TERMGL_THREADS */
+
+#if defined(TERMGL3D) && defined(TERMGL_THREADS)
+typedef struct Batch Batch;
+#endif
+
+#ifdef TERMGL_THREADS
+#define FLUSH_BANDS_MAX 64
+#define FLUSH_PARALLEL_MIN 16384u /* smaller frames are assembled on the calling thread */
+
+/* Bands of rows of a flush, which are assembled in parallel */
+typedef struct FlushBands {
+	const TGL *tgl;
+	char *begin;
+	unsigned band_rows;
+	unsigned n_bands;
+	char *ends[FLUSH_BANDS_MAX];
+} FlushBands;
+#endif
+
+/* Frame buffer is stored as separate planes of chars and colors so it can be cleared with memset and compared with memcmp
+ * Colors are normalized by itgl_pixfmt_norm when stored, so that equivalent colors are bitwise equal
+ **/
+typedef struct Frame {
+	TGLPixFmt *colors;
+	char *chars;
+} Frame;
+
+#define FRAME_BYTES(size) ((sizeof(TGLPixFmt) + sizeof(char)) * (size))
+
+/* UTF-8 encoding printed for a char of the frame buffer, whose bytes are copied 4 at a time and len kept */
+typedef struct Glyph {
+	char bytes[4];
+	uint8_t len;
+} Glyph;
+
+/* Inclusive range of columns of a row, which is empty if x0 > x1 */
+typedef struct RowRange {
+	int x0;
+	int x1;
+} RowRange;
+
+#ifdef TERMGL_THREADS
+/* Thread which prints frames submitted by tgl_flush if TGL_ASYNC_FLUSH is enabled
+ * A frame submitted before the previous one started printing replaces it
+ * State of the TGL used for printing is only changed while the thread is not printing
+ **/
+typedef struct Presenter {
+	Thread handle;
+	Mutex mutex;
+	Cond cond; /* broadcast when a frame is submitted or printed, and when quitting */
+	Frame pending; /* copy of frame_buffer made by tgl_flush */
+	Frame frame; /* frame being printed */
+	RowRange *pending_dirty_rows; /* dirty_rows of TGL at submissions of pending frames */
+	RowRange *dirty_rows; /* of frame, allocated after pending_dirty_rows */
+	bool pending_valid;
+	bool busy; /* printing frame */
+	bool quit;
+	int error; /* errno of last failed print, reported by tgl_flush */
+#ifdef TERMGL_PROFILE
+	TGLStats stats; /* of printed frames */
+#endif
+} Presenter;
+#endif
+
+/* Inclusive bounds which drawing functions are restricted to */
+typedef struct Rect {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+} Rect;
+
+/* Rasterizes a line between vertices clipped to the screen, restricted to rect */
+typedef void LineRasterizer(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+
+/* Edge function a * x + b * y + c, which is positive on the inner side of the edge */
+typedef struct Edge {
+	int64_t a;
+	int64_t b;
+	int64_t c;
+} Edge;
+
+/* Attribute interpolated across a triangle as c + dx * x + dy * y, in fixed point */
+typedef struct Plane {
+	int64_t c;
+	int64_t dx;
+	int64_t dy;
+} Plane;
+
+/* Span shader used in place of a pixel shader in triangle fills, set by tgl_set_span_shader */
+typedef struct SpanShaderBinding {
+	TGLPixelShader *pixel_shader;
+	TGLSpanShader *span_shader;
+} SpanShaderBinding;
+
+#define SPAN_SHADERS_MAX 8
+
+/* Data of itgl_span_shader_pixel, which shades spans by calling a pixel shader for each pixel */
+typedef struct PixelShaderAdapter {
+	TGLPixelShader *shader;
+	const void *data;
+} PixelShaderAdapter;
+
+/* Growable buffer of output encoded by tgl_broadcast_encode, or by tgl_player_asciicast */
+typedef struct BroadcastChunk {
+	char *data;
+	size_t len;
+	size_t capacity;
+} BroadcastChunk;
+
+typedef struct BroadcastFrame {
+	BroadcastChunk delta;
+	BroadcastChunk keyframe; /* only used by keyframes */
+} BroadcastFrame;
+
+/* Frame seq is kept in frames[seq % keyframe_interval], so the last keyframe and all frames after it are kept
+ * Frames are encoded into next, which is swapped with the frame it replaces once encoded
+ **/
+struct TGLBroadcast {
+	unsigned width;
+	unsigned height;
+	unsigned keyframe_interval;
+	uint64_t n_frames;
+	Frame prev_frame_buffer;
+	bool prev_frame_valid;
+	char *output_buffer;
+	size_t output_buffer_size;
+	BroadcastFrame next;
+	BroadcastFrame frames[];
+};
+
+/* Run of opaque pixels of a row of a TGLSprite, whose colors and chars start at offset */
+typedef struct SpriteRun {
+	uint16_t x;
+	uint16_t length;
+	uint32_t offset;
+} SpriteRun;
+
+/* Runs of row y are runs[rows[y]] to runs[rows[y + 1] - 1], ordered by x
+ * All arrays are allocated in one block after the struct
+ **/
+struct TGLSprite {
+	unsigned width;
+	unsigned height;
+	SpriteRun *runs;
+	uint32_t *rows;
+	TGLPixFmt *colors;
+	char *chars;
+};
+
+/* Formats of the z-buffer, each with its own variants of depth testing rasterizers */
+enum ZFormat {
+	Z_FORMAT_NONE = 0,
+	Z_FORMAT_F32,
+	Z_FORMAT_U16,
+};
+
+/* Buffers sized by the dimensions of a TGL, which tgl_init_ex can reserve in its arena */
+enum ArenaSlot {
+	ARENA_FRAME_BUFFER = 0,
+	ARENA_Z_BUFFER,
+	ARENA_OUTPUT_BUFFER,
+	ARENA_PREV_FRAME,
+	ARENA_DIRTY_ROWS,
+	ARENA_QUANTIZE,
+	ARENA_CELLS,
+#ifdef TERMGL_THREADS
+	ARENA_PRESENTER,
+#endif
+	ARENA_SLOTS,
+};
+
+#define ARENA_ALIGN 64u /* cache line */
 
 struct TGL {
 	unsigned width;
@@ -52,12 +294,58 @@ struct TGL {
 	int max_x;
 	int max_y;
 	unsigned frame_size;
-	Pixel *frame_buffer;
-	float *z_buffer;
+	Frame frame_buffer;
+	Frame prev_frame_buffer;
+	RowRange *dirty_rows; /* columns of each row which may differ from prev_frame_buffer, or NULL if TGL_DIFF_FLUSH is disabled */
+	RowRange *drawn_rows; /* columns of each row which may not be blank since frame_buffer was cleared, allocated after dirty_rows */
+	void *z_buffer; /* float, or uint16_t if TGL_Z_BUFFER_16 is enabled */
+	float *z_tiles; /* minimum depth of each tile of z_buffer, as stored in it */
+	uint8_t *z_tiles_count; /* number of pixels of tile at its minimum depth, or 0 if minimum has to be refreshed */
+	unsigned z_tiles_x;
+	int64_t z_unorm_bias; /* added to fixed point depth, before shifting it right by z_unorm_shift into the range of TGL_Z_BUFFER_16 */
+	unsigned z_unorm_shift;
+	uint8_t z_format; /* ZFormat of z_buffer, or Z_FORMAT_NONE if depth is not tested */
 	char *output_buffer;
-	unsigned output_buffer_size;
-	bool z_buffer_enabled;
-	uint8_t settings;
+	size_t output_buffer_size;
+	bool prev_frame_valid;
+	int output_fd;
+	TGLOutputCallback *output_callback;
+	void *output_ctx;
+	char *output_memory; /* buffer of tgl_flush_to_memory, written to in place of other outputs */
+	size_t output_memory_size;
+	size_t output_memory_len; /* length of output, which may exceed output_memory_size */
+	uint32_t settings;
+	SpanShaderBinding span_shaders[SPAN_SHADERS_MAX];
+	unsigned n_span_shaders;
+	TGLPixFmt *quantize_colors; /* colors of frame_buffer quantized by tgl_flush, or NULL if colors are not quantized */
+	uint8_t *quantize_lut; /* palette color of each QUANTIZE_INDEX */
+	uint8_t (*quantize_channels)[256]; /* dithered QUANTIZE_BITS of channel values at each position of dither_bayer */
+	uint8_t quantize_flags; /* FMT_IDX256 if quantize_lut holds xterm-256 colors */
+	TGLAllocator allocator;
+	char *arena; /* block holding this struct, frame_buffer and arena_slots, or NULL if they are allocated separately */
+	size_t arena_size;
+	void *arena_slots[ARENA_SLOTS]; /* buffers reserved in arena, or NULL if allocated when needed */
+	size_t arena_slot_sizes[ARENA_SLOTS];
+	size_t capacity[ARENA_SLOTS]; /* bytes of buffer of each slot, which tgl_resize reuses while they suffice */
+	bool clear_screen; /* next frame printed in full clears the screen also if TGL_PROGRESSIVE is enabled */
+	const Glyph *glyphs; /* encodings of all 256 chars, or NULL if chars are printed as they are */
+	RowRange *cells; /* dirty rows and frame of cells which TGL_HALF_BLOCK and TGL_BRAILLE resolve pixels into, or NULL */
+#ifdef TERMGL3D
+	TGLVec4 *mesh_verts; /* vertex shader output of tgl_draw_mesh */
+	size_t mesh_verts_capacity;
+#endif
+#ifdef TERMGL_THREADS
+	Pool *pool;
+#ifdef TERMGL3D
+	Batch *batch;
+#endif
+	Presenter *presenter;
+	uint64_t frame_interval; /* minimum ns between starts of printing frames by presenter */
+#endif
+#ifdef TERMGL_PROFILE
+	TGLStats *stats; /* slot of each thread of pool, written through const TGL by drawing functions */
+	unsigned n_stats;
+#endif
 };
 
 #define SWAP(typ, a, b)                \
@@ -69,29 +357,79 @@ struct TGL {
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define XOR(a, b) (((bool)(a)) != ((bool)(b)))
+#define ALIGN_UP(n, align) (((n) + (align) - 1) / (align) * (align))
+
+#define SET_PIXEL_RAW(tgl, x, y, v_char_, color_)                                          \
+	do {                                                                               \
+		(tgl)->frame_buffer.chars[(y) * (tgl)->width + (x)] = (v_char_);           \
+		(tgl)->frame_buffer.colors[(y) * (tgl)->width + (x)] = itgl_pixfmt_norm(color_); \
+	} while (0)
+
+#define SET_PIXEL_FLAT(tgl, x, y, z, u, v, t, data)                         \
+	do {                                                                \
+		char __set_pixel_c;                                         \
+		TGLPixFmt __set_pixel_color;                                \
+		t(u, v, &__set_pixel_color, &__set_pixel_c, data);          \
+		SET_PIXEL_RAW(tgl, x, y, __set_pixel_c, __set_pixel_color); \
+		STATS_ADD(tgl, pixels_shaded, 1);                           \
+	} while (0)
 
-#define SET_PIXEL_RAW(tgl, x, y, v_char_, color_)                            \
-	do {                                                                 \
-		*(&(tgl)->frame_buffer[(y) * (tgl)->width + (x)]) = (Pixel){ \
-			.v_char = (v_char_),                                 \
-			.color = (color_),                                   \
-		};                                                           \
+/* Depth is converted to depth_t by the caller, in which it is compared to and stored into z_buffer of buf_t */
+#define SET_PIXEL_DEPTH_AS(tgl, x, y, buf_t, depth_t, depth, u, v, t, data)                           \
+	do {                                                                                          \
+		buf_t *const __set_pixel_z = (buf_t *)(tgl)->z_buffer + (y) * (tgl)->width + (x);     \
+		const depth_t __set_pixel_depth = (depth);                                            \
+		if (__set_pixel_depth >= *__set_pixel_z) {                                            \
+			char __set_pixel_c;                                                           \
+			TGLPixFmt __set_pixel_color;                                                  \
+			t(u, v, &__set_pixel_color, &__set_pixel_c, data);                            \
+			SET_PIXEL_RAW(tgl, x, y, __set_pixel_c, __set_pixel_color);                   \
+			itgl_z_tile_write(tgl, Z_TILE(tgl, x, y), *__set_pixel_z, __set_pixel_depth); \
+			*__set_pixel_z = (buf_t)__set_pixel_depth;                                    \
+			STATS_ADD(tgl, pixels_shaded, 1);                                             \
+		} else {                                                                              \
+			STATS_ADD(tgl, pixels_depth_rejected, 1);                                     \
+		}                                                                                     \
 	} while (0)
 
-#define SET_PIXEL(tgl, x, y, z, u, v, t, data)                                      \
-	do {                                                                        \
-		char __set_pixel_c;                                                 \
-		TGLPixFmt __set_pixel_color;                                        \
-		if (!(tgl)->z_buffer_enabled) {                                     \
-			t(u, v, &__set_pixel_color, &__set_pixel_c, data);          \
-			SET_PIXEL_RAW(tgl, x, y, __set_pixel_c, __set_pixel_color); \
-		} else if ((z) >= (tgl)->z_buffer[(y) * (tgl)->width + (x)]) {      \
-			t(u, v, &__set_pixel_color, &__set_pixel_c, data);          \
-			SET_PIXEL_RAW(tgl, x, y, __set_pixel_c, __set_pixel_color); \
-			(tgl)->z_buffer[(y) * (tgl)->width + (x)] = z;              \
-		}                                                                   \
+#define SET_PIXEL_DEPTH(tgl, x, y, z, u, v, t, data) SET_PIXEL_DEPTH_AS(tgl, x, y, float, float, z, u, v, t, data)
+#define SET_PIXEL_DEPTH16(tgl, x, y, z, u, v, t, data) \
+	SET_PIXEL_DEPTH_AS(tgl, x, y, uint16_t, int32_t, itgl_depth_unorm16(tgl, itgl_depth_fixed(z)), u, v, t, data)
+
+#define SET_PIXEL(tgl, x, y, z, u, v, t, data)                          \
+	do {                                                            \
+		switch ((tgl)->z_format) {                              \
+		case Z_FORMAT_NONE:                                     \
+			SET_PIXEL_FLAT(tgl, x, y, z, u, v, t, data);    \
+			break;                                          \
+		case Z_FORMAT_F32:                                      \
+			SET_PIXEL_DEPTH(tgl, x, y, z, u, v, t, data);   \
+			break;                                          \
+		case Z_FORMAT_U16:                                      \
+			SET_PIXEL_DEPTH16(tgl, x, y, z, u, v, t, data); \
+			break;                                          \
+		}                                                       \
 	} while (0)
 
+/* The z-buffer is divided into tiles with a minimum depth, against which triangles are rejected
+ * Writes only increase depth, so the minimum stays exact until the last pixel at it is overwritten
+ * It then stays conservative until it is refreshed from the z-buffer
+ **/
+#define Z_TILE_SHIFT 3
+#define Z_TILE_SIZE (1 << Z_TILE_SHIFT)
+#define Z_TILE(tgl, x, y) (((unsigned)(y) >> Z_TILE_SHIFT) * (tgl)->z_tiles_x + ((unsigned)(x) >> Z_TILE_SHIFT))
+/* Bytes of z_buffer in the format of settings of tgl, which its tiles are allocated after */
+#define Z_TILES_OFFSET(tgl) ALIGN_UP((((tgl)->settings & TGL_Z_BUFFER_16) ? sizeof(uint16_t) : sizeof(float)) * (tgl)->frame_size, sizeof(float))
+
+/* Fixed point scale of interpolated attributes in itgl_triangle_fill */
+#define FILL_UV_SHIFT 16
+#define FILL_UV_SCALE ((double)(1 << FILL_UV_SHIFT))
+#define FILL_Z_SCALE 4294967296. /* 2^32 */
+#define FILL_SCAN_WIDTH 16
+
+#define SCREEN_RECT(tgl) ((Rect){ .x0 = 0, .y0 = 0, .x1 = (tgl)->max_x, .y1 = (tgl)->max_y })
+#define RECT_CONTAINS(rect, x, y) ((x) >= (rect)->x0 && (x) <= (rect)->x1 && (y) >= (rect)->y0 && (y) <= (rect)->y1)
+
 #define CALL(stmt, retval)              \
 	do {                            \
 		if (TGL_UNLIKELY(stmt)) \
@@ -99,12 +437,138 @@ struct TGL {
 	} while (0)
 #define CALL_STDOUT(stmt, retval) CALL((stmt) == EOF, retval)
 
+/* Statistics of TERMGL_PROFILE are accumulated in the slot of the current thread, so threads do not share counters */
+#ifdef TERMGL_PROFILE
+#ifdef TERMGL_THREADS
+#ifdef _MSC_VER
+#define TGL_THREAD_LOCAL __declspec(thread)
+#else
+#define TGL_THREAD_LOCAL __thread
+#endif
+#define STATS(tgl) (&(tgl)->stats[itgl_stats_slot])
+#else
+#define STATS(tgl) ((tgl)->stats)
+#endif
+#define STATS_ADD(tgl, field, n) (STATS(tgl)->field += (n))
+#define STATS_TIME_BEGIN(name) const uint64_t __stats_time_##name = itgl_time_ns()
+#define STATS_TIME_END(tgl, field, name) STATS_ADD(tgl, field, itgl_time_ns() - __stats_time_##name)
+#else
+#define STATS_ADD(tgl, field, n) ((void)0)
+#define STATS_TIME_BEGIN(name) ((void)0)
+#define STATS_TIME_END(tgl, field, name) ((void)0)
+#endif
+
+/* Longest non-rgb SGR code: \033[22;24;XX;10Xm (length 15)
+ * Longest rgb SGR code: \033[22;24;38;2;XXX;XXX;XXX;48;2;XXX;XXX;XXXm (length 42)
+ * CUP code: \033[YYYYYYYYYY;XXXXXXXXXXH (length 24)
+ * Maximum 74 chars per pixel: CUP + SGR + 2 x char of up to 4 bytes (Glyph)
+ * Per line: DECDWL code: \033#6 (length 3) + 1 Newline character
+ * At end of frame: CUP + SGR clear code: \033[0m (length 28)
+ **/
+#define OUTPUT_ROW_MAX(tgl) ((tgl)->width * 74u + 32u)
+/* {Clear screen code: \033[1;1H\033[2J } (length 10) OR {SGR set cursor position code: \033[;H } (length 4) */
+#define OUTPUT_HEADER_MAX 10u
+
 #define MIX(begin, end, d) ((begin) * (d) + (end) * (1 - (d)))
 
 #define RGB_EQ(rgb0, rgb1) (((rgb0).r == (rgb1).r) && ((rgb0).g == (rgb1).g) && ((rgb0).b == (rgb1).b))
-#define COLOR_EQ(color0, color1) (!(((color0).flags ^ (color1).flags) & TGL_RGB24) \
-	&& (((color0).flags & TGL_RGB24) ? (RGB_EQ((color0).color.rgb, (color1).color.rgb)) : ((color0).color.indexed == (color1).color.indexed)))
-#define PIXFMT_EQ(color0, color1) (COLOR_EQ((color0).fg, (color1).fg) && COLOR_EQ((color0).bkg, (color1).bkg))
+
+/* TGLFmt flag of colors quantized by TGL_QUANTIZE_256, whose color.indexed is an xterm-256 color. Never stored in the frame buffer */
+#define FMT_IDX256 0x02
+/* Length of SGR parameter of an xterm-256 color preceded by ';', e.g. ";38;5;N" */
+#define SGR_IDX256_LEN(idx) (7u + ((idx) >= 10) + ((idx) >= 100))
+
+/* Quantized colors are looked up by the 5 most significant bits of each channel */
+#define QUANTIZE_BITS 5
+#define QUANTIZE_LUT_SIZE (1u << (3 * QUANTIZE_BITS))
+#define QUANTIZE_INDEX(r, g, b) (((r) << (2 * QUANTIZE_BITS)) | ((g) << QUANTIZE_BITS) | (b))
+/* Dithering offsets channels by up to about half the distance between neighbouring palette colors */
+#define QUANTIZE_DITHER_256 40
+#define QUANTIZE_DITHER_16 96
+/* Colors printed by tgl_flush */
+#define FLUSH_COLORS(tgl) ((tgl)->quantize_colors ? (tgl)->quantize_colors : (tgl)->frame_buffer.colors)
+
+/* Only valid for colors normalized by itgl_pixfmt_norm */
+#define PIXFMT_EQ(color0, color1) (!memcmp(&(color0), &(color1), sizeof(TGLPixFmt)))
+
+/* Pixels per cell printed with TGL_HALF_BLOCK, or TGL_BRAILLE which takes precedence */
+#define CELL_W(settings) (((settings) & TGL_BRAILLE) ? 2u : 1u)
+#define CELL_H(settings) (((settings) & TGL_BRAILLE) ? 4u : 2u)
+/* Rows of cells of TGL_HALF_BLOCK, which has at least as many cells as TGL_BRAILLE */
+#define CELL_ROWS_MAX(height) (((height) + 1u) / 2u)
+
+/* Chars of cells of TGL_HALF_BLOCK. The upper pixel is the foreground of the upper half block */
+enum {
+	CELL_BLANK = 0,
+	CELL_UPPER_HALF = 1,
+};
+
+/* Decimal strings of RGB channel values preceded by ';', which are copied 4 bytes at a time */
+static const char sgr_channels[256][5] = {
+	";0", ";1", ";2", ";3", ";4", ";5", ";6", ";7", ";8", ";9", ";10", ";11", ";12", ";13", ";14", ";15",
+	";16", ";17", ";18", ";19", ";20", ";21", ";22", ";23", ";24", ";25", ";26", ";27", ";28", ";29", ";30", ";31",
+	";32", ";33", ";34", ";35", ";36", ";37", ";38", ";39", ";40", ";41", ";42", ";43", ";44", ";45", ";46", ";47",
+	";48", ";49", ";50", ";51", ";52", ";53", ";54", ";55", ";56", ";57", ";58", ";59", ";60", ";61", ";62", ";63",
+	";64", ";65", ";66", ";67", ";68", ";69", ";70", ";71", ";72", ";73", ";74", ";75", ";76", ";77", ";78", ";79",
+	";80", ";81", ";82", ";83", ";84", ";85", ";86", ";87", ";88", ";89", ";90", ";91", ";92", ";93", ";94", ";95",
+	";96", ";97", ";98", ";99", ";100", ";101", ";102", ";103", ";104", ";105", ";106", ";107", ";108", ";109", ";110", ";111",
+	";112", ";113", ";114", ";115", ";116", ";117", ";118", ";119", ";120", ";121", ";122", ";123", ";124", ";125", ";126", ";127",
+	";128", ";129", ";130", ";131", ";132", ";133", ";134", ";135", ";136", ";137", ";138", ";139", ";140", ";141", ";142", ";143",
+	";144", ";145", ";146", ";147", ";148", ";149", ";150", ";151", ";152", ";153", ";154", ";155", ";156", ";157", ";158", ";159",
+	";160", ";161", ";162", ";163", ";164", ";165", ";166", ";167", ";168", ";169", ";170", ";171", ";172", ";173", ";174", ";175",
+	";176", ";177", ";178", ";179", ";180", ";181", ";182", ";183", ";184", ";185", ";186", ";187", ";188", ";189", ";190", ";191",
+	";192", ";193", ";194", ";195", ";196", ";197", ";198", ";199", ";200", ";201", ";202", ";203", ";204", ";205", ";206", ";207",
+	";208", ";209", ";210", ";211", ";212", ";213", ";214", ";215", ";216", ";217", ";218", ";219", ";220", ";221", ";222", ";223",
+	";224", ";225", ";226", ";227", ";228", ";229", ";230", ";231", ";232", ";233", ";234", ";235", ";236", ";237", ";238", ";239",
+	";240", ";241", ";242", ";243", ";244", ";245", ";246", ";247", ";248", ";249", ";250", ";251", ";252", ";253", ";254", ";255",
+};
+
+static const Glyph glyphs_half_block[256] = {
+	[CELL_BLANK] = { { ' ' }, 1 },
+	[CELL_UPPER_HALF] = { { (char)0xe2, (char)0x96, (char)0x80 }, 3 }, /* U+2580 */
+};
+
+/* Chars of cells of TGL_BRAILLE are masks of dots, printed as U+2800 + mask. Cells without dots are printed as a space, which is shorter */
+#define GLYPH_BRAILLE(mask) { { (char)0xe2, (char)(0xa0 | ((mask) >> 6)), (char)(0x80 | ((mask) & 0x3f)) }, 3 }
+#define GLYPH_BRAILLE4(mask) GLYPH_BRAILLE(mask), GLYPH_BRAILLE((mask) + 1), GLYPH_BRAILLE((mask) + 2), GLYPH_BRAILLE((mask) + 3)
+#define GLYPH_BRAILLE16(mask) GLYPH_BRAILLE4(mask), GLYPH_BRAILLE4((mask) + 4), GLYPH_BRAILLE4((mask) + 8), GLYPH_BRAILLE4((mask) + 12)
+#define GLYPH_BRAILLE64(mask) GLYPH_BRAILLE16(mask), GLYPH_BRAILLE16((mask) + 16), GLYPH_BRAILLE16((mask) + 32), GLYPH_BRAILLE16((mask) + 48)
+static const Glyph glyphs_braille[256] = {
+	{ { ' ' }, 1 }, GLYPH_BRAILLE(1), GLYPH_BRAILLE(2), GLYPH_BRAILLE(3),
+	GLYPH_BRAILLE4(4), GLYPH_BRAILLE4(8), GLYPH_BRAILLE4(12),
+	GLYPH_BRAILLE16(16), GLYPH_BRAILLE16(32), GLYPH_BRAILLE16(48),
+	GLYPH_BRAILLE64(64), GLYPH_BRAILLE64(128), GLYPH_BRAILLE64(192),
+};
+
+/* Dot of each pixel of a braille cell, by row and column */
+static const uint8_t braille_dots[4][2] = {
+	{ 0x01, 0x08 },
+	{ 0x02, 0x10 },
+	{ 0x04, 0x20 },
+	{ 0x40, 0x80 },
+};
+
+#if defined(TERMGL_PROFILE) && defined(TERMGL_THREADS)
+/* Index of pool thread, which is 0 on threads outside of pools */
+static TGL_THREAD_LOCAL unsigned itgl_stats_slot;
+#endif
+
+/* Default xterm colors of indexed colors */
+static const TGLRGB palette_16[16] = {
+	{ 0, 0, 0 }, { 205, 0, 0 }, { 0, 205, 0 }, { 205, 205, 0 }, { 0, 0, 238 }, { 205, 0, 205 }, { 0, 205, 205 }, { 229, 229, 229 },
+	{ 127, 127, 127 }, { 255, 0, 0 }, { 0, 255, 0 }, { 255, 255, 0 }, { 92, 92, 255 }, { 255, 0, 255 }, { 0, 255, 255 }, { 255, 255, 255 },
+};
+
+/* Channel values of the 6x6x6 color cube of xterm-256 colors 16-231. Colors 232-255 are grays 8, 18, ..., 238 */
+static const uint8_t palette_cube[6] = { 0, 95, 135, 175, 215, 255 };
+
+/* 4x4 Bayer matrix of ordered dithering */
+static const uint8_t dither_bayer[16] = {
+	0, 8, 2, 10,
+	12, 4, 14, 6,
+	3, 11, 1, 9,
+	15, 7, 13, 5,
+};
 
 #ifndef TERMGL_MINIMAL
 const TGLGradient gradient_full = {
@@ -119,10 +583,111 @@ const TGLGradient gradient_min = {
 #endif /* ~TERMGL_MINIMAL */
 
 static void itgl_clip(const TGL *tgl, int *x, int *y);
+static inline TGLPixFmt itgl_pixfmt_norm(TGLPixFmt color);
+static int itgl_quantize_init(TGL *tgl);
+static void itgl_quantize_frame(TGL *tgl, bool dirty);
+static inline TGLPixFmt itgl_pixfmt_quantize(const TGL *tgl, TGLPixFmt color, unsigned x, unsigned y);
+static inline TGLFmt itgl_fmt_quantize(const TGL *tgl, TGLFmt fmt, const uint8_t *channels);
+static unsigned itgl_rgb_dist(TGLRGB rgb0, TGLRGB rgb1);
+static void *itgl_std_alloc(size_t size, void *ctx);
+static void itgl_std_free(void *ptr, void *ctx);
+static void *itgl_alloc(const TGL *tgl, size_t size);
+static void itgl_free(const TGL *tgl, void *ptr);
+static void *itgl_realloc(const TGL *tgl, void *ptr, size_t len, size_t size);
+static size_t itgl_slot_size(const TGL *tgl, enum ArenaSlot slot);
+static void *itgl_slot_alloc(TGL *tgl, enum ArenaSlot slot);
+static void *itgl_slot_get(const TGL *tgl, enum ArenaSlot slot);
+static void itgl_slot_set(TGL *tgl, enum ArenaSlot slot, void *buf);
+static int itgl_z_buffer_alloc(TGL *tgl);
+static void itgl_z_buffer_init(TGL *tgl);
+static void itgl_frame_init(Frame *frame, void *mem, unsigned size);
+static void itgl_frame_copy(Frame *dest, const Frame *src, unsigned size);
+static void itgl_rows_fill(RowRange *rows, unsigned height, int x0, int x1);
+static void itgl_rows_merge(RowRange *dest, const RowRange *src, unsigned height);
+static inline void itgl_dirty_rect(TGL *tgl, int x0, int y0, int x1, int y1);
+static void itgl_dirty_verts(TGL *tgl, const TGLVert *verts, unsigned n);
+static void itgl_prev_frame_update(TGL *tgl, bool all);
+#ifdef TERMGL_THREADS
+static THREAD_FUNC(itgl_pool_worker, arg);
+static Pool *itgl_pool_create(const TGL *tgl, unsigned n_threads);
+static void itgl_pool_delete(const TGL *tgl, Pool *pool);
+static void itgl_pool_run(Pool *pool, PoolJob *job, void *ctx);
+static unsigned itgl_pool_next(Pool *pool);
+static unsigned itgl_pool_threads(const Pool *pool);
+static int itgl_presenter_create(TGL *tgl);
+static void itgl_presenter_delete(TGL *tgl);
+static THREAD_FUNC(itgl_presenter_worker, arg);
+static int itgl_presenter_submit(TGL *tgl);
+static void itgl_presenter_lock(TGL *tgl);
+static void itgl_presenter_unlock(TGL *tgl);
+static void itgl_sleep_ns(uint64_t ns);
+#ifdef TERMGL3D
+static void itgl_batch_free(const TGL *tgl, Batch *batch);
+#endif
+#endif
+#if defined(TERMGL_THREADS) || defined(TERMGL_PROFILE) || defined(TERMGL_RECORD)
+static uint64_t itgl_time_ns(void);
+#endif
+#ifdef TERMGL_PROFILE
+static int itgl_stats_resize(TGL *tgl, unsigned n_stats);
+static void itgl_stats_add(TGLStats *dest, const TGLStats *src);
+#endif
 static inline char *itgl_generate_sgr_rgb_channel(uint8_t val, char *buf);
-static char *itgl_generate_sgr_rgb(TGLRGB rgb, char *buf);
+static inline char *itgl_generate_sgr_rgb(TGLRGB rgb, char *buf);
+static inline char *itgl_generate_sgr_idx256(uint8_t idx, char *buf);
 static char *itgl_generate_sgr(TGLPixFmt color_prev, TGLPixFmt color_cur, char *buf);
-static void itgl_horiz_line(TGL *tgl, int x0, float z0, uint8_t u0, uint8_t v0, int x1, float z1, uint8_t u1, uint8_t v1, int y, TGLPixelShader *t, const void *data);
+static inline char *itgl_generate_sgr_params(TGLPixFmt color_prev, TGLPixFmt color_cur, bool flag_delim, char *buf);
+static bool itgl_sgr_reset_shorter(const TGLPixFmt *color_prev, const TGLPixFmt *color_cur);
+static char *itgl_generate_cup(unsigned row, unsigned col, char *buf);
+static int itgl_present(TGL *tgl);
+static int itgl_present_cells(TGL *tgl);
+static void itgl_resolve_half_block(const TGL *tgl, const Frame *cells, unsigned width, unsigned row, int x0, int x1);
+static void itgl_resolve_braille(const TGL *tgl, const Frame *cells, unsigned width, unsigned row, int x0, int x1);
+static inline TGLFmt itgl_subcell_color(const TGLPixFmt *color, char c);
+static inline char *itgl_put_char(const Glyph *glyphs, char c, char *loc);
+static int itgl_broadcast_present(TGLBroadcast *broadcast, TGL *tgl, uint32_t settings, BroadcastChunk *chunk);
+static int itgl_broadcast_append(const char *buf, size_t len, void *ctx);
+static int itgl_flush_diff(TGL *tgl);
+static int itgl_write(TGL *tgl, const char *buf, size_t len);
+static int itgl_output_reserve(TGL *tgl, char **loc, size_t len);
+static int itgl_flush_frame(TGL *tgl, char **loc);
+static char *itgl_flush_rows(const TGL *tgl, unsigned row_begin, unsigned row_end, TGLPixFmt *color, char *loc);
+#ifdef TERMGL_THREADS
+static char *itgl_flush_bands(TGL *tgl, char *loc);
+static void itgl_flush_band_job(void *ctx, unsigned thread);
+#endif
+static void itgl_line(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+static void itgl_line_shader(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+static void itgl_line_shader_depth(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+static void itgl_line_shader_depth16(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+#ifndef TERMGL_MINIMAL
+static void itgl_line_simple(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+static void itgl_line_simple_depth(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+static void itgl_line_simple_depth16(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+static void itgl_line_texture(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+static void itgl_line_texture_depth(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+static void itgl_line_texture_depth16(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLPixelShader *t, const void *data);
+#endif
+static void itgl_triangle_fill(TGL *tgl, const Rect *rect, TGLVert v0, TGLVert v1, TGLVert v2, TGLPixelShader *t, const void *data);
+static void itgl_fill_span(TGL *tgl, int y, int x, int x_end, const Plane *plane_z, const Plane *plane_u, const Plane *plane_v, TGLSpanShader *s, const void *data);
+static void itgl_fill_span_depth(TGL *tgl, int y, int x, int x_end, const Plane *plane_z, const Plane *plane_u, const Plane *plane_v, TGLSpanShader *s, const void *data);
+static void itgl_fill_span_depth16(TGL *tgl, int y, int x, int x_end, const Plane *plane_z, const Plane *plane_u, const Plane *plane_v, TGLSpanShader *s, const void *data);
+static void itgl_fill_run(TGL *tgl, int y, int x, unsigned length, const Plane *plane_u, const Plane *plane_v, TGLSpanShader *s, const void *data);
+static float itgl_z_tiles_min(TGL *tgl, const Rect *rect);
+static void itgl_z_tile_refresh(TGL *tgl, unsigned tile_x, unsigned tile_y);
+static inline void itgl_z_tile_write(TGL *tgl, unsigned tile, float depth_prev, float depth);
+static inline float itgl_fixed_depth(int64_t z);
+static inline int64_t itgl_depth_fixed(float z);
+static inline int32_t itgl_depth_unorm16(const TGL *tgl, int64_t z);
+static float itgl_plane_depth_max(const TGL *tgl, const Plane *plane, const Rect *rect);
+static TGLSpanShader *itgl_span_shader(const TGL *tgl, TGLPixelShader *t);
+static void itgl_span_shader_pixel(const TGLSpan *span, TGLPixFmt *colors, char *chars, const void *data);
+static inline Edge itgl_edge(TGLVert v0, TGLVert v1);
+static Plane itgl_plane_z(const Edge edges[3], double inv_area, float z0, float z1, float z2);
+static Plane itgl_plane_uv(const Edge edges[3], double inv_area, uint8_t a0, uint8_t a1, uint8_t a2);
+static inline int64_t itgl_div_floor(int64_t num, int64_t den);
+static int itgl_enable(TGL *tgl, uint32_t settings);
+static void itgl_disable(TGL *tgl, uint32_t settings);
 
 #ifndef TERMGL_MINIMAL
 void tgl_pixel_shader_simple(const uint8_t u, const uint8_t v, TGLPixFmt *const color, char *const c, const void *const data)
@@ -141,6 +706,33 @@ void tgl_pixel_shader_texture(uint8_t u, uint8_t v, TGLPixFmt *const color, char
 	*c = shader->chars[idx];
 }
 
+void tgl_span_shader_simple(const TGLSpan *const span, TGLPixFmt *const colors, char *const chars, const void *const data)
+{
+	const TGLPixelShaderSimple *const shader = data;
+	int32_t u = span->u, v = span->v;
+	unsigned i;
+	for (i = 0; i < span->length; i++) {
+		colors[i] = shader->color;
+		chars[i] = tgl_grad_char(shader->grad, TGL_SPAN_UV(u) + TGL_SPAN_UV(v));
+		u += span->du;
+		v += span->dv;
+	}
+}
+
+void tgl_span_shader_texture(const TGLSpan *const span, TGLPixFmt *const colors, char *const chars, const void *const data)
+{
+	const TGLPixelShaderTexture *const shader = data;
+	int32_t u = span->u, v = span->v;
+	unsigned i;
+	for (i = 0; i < span->length; i++) {
+		const unsigned idx = TGL_SPAN_UV(u) * shader->width / 256 + shader->width * (TGL_SPAN_UV(v) * shader->height / 256);
+		colors[i] = shader->colors[idx];
+		chars[i] = shader->chars[idx];
+		u += span->du;
+		v += span->dv;
+	}
+}
+
 char tgl_grad_char(const TGLGradient *const grad, const uint8_t intensity)
 {
 	return grad->grad[grad->length * intensity / 256u];
@@ -153,6 +745,214 @@ inline void itgl_clip(const TGL *const tgl, int *const x, int *const y)
 	*y = MAX(MIN(tgl->max_y, *y), 0);
 }
 
+/* Clears bits which do not affect output */
+inline TGLPixFmt itgl_pixfmt_norm(TGLPixFmt color)
+{
+	color.fg.flags &= TGL_RGB24 | TGL_BOLD | TGL_UNDERLINE;
+	color.bkg.flags &= TGL_RGB24;
+	if (!(color.fg.flags & TGL_RGB24))
+		color.fg.color = (TGLFmtColor){ .indexed = color.fg.color.indexed };
+	if (!(color.bkg.flags & TGL_RGB24))
+		color.bkg.color = (TGLFmtColor){ .indexed = color.bkg.color.indexed };
+	return color;
+}
+
+/* Builds quantize_lut and quantize_channels for the current settings and size, or frees quantize_colors if colors are not quantized
+ * Each entry of quantize_lut is the palette color nearest to the center of its cell of RGB space
+ * quantize_lut and quantize_channels are allocated in the same block, after quantize_colors
+ **/
+int itgl_quantize_init(TGL *const tgl)
+{
+	const bool quantize_16 = tgl->settings & TGL_QUANTIZE_16;
+	if (!(tgl->settings & (TGL_QUANTIZE_256 | TGL_QUANTIZE_16))) {
+		itgl_free(tgl, tgl->quantize_colors);
+		tgl->quantize_colors = NULL;
+		return 0;
+	}
+	if (!tgl->quantize_colors) {
+		tgl->quantize_colors = itgl_slot_alloc(tgl, ARENA_QUANTIZE);
+		if (!tgl->quantize_colors)
+			return -1;
+	}
+	tgl->quantize_lut = (uint8_t *)(tgl->quantize_colors + tgl->frame_size);
+	tgl->quantize_channels = (uint8_t(*)[256])(tgl->quantize_lut + QUANTIZE_LUT_SIZE);
+	tgl->quantize_flags = quantize_16 ? 0 : FMT_IDX256;
+
+	const int spread = !(tgl->settings & TGL_DITHER) ? 0 : quantize_16 ? QUANTIZE_DITHER_16 : QUANTIZE_DITHER_256;
+	unsigned i, j;
+	for (i = 0; i < 16; i++) {
+		const int dither = (2 * dither_bayer[i] - 15) * spread / 32;
+		for (j = 0; j < 256; j++)
+			tgl->quantize_channels[i][j] = MAX(MIN((int)j + dither, 255), 0) >> (8 - QUANTIZE_BITS);
+	}
+
+	const unsigned half = 1u << (7 - QUANTIZE_BITS);
+	for (i = 0; i < QUANTIZE_LUT_SIZE; i++) {
+		const TGLRGB rgb = {
+			.r = ((i >> (2 * QUANTIZE_BITS)) << (8 - QUANTIZE_BITS)) + half,
+			.g = (((i >> QUANTIZE_BITS) & ((1u << QUANTIZE_BITS) - 1)) << (8 - QUANTIZE_BITS)) + half,
+			.b = ((i & ((1u << QUANTIZE_BITS) - 1)) << (8 - QUANTIZE_BITS)) + half,
+		};
+		unsigned best = 0, best_dist = UINT_MAX;
+		if (quantize_16) {
+			for (j = 0; j < 16; j++) {
+				const unsigned dist = itgl_rgb_dist(rgb, palette_16[j]);
+				if (dist < best_dist) {
+					best = j;
+					best_dist = dist;
+				}
+			}
+		} else {
+			/* Channels of the color cube are independent */
+			const uint8_t channels[3] = { rgb.r, rgb.g, rgb.b };
+			unsigned levels[3], channel;
+			for (channel = 0; channel < 3; channel++) {
+				levels[channel] = 0;
+				for (j = 1; j < 6; j++)
+					if (abs(palette_cube[j] - channels[channel]) < abs(palette_cube[levels[channel]] - channels[channel]))
+						levels[channel] = j;
+			}
+			best = 16 + 36 * levels[0] + 6 * levels[1] + levels[2];
+			best_dist = itgl_rgb_dist(rgb, (TGLRGB){ palette_cube[levels[0]], palette_cube[levels[1]], palette_cube[levels[2]] });
+			for (j = 0; j < 24; j++) {
+				const uint8_t gray = 8 + 10 * j;
+				const unsigned dist = itgl_rgb_dist(rgb, (TGLRGB){ gray, gray, gray });
+				if (dist < best_dist) {
+					best = 232 + j;
+					best_dist = dist;
+				}
+			}
+		}
+		tgl->quantize_lut[i] = best;
+	}
+	return 0;
+}
+
+/* Squared distance weighted by the sensitivity of the eye to each channel */
+unsigned itgl_rgb_dist(const TGLRGB rgb0, const TGLRGB rgb1)
+{
+	const int r = rgb0.r - rgb1.r, g = rgb0.g - rgb1.g, b = rgb0.b - rgb1.b;
+	return 2 * r * r + 4 * g * g + 3 * b * b;
+}
+
+/* Fills quantize_colors with colors of frame_buffer */
+void itgl_quantize_frame(TGL *const tgl, const bool dirty)
+{
+	const TGLPixFmt *const colors = tgl->frame_buffer.colors;
+	TGLPixFmt *const dest = tgl->quantize_colors;
+	unsigned row;
+	for (row = 0; row < tgl->height; row++) {
+		const RowRange range = dirty ? tgl->dirty_rows[row] : (RowRange){ .x0 = 0, .x1 = (int)tgl->width - 1 };
+		int col;
+		for (col = range.x0; col <= range.x1; col++)
+			dest[row * tgl->width + col] = itgl_pixfmt_quantize(tgl, colors[row * tgl->width + col], col, row);
+	}
+}
+
+/* Replaces RGB colors by palette colors of quantize_lut, dithered by the position of the pixel */
+inline TGLPixFmt itgl_pixfmt_quantize(const TGL *const tgl, TGLPixFmt color, const unsigned x, const unsigned y)
+{
+	const uint8_t *const channels = tgl->quantize_channels[((y & 3u) << 2) | (x & 3u)];
+	color.fg = itgl_fmt_quantize(tgl, color.fg, channels);
+	color.bkg = itgl_fmt_quantize(tgl, color.bkg, channels);
+	return color;
+}
+
+inline TGLFmt itgl_fmt_quantize(const TGL *const tgl, TGLFmt fmt, const uint8_t *const channels)
+{
+	if (!(fmt.flags & TGL_RGB24))
+		return fmt;
+	const unsigned idx = QUANTIZE_INDEX((unsigned)channels[fmt.color.rgb.r], (unsigned)channels[fmt.color.rgb.g], (unsigned)channels[fmt.color.rgb.b]);
+	fmt.flags = (fmt.flags & ~TGL_RGB24) | tgl->quantize_flags;
+	fmt.color = (TGLFmtColor){ .indexed = tgl->quantize_lut[idx] };
+	return fmt;
+}
+
+/* Places both planes in mem of FRAME_BYTES(size), colors first to keep them aligned */
+void itgl_frame_init(Frame *const frame, void *const mem, const unsigned size)
+{
+	frame->colors = mem;
+	frame->chars = (char *)(frame->colors + size);
+}
+
+void itgl_frame_copy(Frame *const dest, const Frame *const src, const unsigned size)
+{
+	memcpy(dest->colors, src->colors, FRAME_BYTES(size));
+}
+
+/* Sets all rows to columns x0 to x1, or to an empty range for x0 = INT_MAX and x1 = -1 */
+void itgl_rows_fill(RowRange *const rows, const unsigned height, const int x0, const int x1)
+{
+	unsigned i;
+	for (i = 0; i < height; i++)
+		rows[i] = (RowRange){ .x0 = x0, .x1 = x1 };
+}
+
+/* Extends ranges of dest to include those of src */
+void itgl_rows_merge(RowRange *const dest, const RowRange *const src, const unsigned height)
+{
+	unsigned i;
+	for (i = 0; i < height; i++) {
+		dest[i].x0 = MIN(dest[i].x0, src[i].x0);
+		dest[i].x1 = MAX(dest[i].x1, src[i].x1);
+	}
+}
+
+/* Records that pixels in a rectangle of the screen were drawn */
+inline void itgl_dirty_rect(TGL *const tgl, const int x0, const int y0, const int x1, const int y1)
+{
+	if (!tgl->dirty_rows)
+		return;
+	int y;
+	for (y = y0; y <= y1; y++) {
+		RowRange *const dirty = &tgl->dirty_rows[y], *const drawn = &tgl->drawn_rows[y];
+		dirty->x0 = MIN(dirty->x0, x0);
+		dirty->x1 = MAX(dirty->x1, x1);
+		drawn->x0 = MIN(drawn->x0, x0);
+		drawn->x1 = MAX(drawn->x1, x1);
+	}
+}
+
+/* Records that pixels inside the bounding box of verts were drawn */
+void itgl_dirty_verts(TGL *const tgl, const TGLVert *const verts, const unsigned n)
+{
+	if (!tgl->dirty_rows)
+		return;
+	int x0 = verts[0].x, y0 = verts[0].y, x1 = verts[0].x, y1 = verts[0].y;
+	unsigned i;
+	for (i = 1; i < n; i++) {
+		x0 = MIN(x0, verts[i].x);
+		y0 = MIN(y0, verts[i].y);
+		x1 = MAX(x1, verts[i].x);
+		y1 = MAX(y1, verts[i].y);
+	}
+	/* Clipped like the vertices of lines, which are moved onto the screen */
+	itgl_clip(tgl, &x0, &y0);
+	itgl_clip(tgl, &x1, &y1);
+	itgl_dirty_rect(tgl, x0, y0, x1, y1);
+}
+
+/* Copies frame_buffer to prev_frame_buffer after it was printed, only in dirty_rows unless all is set, and marks all rows as clean */
+void itgl_prev_frame_update(TGL *const tgl, const bool all)
+{
+	if (all || !tgl->dirty_rows) {
+		itgl_frame_copy(&tgl->prev_frame_buffer, &tgl->frame_buffer, tgl->frame_size);
+	} else {
+		unsigned row;
+		for (row = 0; row < tgl->height; row++) {
+			const RowRange range = tgl->dirty_rows[row];
+			if (range.x0 > range.x1)
+				continue;
+			const unsigned idx = row * tgl->width + range.x0;
+			const unsigned len = range.x1 - range.x0 + 1;
+			memcpy(tgl->prev_frame_buffer.colors + idx, tgl->frame_buffer.colors + idx, sizeof(TGLPixFmt) * len);
+			memcpy(tgl->prev_frame_buffer.chars + idx, tgl->frame_buffer.chars + idx, len);
+		}
+	}
+	if (tgl->dirty_rows)
+		itgl_rows_fill(tgl->dirty_rows, tgl->height, INT_MAX, -1);
+}
+
 int tgl_boot(void)
 {
 #ifdef TGL_OS_WINDOWS
@@ -175,19 +975,39 @@ int tgl_boot(void)
 void tgl_clear(TGL *const tgl, const uint8_t buffers)
 {
 	unsigned i;
+	/* TGL_OUTPUT_BUFFER does not need to be cleared */
 	if (buffers & TGL_FRAME_BUFFER) {
-		for (i = 0; i < tgl->frame_size; i++) {
-			*(&tgl->frame_buffer[i]) = (Pixel){
-				.v_char = ' ',
-				.color = (TGLPixFmt){ 0 },
-			};
+		/* Normalized TGL_PIXFMT(TGL_IDX(TGL_BLACK), TGL_IDX(TGL_BLACK)) is all zero bits */
+		memset(tgl->frame_buffer.colors, 0, sizeof(TGLPixFmt) * tgl->frame_size);
+		memset(tgl->frame_buffer.chars, ' ', tgl->frame_size);
+		/* Everything drawn since the last clear may now differ from prev_frame_buffer */
+		if (tgl->dirty_rows) {
+			itgl_rows_merge(tgl->dirty_rows, tgl->drawn_rows, tgl->height);
+			itgl_rows_fill(tgl->drawn_rows, tgl->height, INT_MAX, -1);
+		}
+	}
+	if (buffers & TGL_Z_BUFFER) {
+		/* Far depth of TGL_Z_BUFFER_16 and of TGL_REVERSED_Z is all zero bits */
+		float far = 0.f;
+		if (tgl->z_format == Z_FORMAT_F32 && !(tgl->settings & TGL_REVERSED_Z)) {
+			float *const z_buffer = tgl->z_buffer;
+			far = -1.f;
+			for (i = 0; i < tgl->frame_size; i++)
+				z_buffer[i] = far;
+		} else {
+			memset(tgl->z_buffer, 0, Z_TILES_OFFSET(tgl));
+		}
+		const unsigned tiles_y = (tgl->height + Z_TILE_SIZE - 1) >> Z_TILE_SHIFT;
+		unsigned tile_x, tile_y;
+		for (tile_y = 0; tile_y < tiles_y; tile_y++) {
+			const unsigned height = MIN(Z_TILE_SIZE, tgl->height - (tile_y << Z_TILE_SHIFT));
+			for (tile_x = 0; tile_x < tgl->z_tiles_x; tile_x++) {
+				const unsigned tile = tile_y * tgl->z_tiles_x + tile_x;
+				tgl->z_tiles[tile] = far;
+				tgl->z_tiles_count[tile] = height * MIN(Z_TILE_SIZE, tgl->width - (tile_x << Z_TILE_SHIFT));
+			}
 		}
 	}
-	if (buffers & TGL_Z_BUFFER)
-		for (i = 0; i < tgl->frame_size; i++)
-			tgl->z_buffer[i] = -1.f;
-	if (buffers & TGL_OUTPUT_BUFFER)
-		memset(tgl->output_buffer, '\0', tgl->output_buffer_size);
 }
 
 void tgl_clear_screen(void)
@@ -197,38 +1017,301 @@ void tgl_clear_screen(void)
 
 TGL *tgl_init(const unsigned width, const unsigned height)
 {
-	TGL *const tgl = TGL_MALLOC(sizeof(TGL));
-	if (!tgl)
-		return NULL;
-	*tgl = (TGL){
+	return tgl_init_ex(width, height, NULL, 0);
+}
+
+TGL *tgl_init_ex(const unsigned width, const unsigned height, const TGLAllocator *const allocator, const uint32_t arena_settings)
+{
+	TGL init = {
 		.width = width,
 		.height = height,
 		.max_x = width - 1,
 		.max_y = height - 1,
 		.frame_size = width * height,
-		.frame_buffer = TGL_MALLOC(sizeof(Pixel) * width * height),
+		.output_fd = 1, /* stdout */
+		.allocator = allocator ? *allocator : (TGLAllocator){ .alloc = &itgl_std_alloc, .free = &itgl_std_free },
 	};
-	if (!tgl->frame_buffer) {
-		TGL_FREE(tgl);
+	TGL *tgl;
+	if (arena_settings) {
+		/* Struct, then reserved slots, each starting on a cache line */
+		static const uint32_t slot_settings[ARENA_SLOTS] = {
+			[ARENA_FRAME_BUFFER] = UINT32_MAX,
+			[ARENA_Z_BUFFER] = TGL_Z_BUFFER,
+			[ARENA_OUTPUT_BUFFER] = TGL_OUTPUT_BUFFER,
+			[ARENA_PREV_FRAME] = TGL_DIFF_FLUSH,
+			[ARENA_DIRTY_ROWS] = TGL_DIFF_FLUSH,
+			[ARENA_QUANTIZE] = TGL_QUANTIZE_256 | TGL_QUANTIZE_16,
+			[ARENA_CELLS] = TGL_HALF_BLOCK | TGL_BRAILLE,
+#ifdef TERMGL_THREADS
+			[ARENA_PRESENTER] = TGL_ASYNC_FLUSH,
+#endif
+		};
+		size_t offsets[ARENA_SLOTS], size = ALIGN_UP(sizeof(TGL), ARENA_ALIGN);
+		unsigned slot;
+		for (slot = 0; slot < ARENA_SLOTS; slot++) {
+			offsets[slot] = size;
+			if (arena_settings & slot_settings[slot]) {
+				init.arena_slot_sizes[slot] = ALIGN_UP(itgl_slot_size(&init, slot), ARENA_ALIGN);
+				size += init.arena_slot_sizes[slot];
+			}
+		}
+		init.arena_size = size + ARENA_ALIGN - 1u;
+		init.arena = itgl_alloc(&init, init.arena_size);
+		if (!init.arena)
+			return NULL;
+		char *const base = (char *)ALIGN_UP((uintptr_t)init.arena, ARENA_ALIGN);
+		for (slot = 0; slot < ARENA_SLOTS; slot++)
+			if (arena_settings & slot_settings[slot])
+				init.arena_slots[slot] = base + offsets[slot];
+		tgl = (TGL *)base;
+	} else {
+		tgl = itgl_alloc(&init, sizeof(TGL));
+		if (!tgl)
+			return NULL;
+	}
+	*tgl = init;
+	void *const frame_mem = itgl_slot_alloc(tgl, ARENA_FRAME_BUFFER);
+	if (!frame_mem) {
+		tgl_delete(tgl);
+		return NULL;
+	}
+	itgl_frame_init(&tgl->frame_buffer, frame_mem, tgl->frame_size);
+#ifdef TERMGL_PROFILE
+	if (itgl_stats_resize(tgl, 1)) {
+		tgl_delete(tgl);
 		return NULL;
 	}
+#endif
 	tgl_clear(tgl, TGL_FRAME_BUFFER);
 	return tgl;
 }
 
-inline char *itgl_generate_sgr_rgb_channel(const uint8_t val, char *buf)
+void *itgl_std_alloc(const size_t size, void *const ctx)
 {
-	*buf++ = ';';
-	if (val >= 10) {
-		if (val >= 100)
-			*buf++ = (val / 100u) + '0';
-		*buf++ = ((val % 100u) / 10u) + '0';
+	(void)ctx;
+	return TGL_MALLOC(size);
+}
+
+void itgl_std_free(void *const ptr, void *const ctx)
+{
+	(void)ctx;
+	TGL_FREE(ptr);
+}
+
+void *itgl_alloc(const TGL *const tgl, const size_t size)
+{
+	return tgl->allocator.alloc(size, tgl->allocator.ctx);
+}
+
+/* Frees ptr unless it is NULL or in the arena */
+void itgl_free(const TGL *const tgl, void *const ptr)
+{
+	if (!ptr || (tgl->arena && (uintptr_t)ptr - (uintptr_t)tgl->arena < tgl->arena_size))
+		return;
+	tgl->allocator.free(ptr, tgl->allocator.ctx);
+}
+
+/* Moves the first len bytes of ptr to a new block of size bytes, or returns NULL and keeps ptr */
+void *itgl_realloc(const TGL *const tgl, void *const ptr, const size_t len, const size_t size)
+{
+	void *const mem = itgl_alloc(tgl, size);
+	if (!mem)
+		return NULL;
+	if (len)
+		memcpy(mem, ptr, len);
+	itgl_free(tgl, ptr);
+	return mem;
+}
+
+size_t itgl_slot_size(const TGL *const tgl, const enum ArenaSlot slot)
+{
+	switch (slot) {
+	case ARENA_FRAME_BUFFER:
+	case ARENA_PREV_FRAME:
+		return FRAME_BYTES(tgl->frame_size);
+	case ARENA_Z_BUFFER: {
+		/* Tiles are allocated in the same block, after z_buffer by itgl_z_buffer_init */
+		const unsigned n_tiles = ((tgl->width + Z_TILE_SIZE - 1) >> Z_TILE_SHIFT) * ((tgl->height + Z_TILE_SIZE - 1) >> Z_TILE_SHIFT);
+		return Z_TILES_OFFSET(tgl) + (sizeof(float) + sizeof(uint8_t)) * n_tiles;
+	}
+	case ARENA_OUTPUT_BUFFER:
+		/* Sized for indexed color frames with a few bytes per pixel, grows when flushing larger frames */
+		return 4u * tgl->frame_size + OUTPUT_HEADER_MAX + OUTPUT_ROW_MAX(tgl);
+	case ARENA_DIRTY_ROWS:
+		/* drawn_rows are allocated in the same block, after dirty_rows */
+		return sizeof(RowRange) * 2u * tgl->height;
+	case ARENA_QUANTIZE:
+		return sizeof(TGLPixFmt) * tgl->frame_size + QUANTIZE_LUT_SIZE + sizeof(uint8_t[16][256]);
+	case ARENA_CELLS:
+		/* Sized for TGL_HALF_BLOCK, the frame is allocated after the dirty rows by itgl_present_cells */
+		return sizeof(RowRange) * CELL_ROWS_MAX(tgl->height) + FRAME_BYTES(tgl->width * CELL_ROWS_MAX(tgl->height));
+#ifdef TERMGL_THREADS
+	case ARENA_PRESENTER:
+		/* Both frames and dirty rows are allocated in the same block, after the struct */
+		return ALIGN_UP(sizeof(Presenter), ARENA_ALIGN) + 2u * ALIGN_UP(FRAME_BYTES(tgl->frame_size), ARENA_ALIGN) + sizeof(RowRange) * 2u * tgl->height;
+#endif
+	case ARENA_SLOTS:
+		break;
 	}
-	*buf++ = (val % 10u) + '0';
+	return 0;
+}
+
+/* Returns the buffer reserved for slot if it is large enough, or allocates one, and records its capacity */
+void *itgl_slot_alloc(TGL *const tgl, const enum ArenaSlot slot)
+{
+	const size_t size = itgl_slot_size(tgl, slot);
+	if (tgl->arena_slots[slot] && size <= tgl->arena_slot_sizes[slot]) {
+		tgl->capacity[slot] = tgl->arena_slot_sizes[slot];
+		return tgl->arena_slots[slot];
+	}
+	void *const buf = itgl_alloc(tgl, size);
+	tgl->capacity[slot] = buf ? size : 0;
 	return buf;
 }
 
-char *itgl_generate_sgr_rgb(const TGLRGB rgb, char *buf)
+void *itgl_slot_get(const TGL *const tgl, const enum ArenaSlot slot)
+{
+	switch (slot) {
+	case ARENA_FRAME_BUFFER:
+		return tgl->frame_buffer.colors;
+	case ARENA_Z_BUFFER:
+		return tgl->z_buffer;
+	case ARENA_OUTPUT_BUFFER:
+		return tgl->output_buffer;
+	case ARENA_PREV_FRAME:
+		return tgl->prev_frame_buffer.colors;
+	case ARENA_DIRTY_ROWS:
+		return tgl->dirty_rows;
+	case ARENA_QUANTIZE:
+		return tgl->quantize_colors;
+	case ARENA_CELLS:
+		return tgl->cells;
+#ifdef TERMGL_THREADS
+	case ARENA_PRESENTER:
+		return tgl->presenter;
+#endif
+	case ARENA_SLOTS:
+		break;
+	}
+	return NULL;
+}
+
+/* Replaces buffer of slot, whose layout is set up by the caller */
+void itgl_slot_set(TGL *const tgl, const enum ArenaSlot slot, void *const buf)
+{
+	switch (slot) {
+	case ARENA_FRAME_BUFFER:
+		tgl->frame_buffer.colors = buf;
+		break;
+	case ARENA_Z_BUFFER:
+		tgl->z_buffer = buf;
+		break;
+	case ARENA_OUTPUT_BUFFER:
+		tgl->output_buffer = buf;
+		break;
+	case ARENA_PREV_FRAME:
+		tgl->prev_frame_buffer.colors = buf;
+		break;
+	case ARENA_DIRTY_ROWS:
+		tgl->dirty_rows = buf;
+		break;
+	case ARENA_QUANTIZE:
+		tgl->quantize_colors = buf;
+		break;
+	case ARENA_CELLS:
+		tgl->cells = buf;
+		break;
+#ifdef TERMGL_THREADS
+	case ARENA_PRESENTER:
+		tgl->presenter = buf;
+		break;
+#endif
+	case ARENA_SLOTS:
+		break;
+	}
+}
+
+int tgl_resize(TGL *const tgl, const unsigned width, const unsigned height)
+{
+#ifdef TERMGL_THREADS
+	/* The last frame is printed at the old size, and the presenter is recreated with buffers of the new size */
+	const bool async = tgl->presenter;
+	itgl_presenter_delete(tgl);
+#endif
+	TGL resized = *tgl;
+	resized.width = width;
+	resized.height = height;
+	resized.frame_size = width * height;
+	tgl->capacity[ARENA_OUTPUT_BUFFER] = tgl->output_buffer_size;
+
+	/* Buffers which are too small are only replaced once all replacements are allocated, so that tgl is unchanged on failure */
+	void *grown[ARENA_SLOTS] = { NULL };
+	size_t grown_sizes[ARENA_SLOTS];
+	int ret = 0;
+	unsigned slot;
+	for (slot = 0; slot < ARENA_SLOTS; slot++) {
+		const size_t size = itgl_slot_size(&resized, slot);
+		if (!itgl_slot_get(tgl, slot) || size <= tgl->capacity[slot])
+			continue;
+		grown_sizes[slot] = MAX(size, tgl->capacity[slot] + tgl->capacity[slot] / 2u);
+		grown[slot] = itgl_alloc(tgl, grown_sizes[slot]);
+		if (!grown[slot]) {
+			ret = -1;
+			break;
+		}
+	}
+	if (ret) {
+		for (slot = 0; slot < ARENA_SLOTS; slot++)
+			itgl_free(tgl, grown[slot]);
+	} else {
+		for (slot = 0; slot < ARENA_SLOTS; slot++) {
+			if (!grown[slot])
+				continue;
+			itgl_free(tgl, itgl_slot_get(tgl, slot));
+			itgl_slot_set(tgl, slot, grown[slot]);
+			tgl->capacity[slot] = grown_sizes[slot];
+		}
+
+		tgl->width = width;
+		tgl->height = height;
+		tgl->max_x = width - 1;
+		tgl->max_y = height - 1;
+		tgl->frame_size = width * height;
+		itgl_frame_init(&tgl->frame_buffer, tgl->frame_buffer.colors, tgl->frame_size);
+		if (tgl->prev_frame_buffer.colors)
+			itgl_frame_init(&tgl->prev_frame_buffer, tgl->prev_frame_buffer.colors, tgl->frame_size);
+		if (tgl->z_buffer)
+			itgl_z_buffer_init(tgl);
+		if (tgl->dirty_rows) {
+			tgl->drawn_rows = tgl->dirty_rows + tgl->height;
+			itgl_rows_fill(tgl->dirty_rows, 2u * tgl->height, 0, tgl->max_x);
+		}
+		if (tgl->output_buffer)
+			tgl->output_buffer_size = tgl->capacity[ARENA_OUTPUT_BUFFER];
+		/* Tables are kept at the same size, but moved by the end of quantize_colors */
+		if (tgl->quantize_colors)
+			(void)itgl_quantize_init(tgl);
+		tgl_clear(tgl, TGL_FRAME_BUFFER | (tgl->z_buffer ? TGL_Z_BUFFER : 0));
+		tgl->prev_frame_valid = false;
+		tgl->clear_screen = true;
+	}
+#ifdef TERMGL_THREADS
+	if (async && itgl_presenter_create(tgl)) {
+		tgl->settings &= ~TGL_ASYNC_FLUSH;
+		return -1;
+	}
+#endif
+	return ret;
+}
+
+/* Writes 4 bytes, of which 2 to 4 are kept */
+inline char *itgl_generate_sgr_rgb_channel(const uint8_t val, char *buf)
+{
+	memcpy(buf, sgr_channels[val], 4);
+	return buf + 2 + (val >= 10) + (val >= 100);
+}
+
+inline char *itgl_generate_sgr_rgb(const TGLRGB rgb, char *buf)
 {
 	*buf++ = '8';
 	*buf++ = ';';
@@ -239,23 +1322,77 @@ char *itgl_generate_sgr_rgb(const TGLRGB rgb, char *buf)
 	return buf;
 }
 
-char *itgl_generate_sgr(const TGLPixFmt color_prev, const TGLPixFmt color_cur, char *buf)
+inline char *itgl_generate_sgr_idx256(const uint8_t idx, char *buf)
 {
-	const uint8_t enable = color_cur.fg.flags & ~color_prev.fg.flags;
-	const uint8_t disable = color_prev.fg.flags & ~color_cur.fg.flags;
-	bool flag_delim = false;
+	*buf++ = '8';
+	*buf++ = ';';
+	*buf++ = '5';
+	return itgl_generate_sgr_rgb_channel(idx, buf);
+}
 
+/* Uses the shorter of an incremental change from color_prev, and a reset followed by the parts of color_cur which differ from the reset state
+ * The reset state is taken to be the initial state of a flush, TGL_PIXFMT(TGL_IDX(TGL_WHITE))
+ **/
+char *itgl_generate_sgr(const TGLPixFmt color_prev, const TGLPixFmt color_cur, char *buf)
+{
+	const TGLPixFmt color_reset = TGL_PIXFMT(TGL_IDX(TGL_WHITE));
 	*buf++ = '\033';
 	*buf++ = '[';
+	const bool reset = itgl_sgr_reset_shorter(&color_prev, &color_cur);
+	if (reset)
+		*buf++ = '0';
+	buf = itgl_generate_sgr_params(reset ? color_reset : color_prev, color_cur, reset, buf);
+	*buf++ = 'm';
+	return buf;
+}
+
+/* Compares lengths of parameters including delimiters. Both forms set flags which are enabled, and colors which change to other than the reset state the same way
+ * A reset saves parameters which disable flags, or change a color to that of the reset state (3 chars each)
+ * It costs '0' (2 chars), and setting flags and colors which did not change but differ from the reset state
+ **/
+bool itgl_sgr_reset_shorter(const TGLPixFmt *const color_prev, const TGLPixFmt *const color_cur)
+{
+	const uint8_t disable = color_prev->fg.flags & ~color_cur->fg.flags;
+	const uint8_t kept = color_prev->fg.flags & color_cur->fg.flags;
+	const bool fg_rgb = color_cur->fg.flags & TGL_RGB24, bkg_rgb = color_cur->bkg.flags & TGL_RGB24;
+	const bool fg_idx256 = color_cur->fg.flags & FMT_IDX256, bkg_idx256 = color_cur->bkg.flags & FMT_IDX256;
+	const bool fg_reset = !fg_rgb && !fg_idx256 && color_cur->fg.color.indexed == TGL_WHITE;
+	const bool bkg_reset = !bkg_rgb && !bkg_idx256 && color_cur->bkg.color.indexed == TGL_BLACK;
+	/* Most transitions can save nothing */
+	if (!(disable & (TGL_BOLD | TGL_UNDERLINE)) && !fg_reset && !bkg_reset)
+		return false;
+	const bool fg_changed = (color_cur->fg.flags ^ color_prev->fg.flags) & (TGL_RGB24 | FMT_IDX256) || memcmp(&color_cur->fg.color, &color_prev->fg.color, sizeof(TGLFmtColor));
+	const bool bkg_changed = (color_cur->bkg.flags ^ color_prev->bkg.flags) & (TGL_RGB24 | FMT_IDX256) || memcmp(&color_cur->bkg.color, &color_prev->bkg.color, sizeof(TGLFmtColor));
+	const bool fg_kept = !fg_changed && !fg_reset, bkg_kept = !bkg_changed && !bkg_reset;
+
+	const unsigned saved = 3 * (!!(disable & TGL_BOLD) + !!(disable & TGL_UNDERLINE) + (fg_changed && fg_reset) + (bkg_changed && bkg_reset));
+	/* Unchanged RGB colors cost more than the most a reset can save */
+	const unsigned cost = 2 + 2 * (!!(kept & TGL_BOLD) + !!(kept & TGL_UNDERLINE))
+		+ fg_kept * (fg_rgb ? 12 : fg_idx256 ? SGR_IDX256_LEN(color_cur->fg.color.indexed) : 3)
+		+ bkg_kept * (bkg_rgb ? 12 : bkg_idx256 ? SGR_IDX256_LEN(color_cur->bkg.color.indexed) : 3 + !!(color_cur->bkg.color.indexed & TGL_HIGH_INTENSITY));
+	return cost < saved;
+}
+
+/* Parameters of SGR code which changes color_prev to color_cur */
+inline char *itgl_generate_sgr_params(const TGLPixFmt color_prev, const TGLPixFmt color_cur, bool flag_delim, char *buf)
+{
+	const uint8_t enable = color_cur.fg.flags & ~color_prev.fg.flags;
+	const uint8_t disable = color_prev.fg.flags & ~color_cur.fg.flags;
 
 	/* BOLD */
 	if (disable & TGL_BOLD) {
-		*buf++ = '2';
-		*buf++ = '2';
-		flag_delim = true;
+		if (flag_delim)
+			*buf++ = ';';
+		else
+			flag_delim = true;
+		*buf++ = '2';
+		*buf++ = '2';
 	} else if (enable & TGL_BOLD) {
+		if (flag_delim)
+			*buf++ = ';';
+		else
+			flag_delim = true;
 		*buf++ = '1';
-		flag_delim = true;
 	}
 
 	/* UNDERLINE */
@@ -276,7 +1413,7 @@ char *itgl_generate_sgr(const TGLPixFmt color_prev, const TGLPixFmt color_cur, c
 
 	/* FOREGROUND */
 	if (color_cur.fg.flags & TGL_RGB24) {
-		if (!RGB_EQ(color_cur.fg.color.rgb, color_prev.fg.color.rgb)) {
+		if (!(color_prev.fg.flags & TGL_RGB24) || !RGB_EQ(color_cur.fg.color.rgb, color_prev.fg.color.rgb)) {
 			if (flag_delim)
 				*buf++ = ';';
 			else
@@ -284,7 +1421,16 @@ char *itgl_generate_sgr(const TGLPixFmt color_prev, const TGLPixFmt color_cur, c
 			*buf++ = '3';
 			buf = itgl_generate_sgr_rgb(color_cur.fg.color.rgb, buf);
 		}
-	} else if ((color_prev.fg.flags & TGL_RGB24)
+	} else if (color_cur.fg.flags & FMT_IDX256) {
+		if (!(color_prev.fg.flags & FMT_IDX256) || color_prev.fg.color.indexed != color_cur.fg.color.indexed) {
+			if (flag_delim)
+				*buf++ = ';';
+			else
+				flag_delim = true;
+			*buf++ = '3';
+			buf = itgl_generate_sgr_idx256(color_cur.fg.color.indexed, buf);
+		}
+	} else if ((color_prev.fg.flags & (TGL_RGB24 | FMT_IDX256))
 		|| (color_prev.fg.color.indexed != color_cur.fg.color.indexed)) {
 		if (flag_delim)
 			*buf++ = ';';
@@ -296,13 +1442,20 @@ char *itgl_generate_sgr(const TGLPixFmt color_prev, const TGLPixFmt color_cur, c
 
 	/* BACKGROUND */
 	if (color_cur.bkg.flags & TGL_RGB24) {
-		if (!RGB_EQ(color_cur.bkg.color.rgb, color_prev.bkg.color.rgb)) {
+		if (!(color_prev.bkg.flags & TGL_RGB24) || !RGB_EQ(color_cur.bkg.color.rgb, color_prev.bkg.color.rgb)) {
 			if (flag_delim)
 				*buf++ = ';';
 			*buf++ = '4';
 			buf = itgl_generate_sgr_rgb(color_cur.bkg.color.rgb, buf);
 		}
-	} else if ((color_prev.bkg.flags & TGL_RGB24)
+	} else if (color_cur.bkg.flags & FMT_IDX256) {
+		if (!(color_prev.bkg.flags & FMT_IDX256) || color_prev.bkg.color.indexed != color_cur.bkg.color.indexed) {
+			if (flag_delim)
+				*buf++ = ';';
+			*buf++ = '4';
+			buf = itgl_generate_sgr_idx256(color_cur.bkg.color.indexed, buf);
+		}
+	} else if ((color_prev.bkg.flags & (TGL_RGB24 | FMT_IDX256))
 		|| (color_prev.bkg.color.indexed != color_cur.bkg.color.indexed)) {
 		if (flag_delim)
 			*buf++ = ';';
@@ -317,1087 +1470,4753 @@ char *itgl_generate_sgr(const TGLPixFmt color_prev, const TGLPixFmt color_cur, c
 		*buf++ = (color_cur.bkg.color.indexed & 0x07) + '0';
 	}
 
-	*buf++ = 'm';
-
 	return buf;
 }
 
-int tgl_flush(TGL *const tgl)
+char *itgl_generate_cup(const unsigned row, const unsigned col, char *buf)
 {
-	if (tgl->settings & TGL_PROGRESSIVE)
-		CALL_STDOUT(fputs("\033[;H", stdout), -1);
-	else
-		TGL_CLEAR_SCR;
+	char digits[10];
+	unsigned val, n_digits;
+	*buf++ = '\033';
+	*buf++ = '[';
+	for (val = row + 1, n_digits = 0; val; val /= 10u)
+		digits[n_digits++] = (val % 10u) + '0';
+	while (n_digits)
+		*buf++ = digits[--n_digits];
+	*buf++ = ';';
+	for (val = col + 1, n_digits = 0; val; val /= 10u)
+		digits[n_digits++] = (val % 10u) + '0';
+	while (n_digits)
+		*buf++ = digits[--n_digits];
+	*buf++ = 'H';
+	return buf;
+}
 
+/* Prints only the pixels which differ from prev_frame_buffer
+ * Unchanged pixels are skipped over with CUP codes.
+ * Escape codes are assembled in the output buffer if there is one, otherwise in small chunks on the stack
+ **/
+int itgl_flush_diff(TGL *const tgl)
+{
+	char chunk[256];
+	const bool buffered = tgl->output_buffer_size;
+	char *loc = buffered ? tgl->output_buffer : chunk;
 	TGLPixFmt color = TGL_PIXFMT(TGL_IDX(TGL_WHITE));
 	unsigned row, col;
-	Pixel *pixel = tgl->frame_buffer;
+	unsigned cursor_row = tgl->height, cursor_col = 0;
+	const char *chars = tgl->frame_buffer.chars;
+	const TGLPixFmt *colors = tgl->frame_buffer.colors;
+	const TGLPixFmt *flush_colors = FLUSH_COLORS(tgl);
+	const char *prev_chars = tgl->prev_frame_buffer.chars;
+	const TGLPixFmt *prev_colors = tgl->prev_frame_buffer.colors;
+	const Glyph *const glyphs = tgl->glyphs;
 	const bool double_chars = tgl->settings & TGL_DOUBLE_CHARS;
-	const bool double_width = tgl->settings & TGL_DOUBLE_WIDTH;
 
-	if (tgl->output_buffer_size) {
-		char *output_buffer_loc = tgl->output_buffer;
-		for (row = 0; row < tgl->height; row++) {
-			if (double_width) {
-				*output_buffer_loc++ = '\033';
-				*output_buffer_loc++ = '#';
-				*output_buffer_loc++ = '6';
-			}
-			for (col = 0; col < tgl->width; col++) {
-				if (!PIXFMT_EQ(color, pixel->color)) {
-					output_buffer_loc = itgl_generate_sgr(color, pixel->color, output_buffer_loc);
-					color = pixel->color;
-				}
-				*output_buffer_loc++ = pixel->v_char;
-				if (double_chars)
-					*output_buffer_loc++ = pixel->v_char;
-				pixel++;
+	for (row = 0; row < tgl->height; row++,
+	    chars += tgl->width, colors += tgl->width, flush_colors += tgl->width, prev_chars += tgl->width, prev_colors += tgl->width) {
+		/* Only columns written since the last flush can differ */
+		const RowRange range = tgl->dirty_rows ? tgl->dirty_rows[row] : (RowRange){ .x0 = 0, .x1 = (int)tgl->width - 1 };
+		if (range.x0 > range.x1)
+			continue;
+		const unsigned len = range.x1 - range.x0 + 1;
+		if (!memcmp(chars + range.x0, prev_chars + range.x0, len)
+			&& !memcmp(colors + range.x0, prev_colors + range.x0, sizeof(TGLPixFmt) * len))
+			continue;
+		if (buffered)
+			CALL(itgl_output_reserve(tgl, &loc, OUTPUT_ROW_MAX(tgl)), -1);
+		for (col = range.x0; col <= (unsigned)range.x1; col++) {
+			if (chars[col] == prev_chars[col] && PIXFMT_EQ(colors[col], prev_colors[col]))
+				continue;
+			/* Pixel followed by end of frame */
+			if (!buffered && loc - chunk > (ptrdiff_t)(sizeof(chunk) - 96u)) {
+				CALL((size_t)(loc - chunk) != fwrite(chunk, 1, loc - chunk, stdout), -1);
+				STATS_ADD(tgl, bytes_flushed, loc - chunk);
+				loc = chunk;
 			}
-			*output_buffer_loc++ = '\n';
-		}
-		*output_buffer_loc++ = '\033';
-		*output_buffer_loc++ = '[';
-		*output_buffer_loc++ = '0';
-		*output_buffer_loc = 'm';
-		CALL_STDOUT(fputs(tgl->output_buffer, stdout), -1);
-	} else {
-		for (row = 0; row < tgl->height; row++) {
-			if (double_width)
-				CALL_STDOUT(fputs("\033#6", stdout), -1);
-			for (col = 0; col < tgl->width; col++) {
-				if (!PIXFMT_EQ(color, pixel->color)) {
-					char buf[16];
-					*itgl_generate_sgr(color, pixel->color, buf) = '\0';
-					color = pixel->color;
-					CALL_STDOUT(fputs(buf, stdout), -1);
-				}
-				CALL_STDOUT(putchar(pixel->v_char), -1);
-				if (double_chars)
-					CALL_STDOUT(putchar(pixel->v_char), -1);
-				pixel++;
+			if (cursor_row != row || cursor_col != col)
+				loc = itgl_generate_cup(row, double_chars ? col * 2u : col, loc);
+			if (!PIXFMT_EQ(color, flush_colors[col])) {
+				loc = itgl_generate_sgr(color, flush_colors[col], loc);
+				color = flush_colors[col];
+				STATS_ADD(tgl, sgr_codes, 1);
 			}
-			CALL_STDOUT(putchar('\n'), -1);
+			loc = itgl_put_char(glyphs, chars[col], loc);
+			if (double_chars)
+				loc = itgl_put_char(glyphs, chars[col], loc);
+			cursor_row = row;
+			cursor_col = col + 1;
 		}
-		CALL_STDOUT(fputs("\033[0m", stdout), -1);
 	}
 
+	if (cursor_row == tgl->height)
+		return 0;
+
+	/* Leave cursor where a full flush would */
+	loc = itgl_generate_cup(tgl->height, 0, loc);
+	*loc++ = '\033';
+	*loc++ = '[';
+	*loc++ = '0';
+	*loc++ = 'm';
+	if (buffered)
+		return itgl_write(tgl, tgl->output_buffer, loc - tgl->output_buffer);
+	CALL((size_t)(loc - chunk) != fwrite(chunk, 1, loc - chunk, stdout), -1);
 	CALL_STDOUT(fflush(stdout), -1);
+	STATS_ADD(tgl, bytes_flushed, loc - chunk);
 	return 0;
 }
 
-void tgl_putchar(TGL *const tgl, int x, int y, const char c, const TGLPixFmt color)
+/* Writes the contents of output buffer to the memory of tgl_flush_to_memory or the output callback if set,
+ * otherwise either through stdio (flushing stdout), or directly to output_fd.
+ * stdout is flushed before a direct write so previously printed text comes first.
+ **/
+int itgl_write(TGL *const tgl, const char *buf, size_t len)
 {
-	itgl_clip(tgl, &x, &y);
-	SET_PIXEL_RAW(tgl, x, y, c, color);
+	STATS_TIME_BEGIN(write);
+	STATS_ADD(tgl, bytes_flushed, len);
+	if (tgl->output_memory) {
+		if (tgl->output_memory_len < tgl->output_memory_size)
+			memcpy(tgl->output_memory + tgl->output_memory_len, buf, MIN(len, tgl->output_memory_size - tgl->output_memory_len));
+		tgl->output_memory_len += len;
+		STATS_TIME_END(tgl, write_ns, write);
+		return 0;
+	}
+	if (tgl->output_callback) {
+		CALL(tgl->output_callback(buf, len, tgl->output_ctx), -1);
+		STATS_TIME_END(tgl, write_ns, write);
+		return 0;
+	}
+	if (!(tgl->settings & TGL_DIRECT_WRITE)) {
+		CALL(len != fwrite(buf, 1, len, stdout), -1);
+		CALL_STDOUT(fflush(stdout), -1);
+		STATS_TIME_END(tgl, write_ns, write);
+		return 0;
+	}
+
+	CALL_STDOUT(fflush(stdout), -1);
+#ifdef TGL_OS_WINDOWS
+	const HANDLE hOutputHandle = (HANDLE)_get_osfhandle(tgl->output_fd);
+	WINDOWS_CALL(hOutputHandle == INVALID_HANDLE_VALUE, -1);
+	DWORD mode;
+	const bool console = GetConsoleMode(hOutputHandle, &mode) != 0;
+	while (len) {
+		/* Older consoles fail on writes larger than 64KiB */
+		const DWORD count = (DWORD)MIN(len, console ? 0x8000u : 0x40000000u);
+		DWORD written;
+		if (console)
+			WINDOWS_CALL(!WriteConsoleA(hOutputHandle, buf, count, &written, NULL), -1);
+		else
+			WINDOWS_CALL(!WriteFile(hOutputHandle, buf, count, &written, NULL), -1);
+		buf += written;
+		len -= written;
+	}
+#else
+	while (len) {
+		const ssize_t written = write(tgl->output_fd, buf, len);
+		if (TGL_UNLIKELY(written < 0)) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += written;
+		len -= written;
+	}
+#endif
+	STATS_TIME_END(tgl, write_ns, write);
+	return 0;
 }
 
-void tgl_puts(TGL *const tgl, const int x, int y, const char *str, const TGLPixFmt color)
+/* Ensures len bytes can be written to the output buffer at *loc
+ * The buffer is grown geometrically. If that fails, the frame assembled so far is written out and the buffer is reused.
+ * The buffer is always large enough for the header and one row (OUTPUT_ROW_MAX).
+ **/
+int itgl_output_reserve(TGL *const tgl, char **const loc, const size_t len)
 {
-	int cur_x = x;
-	while (*str) {
-		if (TGL_UNLIKELY(*str == '\n')) {
-			cur_x = x;
-			y++;
-			str++;
-			continue;
-		}
-		itgl_clip(tgl, &cur_x, &y);
-		SET_PIXEL_RAW(tgl, cur_x, y, *str, color);
-		cur_x++;
-		str++;
+	const size_t used = *loc - tgl->output_buffer;
+	if (TGL_LIKELY(tgl->output_buffer_size - used >= len))
+		return 0;
+
+	size_t size = tgl->output_buffer_size;
+	while (size - used < len)
+		size *= 2u;
+	char *const output_buffer = itgl_realloc(tgl, tgl->output_buffer, used, size);
+	if (output_buffer) {
+		tgl->output_buffer = output_buffer;
+		tgl->output_buffer_size = size;
+		*loc = output_buffer + used;
+		return 0;
 	}
+
+	CALL(itgl_write(tgl, tgl->output_buffer, used), -1);
+	*loc = tgl->output_buffer;
+	return 0;
 }
 
-void tgl_point(TGL *const tgl, TGLVert v0, TGLPixelShader *const t, const void *const data)
+/* Assembles all rows of a frame which is printed in full into the output buffer */
+int itgl_flush_frame(TGL *const tgl, char **const loc)
 {
-	itgl_clip(tgl, &v0.x, &v0.y);
-	SET_PIXEL(tgl, v0.x, v0.y, v0.z, v0.u, v0.v, t, data);
+	TGLPixFmt color = TGL_PIXFMT(TGL_IDX(TGL_WHITE));
+	unsigned row;
+#ifdef TERMGL_THREADS
+	if ((tgl->settings & TGL_PARALLEL_FLUSH) && tgl->pool && tgl->frame_size >= FLUSH_PARALLEL_MIN) {
+		const size_t len = (size_t)OUTPUT_ROW_MAX(tgl) * tgl->height;
+		CALL(itgl_output_reserve(tgl, loc, len), -1);
+		/* Rows are assembled one by one if the buffer could not grow */
+		if (tgl->output_buffer_size - (*loc - tgl->output_buffer) >= len) {
+			*loc = itgl_flush_bands(tgl, *loc);
+			return 0;
+		}
+	}
+#endif
+	for (row = 0; row < tgl->height; row++) {
+		CALL(itgl_output_reserve(tgl, loc, OUTPUT_ROW_MAX(tgl)), -1);
+		*loc = itgl_flush_rows(tgl, row, row + 1, &color, *loc);
+	}
+	return 0;
 }
 
-/* Bresenham's line algorithm */
-void tgl_line(TGL *const tgl, TGLVert v0, TGLVert v1, TGLPixelShader *const t, const void *const data)
+/* Assembles rows from row_begin up to row_end, starting from and updating SGR state color */
+char *itgl_flush_rows(const TGL *const tgl, const unsigned row_begin, const unsigned row_end, TGLPixFmt *const color, char *loc)
 {
-	itgl_clip(tgl, &v0.x, &v0.y);
-	itgl_clip(tgl, &v1.x, &v1.y);
-	if (abs(v1.y - v0.y) < abs(v1.x - v0.x)) {
-		if (v0.x > v1.x) {
-			SWAP(TGLVert, v1, v0);
-		}
-		const int dx = v1.x - v0.x;
-		int dy = v1.y - v0.y;
-		int yi;
-		if (dy > 0) {
-			yi = 1;
-		} else {
-			yi = -1;
-			dy *= -1;
-		}
-		int d = (dy + dy) - dx;
-		int y = v0.y;
-		int x;
-		for (x = v0.x; x <= v1.x; x++) {
-			SET_PIXEL(tgl, x, y,
-				((x - v0.x) * v1.z + (v0.x - x) * v1.z) / dx,
-				((x - v0.x) * v1.u + (v1.x - x) * v0.u) / dx,
-				((x - v0.x) * v1.v + (v1.x - x) * v0.v) / dx,
-				t, data);
-			if (d > 0) {
-				y += yi;
-				d += 2 * (dy - dx);
-			} else {
-				d += dy + dy;
-			}
+	const char *chars = tgl->frame_buffer.chars + row_begin * tgl->width;
+	const TGLPixFmt *colors = FLUSH_COLORS(tgl) + row_begin * tgl->width;
+	const Glyph *const glyphs = tgl->glyphs;
+	const bool double_chars = tgl->settings & TGL_DOUBLE_CHARS;
+	const bool double_width = tgl->settings & TGL_DOUBLE_WIDTH;
+	unsigned row, col;
+	for (row = row_begin; row < row_end; row++) {
+		if (double_width) {
+			*loc++ = '\033';
+			*loc++ = '#';
+			*loc++ = '6';
 		}
-	} else {
-		if (v0.y > v1.y) {
-			SWAP(TGLVert, v1, v0);
-		}
-		int dx = v1.x - v0.x;
-		const int dy = v1.y - v0.y;
-		int xi;
-		if (dx > 0) {
-			xi = 1;
-		} else {
-			xi = -1;
-			dx *= -1;
-		}
-		int d = (dx + dx) - dy;
-		int x = v0.x;
-		int y;
-		for (y = v0.y; y <= v1.y; y++) {
-			SET_PIXEL(tgl, x, y,
-				((y - v0.y) * v1.z + (v1.y - y) * v0.z) / dx,
-				((y - v0.y) * v1.u + (v1.y - y) * v0.u) / dy,
-				((y - v0.y) * v1.v + (v1.y - y) * v0.v) / dy,
-				t, data);
-			if (d > 0) {
-				x += xi;
-				d += 2 * (dx - dy);
-			} else {
-				d += dx + dx;
+		for (col = 0; col < tgl->width; col++) {
+			if (!PIXFMT_EQ(*color, *colors)) {
+				loc = itgl_generate_sgr(*color, *colors, loc);
+				*color = *colors;
+				STATS_ADD(tgl, sgr_codes, 1);
 			}
+			loc = itgl_put_char(glyphs, *chars, loc);
+			if (double_chars)
+				loc = itgl_put_char(glyphs, *chars, loc);
+			chars++;
+			colors++;
 		}
+		*loc++ = '\n';
 	}
+	return loc;
 }
 
-void tgl_triangle(TGL *const tgl, TGLVert v0, TGLVert v1, TGLVert v2, TGLPixelShader *const t, const void *data)
+#ifdef TERMGL_THREADS
+/* Each band is assembled at the offset of the largest possible output of the rows before it, and then moved into place
+ * A band starts from the SGR state left by the pixel before it, so the output is the same as if rows were assembled in order
+ **/
+char *itgl_flush_bands(TGL *const tgl, char *loc)
 {
-	tgl_line(tgl, v0, v1, t, data);
-	tgl_line(tgl, v0, v2, t, data);
-	tgl_line(tgl, v1, v2, t, data);
+	FlushBands bands = {
+		.tgl = tgl,
+		.begin = loc,
+	};
+	const unsigned n_bands = MIN(MIN(tgl->height, itgl_pool_threads(tgl->pool) * 4u), FLUSH_BANDS_MAX);
+	bands.band_rows = (tgl->height + n_bands - 1) / n_bands;
+	bands.n_bands = (tgl->height + bands.band_rows - 1) / bands.band_rows;
+	itgl_pool_run(tgl->pool, &itgl_flush_band_job, &bands);
+
+	unsigned band;
+	loc = bands.ends[0];
+	for (band = 1; band < bands.n_bands; band++) {
+		const char *const begin = bands.begin + (size_t)OUTPUT_ROW_MAX(tgl) * band * bands.band_rows;
+		const size_t len = bands.ends[band] - begin;
+		memmove(loc, begin, len);
+		loc += len;
+	}
+	return loc;
 }
 
-void itgl_horiz_line(TGL *const tgl, const int x0, const float z0, const uint8_t u0, const uint8_t v0, const int x1, const float z1, const uint8_t u1, const uint8_t v1, const int y, TGLPixelShader *t, const void *const data)
+void itgl_flush_band_job(void *const ctx, const unsigned thread)
 {
-	if (x0 == x1) {
-		SET_PIXEL(tgl, x0, y, z0, u0, v0, t, data);
-	} else {
-		const int dx = x1 - x0;
-		int x;
-		for (x = x0; x <= x1; x++) {
-			SET_PIXEL(tgl, x, y,
-				((x - x0) * z1 + (x1 - x) * z0) / dx,
-				((x - x0) * u1 + (x1 - x) * u0) / dx,
-				((x - x0) * v1 + (x1 - x) * v0) / dx,
-				t, data);
-		}
+	FlushBands *const bands = ctx;
+	const TGL *const tgl = bands->tgl;
+	unsigned band;
+	(void)thread;
+	while ((band = itgl_pool_next(tgl->pool)) < bands->n_bands) {
+		const unsigned row_begin = band * bands->band_rows;
+		const unsigned row_end = MIN(row_begin + bands->band_rows, tgl->height);
+		TGLPixFmt color = row_begin ? FLUSH_COLORS(tgl)[row_begin * tgl->width - 1] : TGL_PIXFMT(TGL_IDX(TGL_WHITE));
+		bands->ends[band] = itgl_flush_rows(tgl, row_begin, row_end, &color, bands->begin + (size_t)OUTPUT_ROW_MAX(tgl) * row_begin);
 	}
 }
+#endif
 
-/* Solution based on Bresenham's line algorithm
- * adapted from: https://github.com/OneLoneCoder/videos/blob/master/olcConsoleGameEngine.h
- **/
-void tgl_triangle_fill(TGL *const tgl, TGLVert v0, TGLVert v1, TGLVert v2, TGLPixelShader *const t, const void *data)
+void tgl_set_output_fd(TGL *const tgl, const int fd)
 {
-	itgl_clip(tgl, &v0.x, &v0.y);
-	itgl_clip(tgl, &v1.x, &v1.y);
-	itgl_clip(tgl, &v2.x, &v2.y);
-	if (v1.y < v0.y) {
-		SWAP(TGLVert, v1, v0);
-	}
-	if (v2.y < v0.y) {
-		SWAP(TGLVert, v2, v0);
-	}
-	if (v2.y < v1.y) {
-		SWAP(TGLVert, v1, v2);
-	}
+#ifdef TERMGL_THREADS
+	itgl_presenter_lock(tgl);
+	tgl->output_fd = fd;
+	itgl_presenter_unlock(tgl);
+#else
+	tgl->output_fd = fd;
+#endif
+}
 
-	int t0xp, t1xp, minx, maxx, t0x, t1x;
-	t0x = t1x = v0.x;
-	int y = v0.y;
-	int dx0 = v1.x - v0.x;
-	int signx0, signx1;
-	bool changed0, changed1;
-	changed0 = changed1 = false;
-	if (dx0 < 0) {
-		dx0 *= -1;
-		signx0 = -1;
-	} else {
-		signx0 = 1;
+void tgl_set_output_callback(TGL *const tgl, TGLOutputCallback *const callback, void *const ctx)
+{
+#ifdef TERMGL_THREADS
+	itgl_presenter_lock(tgl);
+#endif
+	tgl->output_callback = callback;
+	tgl->output_ctx = ctx;
+#ifdef TERMGL_THREADS
+	itgl_presenter_unlock(tgl);
+#endif
+}
+
+int tgl_flush(TGL *const tgl)
+{
+#ifdef TERMGL_THREADS
+	if (tgl->presenter)
+		return itgl_presenter_submit(tgl);
+#endif
+	STATS_TIME_BEGIN(flush);
+	const int ret = itgl_present(tgl);
+	STATS_TIME_END(tgl, flush_ns, flush);
+	return ret;
+}
+
+int tgl_flush_to_memory(TGL *const tgl, char *const buf, const size_t size, size_t *const len)
+{
+#ifdef TERMGL_THREADS
+	itgl_presenter_lock(tgl);
+	/* Rows changed by frames the presenter has not printed may differ from prev_frame_buffer.
+	 * A pending frame is printed after this one, so its differences to frame_buffer stay dirty on both sides
+	 **/
+	Presenter *const presenter = tgl->dirty_rows ? tgl->presenter : NULL;
+	if (presenter) {
+		itgl_rows_merge(tgl->dirty_rows, presenter->dirty_rows, tgl->height);
+		itgl_rows_merge(tgl->dirty_rows, presenter->pending_dirty_rows, tgl->height);
+		if (presenter->pending_valid)
+			itgl_rows_merge(presenter->pending_dirty_rows, tgl->dirty_rows, tgl->height);
 	}
-	int dy0 = v1.y - v0.y;
-	int dx1 = v2.x - v0.x;
-	if (dx1 < 0) {
-		dx1 = -dx1;
-		signx1 = -1;
+#endif
+	tgl->output_memory = buf;
+	tgl->output_memory_size = size;
+	tgl->output_memory_len = 0;
+	int ret = -1;
+	if (tgl->output_buffer_size) {
+		STATS_TIME_BEGIN(flush);
+		ret = itgl_present(tgl);
+		STATS_TIME_END(tgl, flush_ns, flush);
 	} else {
-		signx1 = 1;
+		errno = EINVAL;
 	}
-	int dy1 = v2.y - v0.y;
+	tgl->output_memory = NULL;
+	*len = tgl->output_memory_len;
+	if (!ret && *len > size) {
+		/* prev_frame_buffer already holds the frame which was not printed */
+		tgl->prev_frame_valid = false;
+		errno = ENOBUFS;
+		ret = -1;
+	}
+#ifdef TERMGL_THREADS
+	if (presenter && presenter->pending_valid)
+		itgl_rows_merge(tgl->dirty_rows, presenter->pending_dirty_rows, tgl->height);
+	itgl_presenter_unlock(tgl);
+#endif
+	return ret;
+}
 
-	if (dy0 > dx0) {
-		SWAP(int, dx0, dy0);
-		changed0 = true;
+/* Prints frame_buffer */
+int itgl_present(TGL *const tgl)
+{
+	/* Output other than stdout is only written from the output buffer */
+	if (TGL_UNLIKELY(tgl->output_callback && !tgl->output_buffer_size)) {
+		errno = EINVAL;
+		return -1;
 	}
-	if (dy1 > dx1) {
-		SWAP(int, dx1, dy1);
-		changed1 = true;
+	if (tgl->settings & (TGL_HALF_BLOCK | TGL_BRAILLE))
+		return itgl_present_cells(tgl);
+
+	if (tgl->quantize_colors)
+		itgl_quantize_frame(tgl, tgl->dirty_rows && (tgl->settings & TGL_DIFF_FLUSH) && tgl->prev_frame_valid);
+
+	if (tgl->settings & TGL_DIFF_FLUSH) {
+		if (tgl->prev_frame_valid) {
+			CALL(itgl_flush_diff(tgl), -1);
+			itgl_prev_frame_update(tgl, false);
+			return 0;
+		}
+		itgl_prev_frame_update(tgl, true);
+		tgl->prev_frame_valid = true;
 	}
-	int e1 = dx1 >> 1;
-	int e0;
-	if (v0.y == v1.y)
-		goto LBL_NEXT;
-	e0 = dx0 >> 1;
 
-	for (int i = 0; i < dx0;) {
-		t0xp = t1xp = 0;
-		if (t0x < t1x) {
-			minx = t0x;
-			maxx = t1x;
+	if (tgl->output_buffer_size) {
+		char *output_buffer_loc = tgl->output_buffer;
+		if ((tgl->settings & TGL_PROGRESSIVE) && !tgl->clear_screen) {
+			memcpy(output_buffer_loc, "\033[;H", 4);
+			output_buffer_loc += 4;
 		} else {
-			minx = t1x;
-			maxx = t0x;
+			memcpy(output_buffer_loc, "\033[1;1H\033[2J", 10);
+			output_buffer_loc += 10;
 		}
-		while (i < dx0) {
-			i++;
-			e0 += dy0;
-			while (e0 >= dx0) {
-				e0 -= dx0;
-				if (changed0)
-					t0xp = signx0;
-				else
-					goto LBL_NEXT1;
+		tgl->clear_screen = false;
+		CALL(itgl_flush_frame(tgl, &output_buffer_loc), -1);
+		*output_buffer_loc++ = '\033';
+		*output_buffer_loc++ = '[';
+		*output_buffer_loc++ = '0';
+		*output_buffer_loc++ = 'm';
+		return itgl_write(tgl, tgl->output_buffer, output_buffer_loc - tgl->output_buffer);
+	} else {
+		TGLPixFmt color = TGL_PIXFMT(TGL_IDX(TGL_WHITE));
+		unsigned row, col;
+		const char *chars = tgl->frame_buffer.chars;
+		const TGLPixFmt *colors = FLUSH_COLORS(tgl);
+		const bool double_chars = tgl->settings & TGL_DOUBLE_CHARS;
+		const bool double_width = tgl->settings & TGL_DOUBLE_WIDTH;
+		const bool clear = !(tgl->settings & TGL_PROGRESSIVE) || tgl->clear_screen;
+		tgl->clear_screen = false;
+		if (!clear)
+			CALL_STDOUT(fputs("\033[;H", stdout), -1);
+		else
+			TGL_CLEAR_SCR;
+		STATS_ADD(tgl, bytes_flushed, clear ? 10u : 4u);
+		for (row = 0; row < tgl->height; row++) {
+			if (double_width)
+				CALL_STDOUT(fputs("\033#6", stdout), -1);
+			STATS_ADD(tgl, bytes_flushed, (double_width ? 3u : 0u) + tgl->width * (double_chars ? 2u : 1u) + 1u);
+			for (col = 0; col < tgl->width; col++) {
+				if (!PIXFMT_EQ(color, *colors)) {
+					char buf[48];
+					char *const buf_end = itgl_generate_sgr(color, *colors, buf);
+					*buf_end = '\0';
+					color = *colors;
+					STATS_ADD(tgl, sgr_codes, 1);
+					STATS_ADD(tgl, bytes_flushed, buf_end - buf);
+					CALL_STDOUT(fputs(buf, stdout), -1);
+				}
+				if (tgl->glyphs) {
+					const Glyph *const glyph = &tgl->glyphs[(uint8_t)*chars];
+					CALL(fwrite(glyph->bytes, 1, glyph->len, stdout) != glyph->len, -1);
+					if (double_chars)
+						CALL(fwrite(glyph->bytes, 1, glyph->len, stdout) != glyph->len, -1);
+					STATS_ADD(tgl, bytes_flushed, (glyph->len - 1u) * (double_chars ? 2u : 1u));
+				} else {
+					CALL_STDOUT(putchar(*chars), -1);
+					if (double_chars)
+						CALL_STDOUT(putchar(*chars), -1);
+				}
+				chars++;
+				colors++;
 			}
-			if (changed0)
-				break;
-			t0x += signx0;
-		}
-		/* Move line */
-	LBL_NEXT1:
-		/* process second line until y value is about to change */
-		while (true) {
-			e1 += dy1;
-			while (e1 >= dx1) {
-				e1 -= dx1;
-				if (changed1)
-					t1xp = signx1;
-				else
-					goto LBL_NEXT2;
+			CALL_STDOUT(putchar('\n'), -1);
+		}
+		CALL_STDOUT(fputs("\033[0m", stdout), -1);
+		CALL_STDOUT(fflush(stdout), -1);
+		STATS_ADD(tgl, bytes_flushed, 4u);
+	}
+
+	return 0;
+}
+
+/* Resolves pixels of frame_buffer into a frame of cells, which is printed by a TGL of its size like a frame buffer
+ * Only cells of dirty rows are resolved when only they are printed. prev_frame_buffer holds the previous frame of cells, which is smaller than one of pixels
+ **/
+int itgl_present_cells(TGL *const tgl)
+{
+	const unsigned cell_w = CELL_W(tgl->settings), cell_h = CELL_H(tgl->settings);
+	TGL present = *tgl;
+	present.width = (tgl->width + cell_w - 1u) / cell_w;
+	present.height = (tgl->height + cell_h - 1u) / cell_h;
+	present.max_x = present.width - 1;
+	present.max_y = present.height - 1;
+	present.frame_size = present.width * present.height;
+	present.settings &= ~(TGL_HALF_BLOCK | TGL_BRAILLE);
+	present.glyphs = (tgl->settings & TGL_BRAILLE) ? glyphs_braille : glyphs_half_block;
+	present.dirty_rows = tgl->dirty_rows ? tgl->cells : NULL;
+	itgl_frame_init(&present.frame_buffer, tgl->cells + CELL_ROWS_MAX(tgl->height), present.frame_size);
+	if (tgl->prev_frame_buffer.colors)
+		itgl_frame_init(&present.prev_frame_buffer, tgl->prev_frame_buffer.colors, present.frame_size);
+
+	const bool dirty = tgl->dirty_rows && (tgl->settings & TGL_DIFF_FLUSH) && tgl->prev_frame_valid;
+	unsigned row;
+	for (row = 0; row < present.height; row++) {
+		RowRange range = { .x0 = 0, .x1 = present.max_x };
+		if (tgl->dirty_rows) {
+			RowRange pixels = { .x0 = INT_MAX, .x1 = -1 };
+			const unsigned y_end = MIN((row + 1u) * cell_h, tgl->height);
+			unsigned y;
+			for (y = row * cell_h; y < y_end; y++) {
+				pixels.x0 = MIN(pixels.x0, tgl->dirty_rows[y].x0);
+				pixels.x1 = MAX(pixels.x1, tgl->dirty_rows[y].x1);
 			}
-			if (changed1)
-				break;
-			t1x += signx1;
-		}
-	LBL_NEXT2:
-		if (minx > t0x)
-			minx = t0x;
-		if (minx > t1x)
-			minx = t1x;
-		if (maxx < t0x)
-			maxx = t0x;
-		if (maxx < t1x)
-			maxx = t1x;
-
-		const uint8_t vu0 = ((y - v0.y) * v1.u + (v1.y - y) * v0.u) / (v1.y - v0.y);
-		const uint8_t vv0 = ((y - v0.y) * v1.v + (v1.y - y) * v0.v) / (v1.y - v0.y);
-		const uint8_t vu1 = ((y - v0.y) * v2.u + (v2.y - y) * v0.u) / (v2.y - v0.y);
-		const uint8_t vv1 = ((y - v0.y) * v2.v + (v2.y - y) * v0.v) / (v2.y - v0.y);
-		const float vz0 = ((y - v0.y) * v1.z + (v1.y - y) * v0.z) / (v1.y - v0.y);
-		const float vz1 = ((y - v0.y) * v2.z + (v2.y - y) * v0.z) / (v2.y - v0.y);
-
-		if (t0x < t1x)
-			itgl_horiz_line(tgl, minx, vz0, vu0, vv0, maxx, vz1, vu1, vv1, y, t, data);
+			present.dirty_rows[row] = (pixels.x0 > pixels.x1) ? pixels : (RowRange){ .x0 = pixels.x0 / (int)cell_w, .x1 = pixels.x1 / (int)cell_w };
+			if (dirty)
+				range = present.dirty_rows[row];
+		}
+		if (range.x0 > range.x1)
+			continue;
+		if (tgl->settings & TGL_BRAILLE)
+			itgl_resolve_braille(tgl, &present.frame_buffer, present.width, row, range.x0, range.x1);
 		else
-			itgl_horiz_line(tgl, minx, vz1, vu1, vv1, maxx, vz0, vu0, vv0, y, t, data);
-
-		if (!changed0)
-			t0x += signx0;
-		t0x += t0xp;
-		if (!changed1)
-			t1x += signx1;
-		t1x += t1xp;
-		y += 1;
-		if (y == v1.y)
-			break;
-	}
-LBL_NEXT:
-	/* Second half */
-	dx0 = v2.x - v1.x;
-	if (dx0 < 0) {
-		dx0 *= -1;
-		signx0 = -1;
-	} else {
-		signx0 = 1;
+			itgl_resolve_half_block(tgl, &present.frame_buffer, present.width, row, range.x0, range.x1);
 	}
-	dy0 = v2.y - v1.y;
-	t0x = v1.x;
-	if (dy0 > dx0) {
-		SWAP(int, dy0, dx0);
-		changed0 = true;
-	} else {
-		changed0 = false;
+
+	const int ret = itgl_present(&present);
+	tgl->output_buffer = present.output_buffer;
+	tgl->output_buffer_size = present.output_buffer_size;
+	tgl->output_memory_len = present.output_memory_len;
+	tgl->prev_frame_valid = present.prev_frame_valid;
+	tgl->clear_screen = present.clear_screen;
+	/* Rows of a frame which failed to print stay dirty */
+	if (!ret && tgl->dirty_rows)
+		itgl_rows_fill(tgl->dirty_rows, tgl->height, INT_MAX, -1);
+	return ret;
+}
+
+/* Color a pixel shows in a cell: its foreground if it has a char, otherwise its background. Flags other than TGL_RGB24 are dropped */
+inline TGLFmt itgl_subcell_color(const TGLPixFmt *const color, const char c)
+{
+	const TGLFmt fmt = (c != ' ') ? color->fg : color->bkg;
+	return (TGLFmt){
+		.flags = fmt.flags & TGL_RGB24,
+		.color = fmt.color,
+	};
+}
+
+/* Resolves cells x0 to x1 of row, each printed as an upper half block over the color of the lower pixel, or a space if both pixels show the same color */
+void itgl_resolve_half_block(const TGL *const tgl, const Frame *const cells, const unsigned width, const unsigned row, const int x0, const int x1)
+{
+	const unsigned top = 2u * row * tgl->width;
+	const bool has_bottom = 2u * row + 1u < tgl->height;
+	const unsigned bottom = has_bottom ? top + tgl->width : top;
+	TGLPixFmt *const colors = cells->colors + row * width;
+	char *const chars = cells->chars + row * width;
+	int x;
+	for (x = x0; x <= x1; x++) {
+		const TGLFmt upper = itgl_subcell_color(&tgl->frame_buffer.colors[top + x], tgl->frame_buffer.chars[top + x]);
+		const TGLFmt lower = has_bottom ? itgl_subcell_color(&tgl->frame_buffer.colors[bottom + x], tgl->frame_buffer.chars[bottom + x]) : (TGLFmt){ 0 };
+		const bool blank = !memcmp(&upper, &lower, sizeof(TGLFmt));
+		chars[x] = blank ? CELL_BLANK : CELL_UPPER_HALF;
+		colors[x] = (TGLPixFmt){
+			.fg = blank ? (TGLFmt){ 0 } : upper,
+			.bkg = lower,
+		};
 	}
-	e0 = dx0 >> 1;
+}
 
-	for (int i = 0; i <= dx0; i++) {
-		t0xp = t1xp = 0;
-		if (t0x < t1x) {
-			minx = t0x;
-			maxx = t1x;
-		} else {
-			minx = t1x;
-			maxx = t0x;
-		}
-		while (i < dx0) {
-			e0 += dy0;
-			while (e0 >= dx0) {
-				e0 -= dx0;
-				if (changed0) {
-					t0xp = signx0;
-					break;
+/* Resolves cells x0 to x1 of row, each printed as the dots of pixels with chars in the foreground of the first of them, over the background of the first pixel without */
+void itgl_resolve_braille(const TGL *const tgl, const Frame *const cells, const unsigned width, const unsigned row, const int x0, const int x1)
+{
+	const unsigned y_end = MIN(4u * row + 4u, tgl->height);
+	TGLPixFmt *const colors = cells->colors + row * width;
+	char *const chars = cells->chars + row * width;
+	int x;
+	for (x = x0; x <= x1; x++) {
+		const unsigned x_end = MIN(2u * x + 2u, tgl->width);
+		TGLFmt fg = { 0 }, bkg = { 0 };
+		bool has_bkg = false;
+		uint8_t mask = 0;
+		unsigned px, py;
+		for (py = 4u * row; py < y_end; py++) {
+			for (px = 2u * x; px < x_end; px++) {
+				const unsigned idx = py * tgl->width + px;
+				const char c = tgl->frame_buffer.chars[idx];
+				if (c != ' ') {
+					if (!mask)
+						fg = itgl_subcell_color(&tgl->frame_buffer.colors[idx], c);
+					mask |= braille_dots[py - 4u * row][px - 2u * x];
+				} else if (!has_bkg) {
+					bkg = itgl_subcell_color(&tgl->frame_buffer.colors[idx], c);
+					has_bkg = true;
 				}
-				goto LBL_NEXT3;
 			}
-			if (changed0)
-				break;
-			t0x += signx0;
-			if (i < dx0)
-				i++;
-		}
-	LBL_NEXT3:
-		while (t1x != v2.x) {
-			e1 += dy1;
-			while (e1 >= dx1) {
-				e1 -= dx1;
-				if (changed1)
-					t1xp = signx1;
-				else
-					goto LBL_NEXT4;
-			}
-			if (changed1)
-				break;
-			t1x += signx1;
-		}
-	LBL_NEXT4:
-		if (minx > t0x)
-			minx = t0x;
-		if (minx > t1x)
-			minx = t1x;
-		if (maxx < t0x)
-			maxx = t0x;
-		if (maxx < t1x)
-			maxx = t1x;
-
-		if (v1.y != v2.y) {
-			const uint8_t vu0 = ((y - v0.y) * v2.u + (v2.y - y) * v0.u) / (v2.y - v0.y);
-			const uint8_t vv0 = ((y - v0.y) * v2.v + (v2.y - y) * v0.v) / (v2.y - v0.y);
-			const uint8_t vu1 = ((y - v1.y) * v2.u + (v2.y - y) * v1.u) / (v2.y - v1.y);
-			const uint8_t vv1 = ((y - v1.y) * v2.v + (v2.y - y) * v1.v) / (v2.y - v1.y);
-			const float vz0 = ((y - v0.y) * v2.z + (v2.y - y) * v0.z) / (v2.y - v0.y);
-			const float vz1 = ((y - v1.y) * v2.z + (v2.y - y) * v1.z) / (v2.y - v1.y);
-
-			if (t1x < t0x)
-				itgl_horiz_line(tgl, minx, vz0, vu0, vv0, maxx, vz1, vu1, vv1, y, t, data);
-			else
-				itgl_horiz_line(tgl, minx, vz1, vu1, vv1, maxx, vz0, vu0, vv0, y, t, data);
-		} else {
-			itgl_horiz_line(tgl, minx, v1.z, v1.u, v1.v, maxx, v2.z, v2.u, v2.v, y, t, data);
 		}
+		chars[x] = (char)mask;
+		colors[x] = (TGLPixFmt){
+			.fg = fg,
+			.bkg = bkg,
+		};
+	}
+}
 
-		if (!changed0)
-			t0x += signx0;
-		t0x += t0xp;
-		if (!changed1)
-			t1x += signx1;
-		t1x += t1xp;
-		y += 1;
-		if (y > v2.y)
-			return;
-	};
+/* Writes c, or its glyph if glyphs is set */
+inline char *itgl_put_char(const Glyph *const glyphs, const char c, char *const loc)
+{
+	if (!glyphs) {
+		*loc = c;
+		return loc + 1;
+	}
+	const Glyph *const glyph = &glyphs[(uint8_t)c];
+	memcpy(loc, glyph->bytes, 4);
+	return loc + glyph->len;
 }
 
-int tgl_enable(TGL *const tgl, const uint8_t settings)
+int tgl_set_glyph(TGL *const tgl, const uint8_t id, const char *const utf8)
 {
-	const uint8_t enable = settings & ~tgl->settings;
-	tgl->settings |= settings;
-	if (enable & TGL_Z_BUFFER) {
-		tgl->z_buffer_enabled = true;
-		tgl->z_buffer = TGL_MALLOC(sizeof(float) * tgl->frame_size);
-		if (!tgl->z_buffer)
-			return -1;
-		tgl_clear(tgl, TGL_Z_BUFFER);
+	const size_t len = utf8 ? strlen(utf8) : 1u;
+	if (id >= 0x80 || !len || len > 4u) {
+		errno = EINVAL;
+		return -1;
 	}
-	if (enable & TGL_OUTPUT_BUFFER) {
-		/* Longest non-rgb SGR code: \033[22;24;XX;10Xm (length 15)
-		 * Longest rgb SGR code: \033[22;24;38;2;XXX;XXX;XXX;48;2;XXX;XXX;XXXm (length 42)
-		 * Maximum 44 chars per pixel: SGR + 2 x char
-		 * 1 Newline character per line
-		 * DECDWL code: \033#6 (length 3) per line
-		 * {SGR clear code: \033[0m } OR {SGR set cursor position code: \033[;H } (length 4) at start
-		 * 1 NUL terminator
-		 */
-		tgl->output_buffer_size = 44u * tgl->frame_size + tgl->height * 4u + 4u + 1u;
-		tgl->output_buffer = TGL_MALLOC(tgl->output_buffer_size);
-		if (!tgl->output_buffer)
+#ifdef TERMGL_THREADS
+	itgl_presenter_lock(tgl);
+#endif
+	/* All chars are looked up once any glyph is set, so others print themselves */
+	if (!tgl->glyphs) {
+		Glyph *const glyphs = itgl_alloc(tgl, sizeof(Glyph) * 256u);
+		if (!glyphs) {
+#ifdef TERMGL_THREADS
+			itgl_presenter_unlock(tgl);
+#endif
 			return -1;
-		tgl_clear(tgl, TGL_OUTPUT_BUFFER);
+		}
+		unsigned i;
+		for (i = 0; i < 256u; i++)
+			glyphs[i] = (Glyph){ .bytes = { (char)i }, .len = 1 };
+		tgl->glyphs = glyphs;
 	}
+	Glyph *const glyph = (Glyph *)&tgl->glyphs[0x80 | id];
+	*glyph = (Glyph){ .bytes = { (char)(0x80 | id) }, .len = 1 };
+	if (utf8) {
+		memcpy(glyph->bytes, utf8, len);
+		glyph->len = (uint8_t)len;
+	}
+	/* Cells of the glyph which were printed are not changed in the frame buffer */
+	tgl->prev_frame_valid = false;
+#ifdef TERMGL_THREADS
+	itgl_presenter_unlock(tgl);
+#endif
 	return 0;
 }
 
-void tgl_disable(TGL *const tgl, const uint8_t settings)
+TGLBroadcast *tgl_broadcast_create(const TGL *const tgl, const unsigned keyframe_interval)
 {
-	tgl->settings &= ~settings;
-	if (settings & TGL_Z_BUFFER) {
-		tgl->z_buffer_enabled = false;
-		TGL_FREE(tgl->z_buffer);
-		tgl->z_buffer = NULL;
+	const unsigned n_frames = MAX(keyframe_interval, 1u);
+	TGLBroadcast *const broadcast = TGL_MALLOC(sizeof(TGLBroadcast) + sizeof(BroadcastFrame) * n_frames);
+	if (!broadcast)
+		return NULL;
+	broadcast->width = tgl->width;
+	broadcast->height = tgl->height;
+	broadcast->keyframe_interval = n_frames;
+	broadcast->n_frames = 0;
+	broadcast->prev_frame_valid = false;
+	memset(&broadcast->next, 0, sizeof(BroadcastFrame));
+	memset(broadcast->frames, 0, sizeof(BroadcastFrame) * n_frames);
+	void *const frame_mem = TGL_MALLOC(FRAME_BYTES(tgl->frame_size));
+	if (!frame_mem) {
+		TGL_FREE(broadcast);
+		return NULL;
 	}
-	if (settings & TGL_OUTPUT_BUFFER) {
-		tgl->output_buffer_size = 0;
-		TGL_FREE(tgl->output_buffer);
-		tgl->output_buffer = NULL;
+	itgl_frame_init(&broadcast->prev_frame_buffer, frame_mem, tgl->frame_size);
+	broadcast->output_buffer_size = itgl_slot_size(tgl, ARENA_OUTPUT_BUFFER);
+	broadcast->output_buffer = TGL_MALLOC(broadcast->output_buffer_size);
+	if (!broadcast->output_buffer) {
+		TGL_FREE(frame_mem);
+		TGL_FREE(broadcast);
+		return NULL;
 	}
+	return broadcast;
 }
 
-void tgl_delete(TGL *const tgl)
+void tgl_broadcast_delete(TGLBroadcast *const broadcast)
 {
-	TGL_FREE(tgl->frame_buffer);
-	TGL_FREE(tgl->z_buffer);
-	TGL_FREE(tgl->output_buffer);
-	TGL_FREE(tgl);
+	if (!broadcast)
+		return;
+	unsigned i;
+	for (i = 0; i < broadcast->keyframe_interval; i++) {
+		TGL_FREE(broadcast->frames[i].delta.data);
+		TGL_FREE(broadcast->frames[i].keyframe.data);
+	}
+	TGL_FREE(broadcast->next.delta.data);
+	TGL_FREE(broadcast->next.keyframe.data);
+	TGL_FREE(broadcast->prev_frame_buffer.colors);
+	TGL_FREE(broadcast->output_buffer);
+	TGL_FREE(broadcast);
 }
 
-#ifdef TERMGL3D
-
-#include <math.h>
+/* A frame which fails to encode is not published, and the next delta prints the whole frame */
+int tgl_broadcast_encode(TGLBroadcast *const broadcast, TGL *const tgl)
+{
+	if (tgl->width != broadcast->width || tgl->height != broadcast->height) {
+		errno = EINVAL;
+		return -1;
+	}
+	BroadcastFrame *const frame = &broadcast->frames[broadcast->n_frames % broadcast->keyframe_interval];
+	const bool keyframe = !(broadcast->n_frames % broadcast->keyframe_interval);
+	int ret = 0;
+#ifdef TERMGL_THREADS
+	itgl_presenter_lock(tgl);
+#endif
+	if (keyframe)
+		ret = itgl_broadcast_present(broadcast, tgl, tgl->settings & ~TGL_DIFF_FLUSH, &broadcast->next.keyframe);
+	if (!ret)
+		ret = itgl_broadcast_present(broadcast, tgl, tgl->settings | TGL_DIFF_FLUSH, &broadcast->next.delta);
+#ifdef TERMGL_THREADS
+	itgl_presenter_unlock(tgl);
+#endif
+	if (ret) {
+		broadcast->prev_frame_valid = false;
+		return -1;
+	}
+	SWAP(BroadcastChunk, frame->delta, broadcast->next.delta);
+	if (keyframe)
+		SWAP(BroadcastChunk, frame->keyframe, broadcast->next.keyframe);
+	broadcast->n_frames++;
+	return 0;
+}
 
-#define TGL_CULL_FACE_BIT 0x01
-#define TGL_WINDING_BIT 0x02
+/* Prints frame_buffer of tgl into chunk, with the previous frame and output buffer of broadcast */
+int itgl_broadcast_present(TGLBroadcast *const broadcast, TGL *const tgl, const uint32_t settings, BroadcastChunk *const chunk)
+{
+	TGL present = {
+		.width = tgl->width,
+		.height = tgl->height,
+		.frame_size = tgl->frame_size,
+		.frame_buffer = tgl->frame_buffer,
+		.prev_frame_buffer = broadcast->prev_frame_buffer,
+		.output_buffer = broadcast->output_buffer,
+		.output_buffer_size = broadcast->output_buffer_size,
+		.prev_frame_valid = broadcast->prev_frame_valid,
+		.output_callback = &itgl_broadcast_append,
+		.output_ctx = chunk,
+		.settings = settings,
+		.quantize_colors = tgl->quantize_colors,
+		.quantize_lut = tgl->quantize_lut,
+		.quantize_channels = tgl->quantize_channels,
+		.quantize_flags = tgl->quantize_flags,
+		.glyphs = tgl->glyphs,
+		.cells = tgl->cells,
+		.allocator = { .alloc = &itgl_std_alloc, .free = &itgl_std_free }, /* of output_buffer of broadcast */
+#ifdef TERMGL_THREADS
+		.pool = tgl->pool,
+#endif
+#ifdef TERMGL_PROFILE
+		.stats = tgl->stats,
+		.n_stats = tgl->n_stats,
+#endif
+	};
+	chunk->len = 0;
+	const int ret = itgl_present(&present);
+	broadcast->output_buffer = present.output_buffer;
+	broadcast->output_buffer_size = present.output_buffer_size;
+	broadcast->prev_frame_valid = present.prev_frame_valid;
+	return ret;
+}
 
-#define MAP_COORD(half, val) (((val) * (half)) + (half))
+/* Output callback of itgl_broadcast_present */
+int itgl_broadcast_append(const char *const buf, const size_t len, void *const ctx)
+{
+	BroadcastChunk *const chunk = ctx;
+	if (chunk->capacity - chunk->len < len) {
+		const size_t capacity = MAX(chunk->capacity * 2u, chunk->len + len);
+		char *const data = TGL_REALLOC(chunk->data, capacity);
+		if (!data)
+			return -1;
+		chunk->data = data;
+		chunk->capacity = capacity;
+	}
+	memcpy(chunk->data + chunk->len, buf, len);
+	chunk->len += len;
+	return 0;
+}
 
-#define TGL_ROTATION_MATRIX(x, y, z)                                                                                                                   \
-	{                                                                                                                                              \
-		{ cosf(z) * cosf(y), -sinf(z) * cosf(x) + cosf(z) * sinf(y) * sinf(x), sinf(z) * sinf(x) + cosf(z) * sinf(y) * cosf(x), 0.f },         \
-			{ sinf(z) * cosf(y), cosf(z) * cosf(x) + sinf(z) * sinf(y) * sinf(x), -cosf(z) * sinf(x) + sinf(z) * sinf(y) * cosf(x), 0.f }, \
-			{ -sinf(y), cosf(y) * sinf(x), cosf(y) * cosf(x), 0.f },                                                                       \
-			{ 0.f, 0.f, 0.f, 1.f },                                                                                                        \
+/* Viewers behind the last keyframe skip to it, others read deltas */
+bool tgl_broadcast_read(const TGLBroadcast *const broadcast, uint64_t *const seq, const char **const buf, size_t *const len)
+{
+	if (*seq >= broadcast->n_frames)
+		return false;
+	const uint64_t keyframe_seq = (broadcast->n_frames - 1) / broadcast->keyframe_interval * broadcast->keyframe_interval;
+	const BroadcastChunk *chunk;
+	if (*seq < keyframe_seq) {
+		chunk = &broadcast->frames[0].keyframe;
+		*seq = keyframe_seq + 1;
+	} else {
+		chunk = &broadcast->frames[*seq % broadcast->keyframe_interval].delta;
+		++*seq;
 	}
+	*buf = chunk->data;
+	*len = chunk->len;
+	return true;
+}
 
-#define TGL_SCALE_MATRIX(x, y, z)               \
-	{                                       \
-		{ x, 0.f, 0.f, 0.f },           \
-			{ 0.f, y, 0.f, 0.f },   \
-			{ 0.f, 0.f, z, 0.f },   \
-			{ 0.f, 0.f, 0.f, 1.f }, \
-	}
+void tgl_putchar(TGL *const tgl, int x, int y, const char c, const TGLPixFmt color)
+{
+	itgl_clip(tgl, &x, &y);
+	SET_PIXEL_RAW(tgl, x, y, c, color);
+	itgl_dirty_rect(tgl, x, y, x, y);
+}
 
-#define TGL_TRANSLATE_MATRIX(x, y, z)           \
-	{                                       \
-		{ 1.f, 0.f, 0.f, x },           \
-			{ 0.f, 1.f, 0.f, y },   \
-			{ 0.f, 0.f, 1.f, z },   \
-			{ 0.f, 0.f, 0.f, 1.f }, \
+void tgl_puts(TGL *const tgl, const int x, int y, const char *str, const TGLPixFmt color)
+{
+	int cur_x = x;
+	while (*str) {
+		if (TGL_UNLIKELY(*str == '\n')) {
+			cur_x = x;
+			y++;
+			str++;
+			continue;
+		}
+		itgl_clip(tgl, &cur_x, &y);
+		SET_PIXEL_RAW(tgl, cur_x, y, *str, color);
+		itgl_dirty_rect(tgl, cur_x, y, cur_x, y);
+		cur_x++;
+		str++;
 	}
+}
 
-#define TGL_CAMERA_MATRIX(width, height, fov, near_val, far_val)                                                                                     \
-	{                                                                                                                                            \
-		{ (height) / (float)(width) / tanf((fov)*.5f), 0.f, 0.f, 0.f },                                                                      \
-			{ 0.f, 1.f / tanf((fov)*.5f), 0.f, 0.f },                                                                                    \
-			{ 0.f, 0.f, -((far_val) + (near_val)) / ((far_val) - (near_val)), 2.f * (far_val) * (near_val) / ((far_val) - (near_val)) }, \
-			{ 0.f, 0.f, 1.f, 0.f },                                                                                                      \
+TGLSprite *tgl_sprite_create(const unsigned width, const unsigned height, const char *const chars, const TGLPixFmt *const colors, const char transparent)
+{
+	if (width > UINT16_MAX || height > UINT16_MAX) {
+		errno = EINVAL;
+		return NULL;
 	}
+	/* Sized by a first pass, so that the sprite is one allocation */
+	size_t n_runs = 0, n_pixels = 0;
+	unsigned x, y;
+	for (y = 0; y < height; y++) {
+		const char *const row = chars + y * width;
+		for (x = 0; x < width; x++) {
+			if (row[x] == transparent)
+				continue;
+			if (!x || row[x - 1] == transparent)
+				n_runs++;
+			n_pixels++;
+		}
+	}
+	TGLSprite *const sprite = TGL_MALLOC(sizeof(TGLSprite) + sizeof(SpriteRun) * n_runs + sizeof(uint32_t) * (height + 1u) + (sizeof(TGLPixFmt) + sizeof(char)) * n_pixels);
+	if (!sprite)
+		return NULL;
+	sprite->width = width;
+	sprite->height = height;
+	sprite->runs = (SpriteRun *)(sprite + 1);
+	sprite->rows = (uint32_t *)(sprite->runs + n_runs);
+	sprite->colors = (TGLPixFmt *)(sprite->rows + height + 1u);
+	sprite->chars = (char *)(sprite->colors + n_pixels);
+
+	uint32_t run = 0, offset = 0;
+	for (y = 0; y < height; y++) {
+		const unsigned row = y * width;
+		sprite->rows[y] = run;
+		for (x = 0; x < width; x++) {
+			if (chars[row + x] == transparent)
+				continue;
+			if (!x || chars[row + x - 1] == transparent)
+				sprite->runs[run++] = (SpriteRun){ .x = x, .length = 0, .offset = offset };
+			sprite->runs[run - 1].length++;
+			/* Normalized once, instead of by each tgl_blit */
+			sprite->colors[offset] = itgl_pixfmt_norm(colors[row + x]);
+			sprite->chars[offset] = chars[row + x];
+			offset++;
+		}
+	}
+	sprite->rows[height] = run;
+	return sprite;
+}
 
-enum ClipPlane {
-	CLIP_NEAR = 0,
-	CLIP_FAR,
-	CLIP_LEFT,
-	CLIP_RIGHT,
-	CLIP_TOP,
-	CLIP_BOTTOM,
-};
-
-typedef struct TGLUVTriangle {
-	TGLVec4 verts[3];
-	uint8_t uv[3][2];
-} TGLUVTriangle;
-
-static void itgl_clip_line(float dot_i, const TGLVec4 vec_i, const uint8_t uv_i[2], float dot_o, const TGLVec4 vec_o, const uint8_t uv_o[2], TGLVec4 vec_out, uint8_t uv_out[2]);
-static unsigned itgl_clip_triangle_plane(enum ClipPlane plane, const TGLUVTriangle *in, TGLUVTriangle *out);
-static float itgl_clip_plane_dot(const TGLVec4 v, enum ClipPlane plane);
+void tgl_sprite_delete(TGLSprite *const sprite)
+{
+	TGL_FREE(sprite);
+}
 
-#ifndef TERMGL_MINIMAL
-float tgl_sqr(const float val)
+void tgl_blit(TGL *const tgl, const TGLSprite *const sprite, const int x, const int y)
 {
-	return val * val;
+	/* Clipped once to the rows and columns of the sprite on the screen */
+	const int row_begin = MAX(0, -y), row_end = MIN((int)sprite->height, (int)tgl->height - y);
+	const int col_begin = MAX(0, -x), col_end = MIN((int)sprite->width, (int)tgl->width - x);
+	if (row_begin >= row_end || col_begin >= col_end)
+		return;
+	int x0 = INT_MAX, x1 = -1, row;
+	for (row = row_begin; row < row_end; row++) {
+		const int dest = (y + row) * (int)tgl->width + x;
+		uint32_t run;
+		for (run = sprite->rows[row]; run < sprite->rows[row + 1]; run++) {
+			const SpriteRun r = sprite->runs[run];
+			if (r.x >= col_end)
+				break;
+			const int begin = MAX(r.x, col_begin), end = MIN(r.x + r.length, col_end);
+			if (begin >= end)
+				continue;
+			const uint32_t src = r.offset + (begin - r.x);
+			memcpy(tgl->frame_buffer.colors + dest + begin, sprite->colors + src, sizeof(TGLPixFmt) * (end - begin));
+			memcpy(tgl->frame_buffer.chars + dest + begin, sprite->chars + src, end - begin);
+			x0 = MIN(x0, begin);
+			x1 = MAX(x1, end - 1);
+		}
+	}
+	if (x0 <= x1)
+		itgl_dirty_rect(tgl, x + x0, y + row_begin, x + x1, y + row_end - 1);
 }
 
-float tgl_mag3(const float vec[3])
+void tgl_point(TGL *const tgl, TGLVert v0, TGLPixelShader *const t, const void *const data)
 {
-	return sqrtf(tgl_sqr(vec[0]) + tgl_sqr(vec[1]) + tgl_sqr(vec[2]));
+	itgl_clip(tgl, &v0.x, &v0.y);
+	SET_PIXEL(tgl, v0.x, v0.y, v0.z, v0.u, v0.v, t, data);
+	itgl_dirty_rect(tgl, v0.x, v0.y, v0.x, v0.y);
 }
 
-float tgl_magsqr3(const float vec[3])
+void tgl_line(TGL *const tgl, const TGLVert v0, const TGLVert v1, TGLPixelShader *const t, const void *const data)
 {
-	return tgl_sqr(vec[0]) + tgl_sqr(vec[1]) + tgl_sqr(vec[2]);
+	const Rect rect = SCREEN_RECT(tgl);
+	STATS_TIME_BEGIN(raster);
+	itgl_line(tgl, &rect, v0, v1, t, data);
+	STATS_TIME_END(tgl, raster_ns, raster);
+	itgl_dirty_verts(tgl, (const TGLVert[]){ v0, v1 }, 2);
 }
 
-float tgl_dot3(const float vec1[3], const float vec2[3])
+/* Bresenham's line algorithm between vertices clipped to the screen, shading pixels with set_pixel (SET_PIXEL_FLAT, SET_PIXEL_DEPTH or SET_PIXEL_DEPTH16) and pixel shader t_
+ * A variant is defined for each combination, which itgl_line selects once per line, so that pixels neither test the format of the depth buffer nor call built-in shaders through a pointer
+ **/
+#define DEFINE_LINE(name, set_pixel, t_)                                                                                   \
+void name(TGL *const tgl, const Rect *const rect, TGLVert v0, TGLVert v1, TGLPixelShader *const t, const void *const data) \
+{                                                                                                                          \
+	(void)t;                                                                                                           \
+	if (abs(v1.y - v0.y) < abs(v1.x - v0.x)) {                                                                         \
+		if (v0.x > v1.x) {                                                                                         \
+			SWAP(TGLVert, v1, v0);                                                                             \
+		}                                                                                                          \
+		const int dx = v1.x - v0.x;                                                                                \
+		int dy = v1.y - v0.y;                                                                                      \
+		int yi;                                                                                                    \
+		if (dy > 0) {                                                                                              \
+			yi = 1;                                                                                            \
+		} else {                                                                                                   \
+			yi = -1;                                                                                           \
+			dy *= -1;                                                                                          \
+		}                                                                                                          \
+		int d = (dy + dy) - dx;                                                                                    \
+		int y = v0.y;                                                                                              \
+		int x;                                                                                                     \
+		for (x = v0.x; x <= v1.x; x++) {                                                                           \
+			if (RECT_CONTAINS(rect, x, y))                                                                     \
+				set_pixel(tgl, x, y,                                                                       \
+					((x - v0.x) * v1.z + (v1.x - x) * v0.z) / dx,                                      \
+					((x - v0.x) * v1.u + (v1.x - x) * v0.u) / dx,                                      \
+					((x - v0.x) * v1.v + (v1.x - x) * v0.v) / dx,                                      \
+					t_, data);                                                                         \
+			if (d > 0) {                                                                                       \
+				y += yi;                                                                                   \
+				d += 2 * (dy - dx);                                                                        \
+			} else {                                                                                           \
+				d += dy + dy;                                                                              \
+			}                                                                                                  \
+		}                                                                                                          \
+	} else {                                                                                                           \
+		if (v0.y > v1.y) {                                                                                         \
+			SWAP(TGLVert, v1, v0);                                                                             \
+		}                                                                                                          \
+		int dx = v1.x - v0.x;                                                                                      \
+		const int dy = v1.y - v0.y;                                                                                \
+		int xi;                                                                                                    \
+		if (dx > 0) {                                                                                              \
+			xi = 1;                                                                                            \
+		} else {                                                                                                   \
+			xi = -1;                                                                                           \
+			dx *= -1;                                                                                          \
+		}                                                                                                          \
+		if (!dy) {                                                                                                 \
+			if (RECT_CONTAINS(rect, v0.x, v0.y))                                                               \
+				set_pixel(tgl, v0.x, v0.y, v0.z, v0.u, v0.v, t_, data);                                    \
+			return;                                                                                            \
+		}                                                                                                          \
+		int d = (dx + dx) - dy;                                                                                    \
+		int x = v0.x;                                                                                              \
+		int y;                                                                                                     \
+		for (y = v0.y; y <= v1.y; y++) {                                                                           \
+			if (RECT_CONTAINS(rect, x, y))                                                                     \
+				set_pixel(tgl, x, y,                                                                       \
+					((y - v0.y) * v1.z + (v1.y - y) * v0.z) / dy,                                      \
+					((y - v0.y) * v1.u + (v1.y - y) * v0.u) / dy,                                      \
+					((y - v0.y) * v1.v + (v1.y - y) * v0.v) / dy,                                      \
+					t_, data);                                                                         \
+			if (d > 0) {                                                                                       \
+				x += xi;                                                                                   \
+				d += 2 * (dx - dy);                                                                        \
+			} else {                                                                                           \
+				d += dx + dx;                                                                              \
+			}                                                                                                  \
+		}                                                                                                          \
+	}                                                                                                                  \
+}
+
+DEFINE_LINE(itgl_line_shader, SET_PIXEL_FLAT, t)
+DEFINE_LINE(itgl_line_shader_depth, SET_PIXEL_DEPTH, t)
+DEFINE_LINE(itgl_line_shader_depth16, SET_PIXEL_DEPTH16, t)
+#ifndef TERMGL_MINIMAL
+DEFINE_LINE(itgl_line_simple, SET_PIXEL_FLAT, tgl_pixel_shader_simple)
+DEFINE_LINE(itgl_line_simple_depth, SET_PIXEL_DEPTH, tgl_pixel_shader_simple)
+DEFINE_LINE(itgl_line_simple_depth16, SET_PIXEL_DEPTH16, tgl_pixel_shader_simple)
+DEFINE_LINE(itgl_line_texture, SET_PIXEL_FLAT, tgl_pixel_shader_texture)
+DEFINE_LINE(itgl_line_texture_depth, SET_PIXEL_DEPTH, tgl_pixel_shader_texture)
+DEFINE_LINE(itgl_line_texture_depth16, SET_PIXEL_DEPTH16, tgl_pixel_shader_texture)
+#endif
+
+void itgl_line(TGL *const tgl, const Rect *const rect, TGLVert v0, TGLVert v1, TGLPixelShader *const t, const void *const data)
 {
-	return vec1[0] * vec2[0] + vec1[1] * vec2[1] + vec1[2] * vec2[2];
+	itgl_clip(tgl, &v0.x, &v0.y);
+	itgl_clip(tgl, &v1.x, &v1.y);
+	/* Variants of each shader, indexed by ZFormat */
+	static LineRasterizer *const lines_shader[] = {
+		itgl_line_shader,
+		itgl_line_shader_depth,
+		itgl_line_shader_depth16,
+	};
+#ifndef TERMGL_MINIMAL
+	static LineRasterizer *const lines_simple[] = {
+		itgl_line_simple,
+		itgl_line_simple_depth,
+		itgl_line_simple_depth16,
+	};
+	static LineRasterizer *const lines_texture[] = {
+		itgl_line_texture,
+		itgl_line_texture_depth,
+		itgl_line_texture_depth16,
+	};
+	if (t == &tgl_pixel_shader_simple) {
+		lines_simple[tgl->z_format](tgl, rect, v0, v1, t, data);
+		return;
+	}
+	if (t == &tgl_pixel_shader_texture) {
+		lines_texture[tgl->z_format](tgl, rect, v0, v1, t, data);
+		return;
+	}
+#endif
+	lines_shader[tgl->z_format](tgl, rect, v0, v1, t, data);
 }
 
-float tgl_dot4(const float vec1[4], const float vec2[4])
+void tgl_triangle(TGL *const tgl, TGLVert v0, TGLVert v1, TGLVert v2, TGLPixelShader *const t, const void *data)
 {
-	return vec1[0] * vec2[0] + vec1[1] * vec2[1] + vec1[2] * vec2[2] + vec1[3] * vec2[3];
+	const Rect rect = SCREEN_RECT(tgl);
+	STATS_TIME_BEGIN(raster);
+	itgl_line(tgl, &rect, v0, v1, t, data);
+	itgl_line(tgl, &rect, v0, v2, t, data);
+	itgl_line(tgl, &rect, v1, v2, t, data);
+	STATS_TIME_END(tgl, raster_ns, raster);
+	itgl_dirty_verts(tgl, (const TGLVert[]){ v0, v1, v2 }, 3);
 }
 
-float tgl_dot43(const float vec1[4], const float vec2[3])
+void tgl_triangle_fill(TGL *const tgl, const TGLVert v0, const TGLVert v1, const TGLVert v2, TGLPixelShader *const t, const void *data)
 {
-	return vec1[0] * vec2[0] + vec1[1] * vec2[1] + vec1[2] * vec2[2] + vec1[3];
+	const Rect rect = SCREEN_RECT(tgl);
+	STATS_TIME_BEGIN(raster);
+	itgl_triangle_fill(tgl, &rect, v0, v1, v2, t, data);
+	STATS_TIME_END(tgl, raster_ns, raster);
+	itgl_dirty_verts(tgl, (const TGLVert[]){ v0, v1, v2 }, 3);
 }
 
-void tgl_add3s(const float vec1[3], const float summand, float res[3])
+/* Half-space rasterization: a pixel is filled if it lies on or inside all three edges.
+ * Attributes are planes in fixed point, evaluated at the start of each span and then stepped per pixel.
+ * Since the stepping is exact, the value at a pixel does not depend on where its span was clipped
+ **/
+void itgl_triangle_fill(TGL *const tgl, const Rect *const rect, const TGLVert v0, TGLVert v1, TGLVert v2, TGLPixelShader *const t, const void *data)
 {
-	res[0] = vec1[0] + summand;
-	res[1] = vec1[1] + summand;
-	res[2] = vec1[2] + summand;
+	int64_t area = (int64_t)(v1.x - v0.x) * (v2.y - v0.y) - (int64_t)(v1.y - v0.y) * (v2.x - v0.x);
+	if (!area) {
+		/* Degenerate triangle covers no pixel centers, so draw its edges to keep it visible */
+		itgl_line(tgl, rect, v0, v1, t, data);
+		itgl_line(tgl, rect, v0, v2, t, data);
+		itgl_line(tgl, rect, v1, v2, t, data);
+		return;
+	}
+	if (area < 0) {
+		SWAP(TGLVert, v1, v2);
+		area = -area;
+	}
+
+	const int x_min = MAX(MIN(MIN(v0.x, v1.x), v2.x), rect->x0);
+	const int x_max = MIN(MAX(MAX(v0.x, v1.x), v2.x), rect->x1);
+	const int y_min = MAX(MIN(MIN(v0.y, v1.y), v2.y), rect->y0);
+	const int y_max = MIN(MAX(MAX(v0.y, v1.y), v2.y), rect->y1);
+	if (x_min > x_max || y_min > y_max)
+		return;
+
+	/* Edge i is opposite of vertex i, and its edge function is the unnormalized barycentric weight of vertex i */
+	const Edge edges[3] = {
+		itgl_edge(v1, v2),
+		itgl_edge(v2, v0),
+		itgl_edge(v0, v1),
+	};
+	const double inv_area = 1. / (double)area;
+	const Plane plane_z = itgl_plane_z(edges, inv_area, v0.z, v1.z, v2.z);
+	if (tgl->z_format) {
+		const Rect bounds = { .x0 = x_min, .y0 = y_min, .x1 = x_max, .y1 = y_max };
+		if (itgl_plane_depth_max(tgl, &plane_z, &bounds) < itgl_z_tiles_min(tgl, &bounds)) {
+			STATS_ADD(tgl, triangles_occluded, 1);
+			return;
+		}
+	}
+	const Plane plane_u = itgl_plane_uv(edges, inv_area, v0.u, v1.u, v2.u);
+	const Plane plane_v = itgl_plane_uv(edges, inv_area, v0.v, v1.v, v2.v);
+
+	const PixelShaderAdapter adapter = { .shader = t, .data = data };
+	TGLSpanShader *const s = itgl_span_shader(tgl, t);
+	const void *const s_data = (s == &itgl_span_shader_pixel) ? (const void *)&adapter : data;
+
+	unsigned i;
+	int y;
+	if (x_max - x_min < FILL_SCAN_WIDTH) {
+		/* Narrow bounding box: find spans by stepping edge functions across it */
+		int64_t e_row[3];
+		for (i = 0; i < 3; i++)
+			e_row[i] = edges[i].a * x_min + edges[i].b * y_min + edges[i].c;
+		for (y = y_min; y <= y_max; y++) {
+			int64_t e0 = e_row[0], e1 = e_row[1], e2 = e_row[2];
+			int x = x_min;
+			while (x <= x_max && (e0 | e1 | e2) < 0) {
+				x++;
+				e0 += edges[0].a;
+				e1 += edges[1].a;
+				e2 += edges[2].a;
+			}
+			const int x_l = x;
+			while (x <= x_max && (e0 | e1 | e2) >= 0) {
+				x++;
+				e0 += edges[0].a;
+				e1 += edges[1].a;
+				e2 += edges[2].a;
+			}
+			if (x > x_l)
+				itgl_fill_span(tgl, y, x_l, x - 1, &plane_z, &plane_u, &plane_v, s, s_data);
+			for (i = 0; i < 3; i++)
+				e_row[i] += edges[i].b;
+		}
+		return;
+	}
+
+	/* Edge i limits spans to x >= -floor(e_row / a) if a > 0, or x <= floor(e_row / -a) if a < 0,
+	 * where e_row = b * y + c. The quotient is stepped per row together with its remainder */
+	int64_t quot[3], rem[3], quot_step[3], rem_step[3], den[3];
+	for (i = 0; i < 3; i++) {
+		if (!edges[i].a)
+			continue;
+		den[i] = edges[i].a > 0 ? edges[i].a : -edges[i].a;
+		const int64_t e_row = edges[i].b * y_min + edges[i].c;
+		quot[i] = itgl_div_floor(e_row, den[i]);
+		rem[i] = e_row - quot[i] * den[i];
+		quot_step[i] = itgl_div_floor(edges[i].b, den[i]);
+		rem_step[i] = edges[i].b - quot_step[i] * den[i];
+	}
+
+	for (y = y_min; y <= y_max; y++) {
+		int64_t x_l = x_min, x_r = x_max;
+		for (i = 0; i < 3; i++) {
+			if (edges[i].a > 0) {
+				x_l = MAX(x_l, -quot[i]);
+			} else if (edges[i].a < 0) {
+				x_r = MIN(x_r, quot[i]);
+			} else if (edges[i].b * y + edges[i].c < 0) {
+				x_r = x_l - 1;
+				continue;
+			} else {
+				continue;
+			}
+			quot[i] += quot_step[i];
+			rem[i] += rem_step[i];
+			if (rem[i] >= den[i]) {
+				rem[i] -= den[i];
+				quot[i]++;
+			}
+		}
+		if (x_l <= x_r)
+			itgl_fill_span(tgl, y, (int)x_l, (int)x_r, &plane_z, &plane_u, &plane_v, s, s_data);
+	}
 }
 
-void tgl_sub3s(const float vec1[3], const float subtrahend, float res[3])
+void itgl_fill_span(TGL *const tgl, const int y, const int x, const int x_end, const Plane *const plane_z, const Plane *const plane_u, const Plane *const plane_v, TGLSpanShader *const s, const void *const data)
 {
-	res[0] = vec1[0] - subtrahend;
-	res[1] = vec1[1] - subtrahend;
-	res[2] = vec1[2] - subtrahend;
+	switch ((enum ZFormat)tgl->z_format) {
+	case Z_FORMAT_NONE:
+		itgl_fill_run(tgl, y, x, x_end - x + 1, plane_u, plane_v, s, data);
+		break;
+	case Z_FORMAT_F32:
+		itgl_fill_span_depth(tgl, y, x, x_end, plane_z, plane_u, plane_v, s, data);
+		break;
+	case Z_FORMAT_U16:
+		itgl_fill_span_depth16(tgl, y, x, x_end, plane_z, plane_u, plane_v, s, data);
+		break;
+	}
 }
 
-void tgl_add3v(const float vec1[3], const float vec2[3], float res[3])
+#define FIXED_DEPTH_F32(tgl, z) itgl_fixed_depth(z)
+#define FIXED_DEPTH_U16(tgl, z) itgl_depth_unorm16(tgl, z)
+
+/* Depth tests a span against z_buffer of buf_t, converting fixed point depth to depth_t with fixed_depth, and shades each run of consecutive pixels which passed at once
+ * Parts of long spans are skipped in z-buffer tiles which they are behind all of
+ **/
+#define DEFINE_FILL_SPAN(name, buf_t, depth_t, fixed_depth)                                                                                                                                        \
+void name(TGL *const tgl, const int y, int x, const int x_end, const Plane *const plane_z, const Plane *const plane_u, const Plane *const plane_v, TGLSpanShader *const s, const void *const data) \
+{                                                                                                                                                                                                  \
+	buf_t *const z_row = (buf_t *)tgl->z_buffer + y * tgl->width;                                                                                                                              \
+	int64_t z = plane_z->c + plane_z->dx * x + plane_z->dy * y;                                                                                                                                \
+	int x_run = -1;                                                                                                                                                                            \
+	if (x_end - x < Z_TILE_SIZE) {                                                                                                                                                             \
+		/* Short spans were already tested with their whole triangle */                                                                                                                    \
+		for (; x <= x_end; x++) {                                                                                                                                                          \
+			const depth_t depth = fixed_depth(tgl, z);                                                                                                                                 \
+			const buf_t depth_prev = z_row[x];                                                                                                                                         \
+			if (depth >= depth_prev) {                                                                                                                                                 \
+				itgl_z_tile_write(tgl, Z_TILE(tgl, x, y), depth_prev, depth);                                                                                                      \
+				z_row[x] = (buf_t)depth;                                                                                                                                           \
+				if (x_run < 0)                                                                                                                                                     \
+					x_run = x;                                                                                                                                                 \
+			} else {                                                                                                                                                                   \
+				STATS_ADD(tgl, pixels_depth_rejected, 1);                                                                                                                          \
+				if (x_run >= 0) {                                                                                                                                                  \
+					itgl_fill_run(tgl, y, x_run, x - x_run, plane_u, plane_v, s, data);                                                                                        \
+					x_run = -1;                                                                                                                                                \
+				}                                                                                                                                                                  \
+			}                                                                                                                                                                          \
+			z += plane_z->dx;                                                                                                                                                          \
+		}                                                                                                                                                                                  \
+	} else {                                                                                                                                                                                   \
+		while (x <= x_end) {                                                                                                                                                               \
+			const int x_tile_end = MIN(x | (Z_TILE_SIZE - 1), x_end);                                                                                                                  \
+			const unsigned tile = Z_TILE(tgl, x, y);                                                                                                                                   \
+			const int64_t z_tile_end = z + plane_z->dx * (x_tile_end - x);                                                                                                             \
+			if (fixed_depth(tgl, MAX(z, z_tile_end)) < tgl->z_tiles[tile]) {                                                                                                           \
+				if (x_run >= 0) {                                                                                                                                                  \
+					itgl_fill_run(tgl, y, x_run, x - x_run, plane_u, plane_v, s, data);                                                                                        \
+					x_run = -1;                                                                                                                                                \
+				}                                                                                                                                                                  \
+				STATS_ADD(tgl, pixels_depth_rejected, x_tile_end - x + 1);                                                                                                         \
+				z = z_tile_end + plane_z->dx;                                                                                                                                      \
+				x = x_tile_end + 1;                                                                                                                                                \
+				continue;                                                                                                                                                          \
+			}                                                                                                                                                                          \
+			for (; x <= x_tile_end; x++) {                                                                                                                                             \
+				const depth_t depth = fixed_depth(tgl, z);                                                                                                                         \
+				const buf_t depth_prev = z_row[x];                                                                                                                                 \
+				if (depth >= depth_prev) {                                                                                                                                         \
+					itgl_z_tile_write(tgl, tile, depth_prev, depth);                                                                                                           \
+					z_row[x] = (buf_t)depth;                                                                                                                                   \
+					if (x_run < 0)                                                                                                                                             \
+						x_run = x;                                                                                                                                         \
+				} else {                                                                                                                                                           \
+					STATS_ADD(tgl, pixels_depth_rejected, 1);                                                                                                                  \
+					if (x_run >= 0) {                                                                                                                                          \
+						itgl_fill_run(tgl, y, x_run, x - x_run, plane_u, plane_v, s, data);                                                                                \
+						x_run = -1;                                                                                                                                        \
+					}                                                                                                                                                          \
+				}                                                                                                                                                                  \
+				z += plane_z->dx;                                                                                                                                                  \
+			}                                                                                                                                                                          \
+		}                                                                                                                                                                                  \
+	}                                                                                                                                                                                          \
+	if (x_run >= 0)                                                                                                                                                                            \
+		itgl_fill_run(tgl, y, x_run, x_end - x_run + 1, plane_u, plane_v, s, data);                                                                                                        \
+}
+
+DEFINE_FILL_SPAN(itgl_fill_span_depth, float, float, FIXED_DEPTH_F32)
+DEFINE_FILL_SPAN(itgl_fill_span_depth16, uint16_t, int32_t, FIXED_DEPTH_U16)
+
+void itgl_fill_run(TGL *const tgl, const int y, const int x, const unsigned length, const Plane *const plane_u, const Plane *const plane_v, TGLSpanShader *const s, const void *const data)
 {
-	res[0] = vec1[0] + vec2[0];
-	res[1] = vec1[1] + vec2[1];
-	res[2] = vec1[2] + vec2[2];
+	/* Values at pixels inside the triangle are in range, but steps are only bounded when there are two such pixels */
+	const TGLSpan span = {
+		.length = length,
+		.u = (int32_t)(plane_u->c + plane_u->dx * x + plane_u->dy * y),
+		.v = (int32_t)(plane_v->c + plane_v->dx * x + plane_v->dy * y),
+		.du = (length > 1) ? (int32_t)plane_u->dx : 0,
+		.dv = (length > 1) ? (int32_t)plane_v->dx : 0,
+	};
+	const unsigned idx = y * tgl->width + x;
+	TGLPixFmt *const colors = tgl->frame_buffer.colors + idx;
+	STATS_TIME_BEGIN(shade);
+	s(&span, colors, tgl->frame_buffer.chars + idx, data);
+	unsigned i;
+	for (i = 0; i < length; i++)
+		colors[i] = itgl_pixfmt_norm(colors[i]);
+	STATS_TIME_END(tgl, shade_ns, shade);
+	STATS_ADD(tgl, pixels_shaded, length);
 }
 
-void tgl_mul3v(const float vec1[3], const float vec2[3], float res[3])
+/* Minimum depth of z-buffer tiles overlapping rect */
+float itgl_z_tiles_min(TGL *const tgl, const Rect *const rect)
 {
-	res[0] = vec1[0] * vec2[0];
-	res[1] = vec1[1] * vec2[1];
-	res[2] = vec1[2] * vec2[2];
+	float min = FLT_MAX;
+	unsigned tile_x, tile_y;
+	for (tile_y = (unsigned)rect->y0 >> Z_TILE_SHIFT; tile_y <= (unsigned)rect->y1 >> Z_TILE_SHIFT; tile_y++) {
+		for (tile_x = (unsigned)rect->x0 >> Z_TILE_SHIFT; tile_x <= (unsigned)rect->x1 >> Z_TILE_SHIFT; tile_x++) {
+			const unsigned tile = tile_y * tgl->z_tiles_x + tile_x;
+			if (!tgl->z_tiles_count[tile])
+				itgl_z_tile_refresh(tgl, tile_x, tile_y);
+			min = MIN(min, tgl->z_tiles[tile]);
+		}
+	}
+	return min;
 }
 
-void tgl_inv3(const float vec[3], float res[3])
+/* Separate passes compile to branchless code */
+#define Z_TILE_SCAN(tgl, buf_t, x0, y0, x1, y1, min, count)                                           \
+	do {                                                                                          \
+		const buf_t *const __z_tile_buf = (tgl)->z_buffer;                                    \
+		unsigned __z_tile_x, __z_tile_y;                                                      \
+		for (__z_tile_y = (y0); __z_tile_y < (y1); __z_tile_y++)                              \
+			for (__z_tile_x = (x0); __z_tile_x < (x1); __z_tile_x++)                      \
+				min = MIN(min, __z_tile_buf[__z_tile_y * (tgl)->width + __z_tile_x]); \
+		for (__z_tile_y = (y0); __z_tile_y < (y1); __z_tile_y++)                              \
+			for (__z_tile_x = (x0); __z_tile_x < (x1); __z_tile_x++)                      \
+				count += __z_tile_buf[__z_tile_y * (tgl)->width + __z_tile_x] == min; \
+	} while (0)
+
+void itgl_z_tile_refresh(TGL *const tgl, const unsigned tile_x, const unsigned tile_y)
 {
-	res[0] = 1.f / vec[0];
-	res[1] = 1.f / vec[1];
-	res[2] = 1.f / vec[2];
+	const unsigned x0 = tile_x << Z_TILE_SHIFT;
+	const unsigned y0 = tile_y << Z_TILE_SHIFT;
+	const unsigned x1 = MIN(x0 + Z_TILE_SIZE, tgl->width);
+	const unsigned y1 = MIN(y0 + Z_TILE_SIZE, tgl->height);
+	float min = FLT_MAX;
+	unsigned count = 0;
+	if (tgl->z_format == Z_FORMAT_U16)
+		Z_TILE_SCAN(tgl, uint16_t, x0, y0, x1, y1, min, count);
+	else
+		Z_TILE_SCAN(tgl, float, x0, y0, x1, y1, min, count);
+	const unsigned tile = tile_y * tgl->z_tiles_x + tile_x;
+	tgl->z_tiles[tile] = min;
+	tgl->z_tiles_count[tile] = count;
 }
 
-void tgl_norm3(float vec[3])
+/* Once the minimum is stale, no pixel of the tile is at it */
+inline void itgl_z_tile_write(TGL *const tgl, const unsigned tile, const float depth_prev, const float depth)
 {
-	tgl_mul3s(vec, 1.f / tgl_mag3(vec), vec);
+	if (depth_prev == tgl->z_tiles[tile] && depth > depth_prev)
+		tgl->z_tiles_count[tile]--;
 }
 
-void tgl_mulmatvec(const TGLMat mat, const TGLVec3 vec, TGLVec4 res)
+inline float itgl_fixed_depth(const int64_t z)
 {
-	res[0] = tgl_dot43(mat[0], vec);
-	res[1] = tgl_dot43(mat[1], vec);
-	res[2] = tgl_dot43(mat[2], vec);
-	res[3] = tgl_dot43(mat[3], vec);
+	return (float)(z * (1. / FILL_Z_SCALE));
 }
 
-void tgl_mulmat(const TGLMat mat1, const TGLMat mat2, TGLMat res)
+/* Depths beyond +-2 are clamped, which keeps the z-buffer ordering of all depths which are stored in range */
+inline int64_t itgl_depth_fixed(const float z)
 {
-	unsigned c, d, k;
-	for (c = 0; c < 4u; c++)
-		for (d = 0; d < 4u; d++) {
-			res[c][d] = 0.f;
-			for (k = 0; k < 4u; k++)
-				res[c][d] += mat1[c][k] * mat2[k][d];
-		}
+	return (int64_t)((z >= 2.f ? 2.f : z >= -2.f ? z : -2.f) * FILL_Z_SCALE);
 }
 
-void tgl_vertex_shader_simple(const TGLVec3 vert, TGLVec4 out, const void *const data)
+/* 16-bit z-buffer value of fixed point depth, or -1 below its range, which fails the depth test also against a cleared z-buffer */
+inline int32_t itgl_depth_unorm16(const TGL *const tgl, const int64_t z)
 {
-	const TGLVertexShaderSimple *simple = data;
-	tgl_mulmatvec(simple->mat, vert, out);
+	const int64_t biased = z + tgl->z_unorm_bias;
+	return (biased < 0) ? -1 : (int32_t)MIN(biased >> tgl->z_unorm_shift, (int64_t)UINT16_MAX);
 }
 
-void tgl_camera(TGLMat camera, const int width, const int height, const float fov, const float near_val, const float far_val)
+/* Plane is linear, so its maximum over rect is at a corner. Conversion to depth is monotonic, so the result is exact */
+float itgl_plane_depth_max(const TGL *const tgl, const Plane *const plane, const Rect *const rect)
 {
-	TGLMat projection = TGL_CAMERA_MATRIX(width, height, fov, near_val, far_val);
-	memcpy(camera, projection, sizeof(TGLMat));
+	const int64_t z = plane->c
+		+ plane->dx * ((plane->dx > 0) ? rect->x1 : rect->x0)
+		+ plane->dy * ((plane->dy > 0) ? rect->y1 : rect->y0);
+	return (tgl->z_format == Z_FORMAT_U16) ? (float)itgl_depth_unorm16(tgl, z) : itgl_fixed_depth(z);
 }
 
-void tgl_rotate(TGLMat rotate, const float x, const float y, const float z)
+TGLSpanShader *itgl_span_shader(const TGL *const tgl, TGLPixelShader *const t)
 {
-	const TGLMat mat = TGL_ROTATION_MATRIX(x, y, z);
-	memcpy(rotate, mat, sizeof(TGLMat));
+	unsigned i;
+	for (i = 0; i < tgl->n_span_shaders; i++)
+		if (tgl->span_shaders[i].pixel_shader == t)
+			return tgl->span_shaders[i].span_shader;
+#ifndef TERMGL_MINIMAL
+	if (t == &tgl_pixel_shader_simple)
+		return &tgl_span_shader_simple;
+	if (t == &tgl_pixel_shader_texture)
+		return &tgl_span_shader_texture;
+#endif
+	return &itgl_span_shader_pixel;
 }
 
-void tgl_scale(TGLMat scale, const float x, const float y, const float z)
+void itgl_span_shader_pixel(const TGLSpan *const span, TGLPixFmt *const colors, char *const chars, const void *const data)
 {
-	const TGLMat mat = TGL_SCALE_MATRIX(x, y, z);
-	memcpy(scale, mat, sizeof(TGLMat));
+	const PixelShaderAdapter *const adapter = data;
+	int32_t u = span->u, v = span->v;
+	unsigned i;
+	for (i = 0; i < span->length; i++) {
+		adapter->shader(TGL_SPAN_UV(u), TGL_SPAN_UV(v), colors + i, chars + i, adapter->data);
+		u += span->du;
+		v += span->dv;
+	}
 }
 
-void tgl_translate(TGLMat translate, const float x, const float y, const float z)
+int tgl_set_span_shader(TGL *const tgl, TGLPixelShader *const pixel_shader, TGLSpanShader *const span_shader)
 {
-	const TGLMat mat = TGL_TRANSLATE_MATRIX(x, y, z);
-	memcpy(translate, mat, sizeof(TGLMat));
+	unsigned i;
+	for (i = 0; i < tgl->n_span_shaders && tgl->span_shaders[i].pixel_shader != pixel_shader; i++)
+		;
+	if (!span_shader) {
+		if (i < tgl->n_span_shaders)
+			tgl->span_shaders[i] = tgl->span_shaders[--tgl->n_span_shaders];
+		return 0;
+	}
+	if (i == SPAN_SHADERS_MAX) {
+		errno = ENOSPC;
+		return -1;
+	}
+	if (i == tgl->n_span_shaders)
+		tgl->n_span_shaders++;
+	tgl->span_shaders[i] = (SpanShaderBinding){
+		.pixel_shader = pixel_shader,
+		.span_shader = span_shader,
+	};
+	return 0;
 }
-#endif /* ~TERMGL_MINIMAL */
 
-void tgl_mul3s(const float vec[3], const float mul, float res[3])
+inline Edge itgl_edge(const TGLVert v0, const TGLVert v1)
 {
-	res[0] = vec[0] * mul;
-	res[1] = vec[1] * mul;
-	res[2] = vec[2] * mul;
+	const int64_t a = v0.y - v1.y;
+	const int64_t b = v1.x - v0.x;
+	return (Edge){
+		.a = a,
+		.b = b,
+		.c = -(a * v0.x + b * v0.y),
+	};
 }
 
-void tgl_sub3v(const float vec1[3], const float vec2[3], float res[3])
+/* Planes through values at the vertices of a triangle, scaled to fixed point */
+Plane itgl_plane_z(const Edge edges[3], const double inv_area, const float z0, const float z1, const float z2)
 {
-	res[0] = vec1[0] - vec2[0];
-	res[1] = vec1[1] - vec2[1];
-	res[2] = vec1[2] - vec2[2];
+	const double norm = FILL_Z_SCALE * inv_area;
+	return (Plane){
+		.c = (int64_t)(((double)edges[0].c * z0 + (double)edges[1].c * z1 + (double)edges[2].c * z2) * norm),
+		.dx = (int64_t)(((double)edges[0].a * z0 + (double)edges[1].a * z1 + (double)edges[2].a * z2) * norm),
+		.dy = (int64_t)(((double)edges[0].b * z0 + (double)edges[1].b * z1 + (double)edges[2].b * z2) * norm),
+	};
 }
 
-void tgl_cross(const float vec1[3], const float vec2[3], float res[3])
+/* Sums are exact in integers, so only their normalization is rounded. Offset by half for rounding to nearest when truncated */
+Plane itgl_plane_uv(const Edge edges[3], const double inv_area, const uint8_t a0, const uint8_t a1, const uint8_t a2)
 {
-	res[0] = vec1[1] * vec2[2] - vec1[2] * vec2[1];
-	res[1] = vec1[2] * vec2[0] - vec1[0] * vec2[2];
-	res[2] = vec1[0] * vec2[1] - vec1[1] * vec2[0];
+	const double norm = FILL_UV_SCALE * inv_area;
+	return (Plane){
+		.c = (int64_t)((double)(edges[0].c * a0 + edges[1].c * a1 + edges[2].c * a2) * norm) + (1 << (FILL_UV_SHIFT - 1)),
+		.dx = (int64_t)((double)(edges[0].a * a0 + edges[1].a * a1 + edges[2].a * a2) * norm),
+		.dy = (int64_t)((double)(edges[0].b * a0 + edges[1].b * a1 + edges[2].b * a2) * norm),
+	};
 }
 
-void itgl_clip_line(const float dot_i, const TGLVec4 vec_i, const uint8_t uv_i[2], const float dot_o, const TGLVec4 vec_o, const uint8_t uv_o[2], TGLVec4 vec_out, uint8_t uv_out[2])
+/* Division rounding towards negative infinity, for positive divisor */
+inline int64_t itgl_div_floor(const int64_t num, const int64_t den)
 {
-	const float d = dot_i / (dot_i - dot_o);
-	vec_out[0] = MIX(vec_o[0], vec_i[0], d);
-	vec_out[1] = MIX(vec_o[1], vec_i[1], d);
-	vec_out[2] = MIX(vec_o[2], vec_i[2], d);
-	vec_out[3] = MIX(vec_o[3], vec_i[3], d);
-	uv_out[0] = MIX(uv_o[0], uv_i[0], d);
-	uv_out[1] = MIX(uv_o[1], uv_i[1], d);
+	const int64_t quot = num / den;
+	return (num % den && num < 0) ? quot - 1 : quot;
 }
 
-float itgl_clip_plane_dot(const TGLVec4 v, const enum ClipPlane plane)
+int tgl_enable(TGL *const tgl, const uint32_t settings)
 {
-	switch (plane) {
-	case CLIP_LEFT:
-		return v[0] + v[3];
-	case CLIP_RIGHT:
-		return -v[0] + v[3];
-	case CLIP_BOTTOM:
-		return v[1] + v[3];
-	case CLIP_TOP:
-		return -v[1] + v[3];
-	case CLIP_NEAR:
-		return v[2] + v[3];
-	case CLIP_FAR:
-		return -v[2] + v[3];
-	default:
-		TGL_UNREACHABLE();
-		return 0;
+#ifdef TERMGL_THREADS
+	const bool async = (settings & TGL_ASYNC_FLUSH) && !tgl->presenter;
+	itgl_presenter_lock(tgl);
+	const int ret = itgl_enable(tgl, settings);
+	itgl_presenter_unlock(tgl);
+	if (!ret && async && itgl_presenter_create(tgl)) {
+		tgl->settings &= ~TGL_ASYNC_FLUSH;
+		return -1;
 	}
+	return ret;
+#else
+	return itgl_enable(tgl, settings);
+#endif
 }
 
-unsigned itgl_clip_triangle_plane(const enum ClipPlane plane, const TGLUVTriangle *const in, TGLUVTriangle *const out)
+void tgl_disable(TGL *const tgl, const uint32_t settings)
 {
-	unsigned n_inside = 0, n_outside = 0;
-	unsigned inside[3], outside[3];
-	float dps[3];
-	unsigned i;
-	for (i = 0; i < 3; i++) {
-		dps[i] = itgl_clip_plane_dot(in->verts[i], plane);
-		if (dps[i] >= 0.f)
-			inside[n_inside++] = i;
-		else
-			outside[n_outside++] = i;
-	}
+#ifdef TERMGL_THREADS
+	/* The last frame is printed with the settings it was flushed with */
+	if (settings & TGL_ASYNC_FLUSH)
+		itgl_presenter_delete(tgl);
+	itgl_presenter_lock(tgl);
+	itgl_disable(tgl, settings);
+	itgl_presenter_unlock(tgl);
+#else
+	itgl_disable(tgl, settings);
+#endif
+}
 
-	switch (n_inside) {
-	case 0:
-		return 0;
-	case 1:
-		memcpy(out[0].verts[0], in->verts[inside[0]], sizeof(TGLUVTriangle));
-		memcpy(out[0].uv[0], in->uv[inside[0]], sizeof(uint8_t[2]));
-		itgl_clip_line(dps[inside[0]], in->verts[inside[0]], in->uv[inside[0]], dps[outside[0]], in->verts[outside[0]], in->uv[outside[0]], out[0].verts[1], out[0].uv[1]);
-		itgl_clip_line(dps[inside[0]], in->verts[inside[0]], in->uv[inside[0]], dps[outside[1]], in->verts[outside[1]], in->uv[outside[1]], out[0].verts[2], out[0].uv[2]);
-		return 1;
-	case 2:
-		memcpy(out[0].verts[0], in->verts[inside[0]], sizeof(TGLVec4));
-		memcpy(out[0].uv[0], in->uv[inside[0]], sizeof(uint8_t[2]));
-		memcpy(out[0].verts[1], in->verts[inside[1]], sizeof(TGLVec4));
-		memcpy(out[0].uv[1], in->uv[inside[1]], sizeof(uint8_t[2]));
-		itgl_clip_line(dps[inside[0]], in->verts[inside[0]], in->uv[inside[0]], dps[outside[0]], in->verts[outside[0]], in->uv[outside[0]], out[0].verts[2], out[0].uv[2]);
-
-		memcpy(out[1].verts[0], in->verts[inside[1]], sizeof(TGLVec4));
-		memcpy(out[1].uv[0], in->uv[inside[1]], sizeof(uint8_t[2]));
-		memcpy(out[1].verts[1], out[0].verts[2], sizeof(TGLVec4));
-		memcpy(out[1].uv[1], out[0].uv[2], sizeof(uint8_t[2]));
-		itgl_clip_line(dps[inside[1]], in->verts[inside[1]], in->uv[inside[1]], dps[outside[0]], in->verts[outside[0]], in->uv[outside[0]], out[1].verts[2], out[1].uv[2]);
-
-		return 2;
-	case 3:
-		memcpy(&out[0], in, sizeof(TGLUVTriangle));
-		return 1;
+int itgl_enable(TGL *const tgl, const uint32_t settings)
+{
+	const uint32_t enable = settings & ~tgl->settings;
+	tgl->settings |= settings;
+	if (enable & (TGL_DOUBLE_WIDTH | TGL_DOUBLE_CHARS))
+		tgl->prev_frame_valid = false;
+	if ((enable & TGL_Z_BUFFER) || (tgl->z_buffer && (enable & (TGL_Z_BUFFER_16 | TGL_REVERSED_Z))))
+		CALL(itgl_z_buffer_alloc(tgl), -1);
+	if (settings & TGL_DIFF_FLUSH) {
+		tgl->prev_frame_valid = false;
+		if (!tgl->prev_frame_buffer.colors) {
+			void *const frame_mem = itgl_slot_alloc(tgl, ARENA_PREV_FRAME);
+			if (!frame_mem) {
+				tgl->settings &= ~TGL_DIFF_FLUSH;
+				return -1;
+			}
+			itgl_frame_init(&tgl->prev_frame_buffer, frame_mem, tgl->frame_size);
+		}
+		/* Rows written before tracking started are unknown, so all of the frame is dirty and drawn */
+		if (!tgl->dirty_rows) {
+			tgl->dirty_rows = itgl_slot_alloc(tgl, ARENA_DIRTY_ROWS);
+			if (!tgl->dirty_rows) {
+				/* Frees prev_frame_buffer, so that diff tracking is either fully set up or off */
+				itgl_disable(tgl, TGL_DIFF_FLUSH);
+				return -1;
+			}
+			tgl->drawn_rows = tgl->dirty_rows + tgl->height;
+			itgl_rows_fill(tgl->dirty_rows, 2u * tgl->height, 0, tgl->max_x);
+		}
+	}
+	if (enable & (TGL_QUANTIZE_256 | TGL_QUANTIZE_16 | TGL_DITHER)) {
+		tgl->prev_frame_valid = false;
+		CALL(itgl_quantize_init(tgl), -1);
+	}
+	if (enable & TGL_OUTPUT_BUFFER) {
+		tgl->output_buffer = itgl_slot_alloc(tgl, ARENA_OUTPUT_BUFFER);
+		if (!tgl->output_buffer)
+			return -1;
+		tgl->output_buffer_size = tgl->capacity[ARENA_OUTPUT_BUFFER];
+	}
+	if (enable & (TGL_HALF_BLOCK | TGL_BRAILLE)) {
+		tgl->prev_frame_valid = false;
+		if (!tgl->cells) {
+			tgl->cells = itgl_slot_alloc(tgl, ARENA_CELLS);
+			if (!tgl->cells) {
+				tgl->settings &= ~(TGL_HALF_BLOCK | TGL_BRAILLE);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Allocates z_buffer in the format of the settings, or replaces it if it is too small for that format, and clears it
+ * On failure, the previous z_buffer is kept
+ **/
+int itgl_z_buffer_alloc(TGL *const tgl)
+{
+	if (!tgl->z_buffer || itgl_slot_size(tgl, ARENA_Z_BUFFER) > tgl->capacity[ARENA_Z_BUFFER]) {
+		const size_t capacity = tgl->capacity[ARENA_Z_BUFFER];
+		void *const buf = itgl_slot_alloc(tgl, ARENA_Z_BUFFER);
+		if (!buf) {
+			tgl->capacity[ARENA_Z_BUFFER] = capacity;
+			return -1;
+		}
+		itgl_free(tgl, tgl->z_buffer);
+		tgl->z_buffer = buf;
+	}
+	tgl->z_format = (tgl->settings & TGL_Z_BUFFER_16) ? Z_FORMAT_U16 : Z_FORMAT_F32;
+	itgl_z_buffer_init(tgl);
+	tgl_clear(tgl, TGL_Z_BUFFER);
+	return 0;
+}
+
+/* Tiles are allocated in the same block, after z_buffer */
+void itgl_z_buffer_init(TGL *const tgl)
+{
+	tgl->z_tiles_x = (tgl->width + Z_TILE_SIZE - 1) >> Z_TILE_SHIFT;
+	const unsigned n_tiles = tgl->z_tiles_x * ((tgl->height + Z_TILE_SIZE - 1) >> Z_TILE_SHIFT);
+	tgl->z_tiles = (float *)((char *)tgl->z_buffer + Z_TILES_OFFSET(tgl));
+	tgl->z_tiles_count = (uint8_t *)(tgl->z_tiles + n_tiles);
+	/* Depths from -1, or 0 with TGL_REVERSED_Z, to 1 are mapped onto the range of TGL_Z_BUFFER_16, with 1 rounded down into it */
+	const bool reversed = tgl->settings & TGL_REVERSED_Z;
+	tgl->z_unorm_bias = reversed ? 0 : (int64_t)FILL_Z_SCALE;
+	tgl->z_unorm_shift = reversed ? 16u : 17u;
+}
+
+void itgl_disable(TGL *const tgl, const uint32_t settings)
+{
+	const uint32_t disable = settings & tgl->settings;
+	if (disable & (TGL_DOUBLE_WIDTH | TGL_DOUBLE_CHARS | TGL_HALF_BLOCK | TGL_BRAILLE))
+		tgl->prev_frame_valid = false;
+	tgl->settings &= ~settings;
+	if (!(tgl->settings & (TGL_HALF_BLOCK | TGL_BRAILLE))) {
+		itgl_free(tgl, tgl->cells);
+		tgl->cells = NULL;
+	}
+	/* A float z_buffer may not fit in memory of the 16-bit one, in which case it is disabled */
+	if ((settings & TGL_Z_BUFFER) || (tgl->z_buffer && (disable & (TGL_Z_BUFFER_16 | TGL_REVERSED_Z)) && itgl_z_buffer_alloc(tgl))) {
+		tgl->settings &= ~TGL_Z_BUFFER;
+		tgl->z_format = Z_FORMAT_NONE;
+		itgl_free(tgl, tgl->z_buffer);
+		tgl->z_buffer = NULL;
+	}
+	if (settings & TGL_OUTPUT_BUFFER) {
+		tgl->output_buffer_size = 0;
+		itgl_free(tgl, tgl->output_buffer);
+		tgl->output_buffer = NULL;
+	}
+	if (settings & TGL_DIFF_FLUSH) {
+		tgl->prev_frame_valid = false;
+		itgl_free(tgl, tgl->prev_frame_buffer.colors);
+		tgl->prev_frame_buffer = (Frame){ 0 };
+		itgl_free(tgl, tgl->dirty_rows);
+		tgl->dirty_rows = NULL;
+		tgl->drawn_rows = NULL;
+	}
+	if (settings & (TGL_QUANTIZE_256 | TGL_QUANTIZE_16 | TGL_DITHER)) {
+		tgl->prev_frame_valid = false;
+		/* Only fails if quantize_colors could not be allocated when enabling, which leaves colors unquantized */
+		(void)itgl_quantize_init(tgl);
+	}
+}
+
+void tgl_delete(TGL *const tgl)
+{
+#ifdef TERMGL_THREADS
+	itgl_presenter_delete(tgl);
+#endif
+	itgl_free(tgl, tgl->frame_buffer.colors);
+	itgl_free(tgl, tgl->prev_frame_buffer.colors);
+#ifdef TERMGL_THREADS
+	itgl_pool_delete(tgl, tgl->pool);
+#ifdef TERMGL3D
+	itgl_batch_free(tgl, tgl->batch);
+#endif
+#endif
+	itgl_free(tgl, tgl->z_buffer);
+	itgl_free(tgl, tgl->output_buffer);
+	itgl_free(tgl, tgl->quantize_colors);
+	itgl_free(tgl, tgl->dirty_rows);
+	itgl_free(tgl, tgl->cells);
+	itgl_free(tgl, (void *)tgl->glyphs);
+#ifdef TERMGL3D
+	itgl_free(tgl, tgl->mesh_verts);
+#endif
+#ifdef TERMGL_PROFILE
+	itgl_free(tgl, tgl->stats);
+#endif
+	const TGLAllocator allocator = tgl->allocator;
+	allocator.free(tgl->arena ? (void *)tgl->arena : (void *)tgl, allocator.ctx);
+}
+
+#ifdef TERMGL_THREADS
+
+THREAD_FUNC(itgl_pool_worker, arg)
+{
+	PoolThread *const self = arg;
+	Pool *const pool = self->pool;
+	unsigned generation = 0;
+#ifdef TERMGL_PROFILE
+	itgl_stats_slot = self->index;
+#endif
+	MUTEX_LOCK(&pool->mutex);
+	while (true) {
+		while (!pool->quit && pool->generation == generation)
+			COND_WAIT(&pool->cond_start, &pool->mutex);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+		MUTEX_UNLOCK(&pool->mutex);
+		pool->job(pool->ctx, self->index);
+		MUTEX_LOCK(&pool->mutex);
+		if (!--pool->n_busy)
+			COND_BROADCAST(&pool->cond_done);
+	}
+	MUTEX_UNLOCK(&pool->mutex);
+	THREAD_FUNC_RETURN;
+}
+
+Pool *itgl_pool_create(const TGL *const tgl, const unsigned n_threads)
+{
+	Pool *const pool = itgl_alloc(tgl, sizeof(Pool) + sizeof(PoolThread) * (n_threads - 1));
+	if (!pool)
+		return NULL;
+	pool->job = NULL;
+	pool->ctx = NULL;
+	pool->generation = 0;
+	pool->n_busy = 0;
+	pool->counter = 0;
+	pool->quit = false;
+	pool->n_threads = 1;
+	if (MUTEX_INIT(&pool->mutex)) {
+		itgl_free(tgl, pool);
+		return NULL;
+	}
+	if (COND_INIT(&pool->cond_start)) {
+		MUTEX_DESTROY(&pool->mutex);
+		itgl_free(tgl, pool);
+		return NULL;
+	}
+	if (COND_INIT(&pool->cond_done)) {
+		COND_DESTROY(&pool->cond_start);
+		MUTEX_DESTROY(&pool->mutex);
+		itgl_free(tgl, pool);
+		return NULL;
+	}
+
+	/* n_threads counts threads which were started, so a failure can be cleaned up by itgl_pool_delete */
+	for (; pool->n_threads < n_threads; pool->n_threads++) {
+		PoolThread *const thread = &pool->threads[pool->n_threads - 1];
+		thread->pool = pool;
+		thread->index = pool->n_threads;
+#ifdef TGL_OS_WINDOWS
+		thread->handle = CreateThread(NULL, 0, &itgl_pool_worker, thread, 0, NULL);
+		if (!thread->handle) {
+			const int err = GetLastError();
+			itgl_pool_delete(tgl, pool);
+			errno = err;
+			return NULL;
+		}
+#else
+		const int err = pthread_create(&thread->handle, NULL, &itgl_pool_worker, thread);
+		if (err) {
+			itgl_pool_delete(tgl, pool);
+			errno = err;
+			return NULL;
+		}
+#endif
+	}
+	return pool;
+}
+
+void itgl_pool_delete(const TGL *const tgl, Pool *const pool)
+{
+	if (!pool)
+		return;
+	MUTEX_LOCK(&pool->mutex);
+	pool->quit = true;
+	COND_BROADCAST(&pool->cond_start);
+	MUTEX_UNLOCK(&pool->mutex);
+	unsigned i;
+	for (i = 0; i < pool->n_threads - 1; i++) {
+#ifdef TGL_OS_WINDOWS
+		WaitForSingleObject(pool->threads[i].handle, INFINITE);
+		CloseHandle(pool->threads[i].handle);
+#else
+		pthread_join(pool->threads[i].handle, NULL);
+#endif
+	}
+	COND_DESTROY(&pool->cond_done);
+	COND_DESTROY(&pool->cond_start);
+	MUTEX_DESTROY(&pool->mutex);
+	itgl_free(tgl, pool);
+}
+
+/* Runs job on all threads and waits for them to finish. The calling thread has index 0 */
+void itgl_pool_run(Pool *const pool, PoolJob *const job, void *const ctx)
+{
+	MUTEX_LOCK(&pool->mutex);
+	pool->job = job;
+	pool->ctx = ctx;
+	pool->counter = 0;
+	pool->n_busy = pool->n_threads - 1;
+	pool->generation++;
+	COND_BROADCAST(&pool->cond_start);
+	MUTEX_UNLOCK(&pool->mutex);
+
+	job(ctx, 0);
+
+	MUTEX_LOCK(&pool->mutex);
+	while (pool->n_busy)
+		COND_WAIT(&pool->cond_done, &pool->mutex);
+	MUTEX_UNLOCK(&pool->mutex);
+}
+
+/* Returns consecutive integers starting from 0 for each run, used to hand out work items */
+unsigned itgl_pool_next(Pool *const pool)
+{
+	MUTEX_LOCK(&pool->mutex);
+	const unsigned next = pool->counter++;
+	MUTEX_UNLOCK(&pool->mutex);
+	return next;
+}
+
+unsigned itgl_pool_threads(const Pool *const pool)
+{
+	return pool->n_threads;
+}
+
+int tgl_set_threads(TGL *const tgl, const unsigned threads)
+{
+	itgl_pool_delete(tgl, tgl->pool);
+	tgl->pool = NULL;
+#ifdef TERMGL_PROFILE
+	CALL(itgl_stats_resize(tgl, MAX(threads, 1u)), -1);
+#endif
+	if (threads > 1) {
+		tgl->pool = itgl_pool_create(tgl, threads);
+		if (!tgl->pool)
+			return -1;
+	}
+	return 0;
+}
+
+int itgl_presenter_create(TGL *const tgl)
+{
+	Presenter *const presenter = itgl_slot_alloc(tgl, ARENA_PRESENTER);
+	if (!presenter)
+		return -1;
+	presenter->pending_valid = false;
+	presenter->busy = false;
+	presenter->quit = false;
+	presenter->error = 0;
+#ifdef TERMGL_PROFILE
+	presenter->stats = (TGLStats){ 0 };
+#endif
+	/* Frames and dirty rows are allocated in the same block, after the struct */
+	char *const mem = (char *)presenter + ALIGN_UP(sizeof(Presenter), ARENA_ALIGN);
+	const size_t frame_bytes = ALIGN_UP(FRAME_BYTES(tgl->frame_size), ARENA_ALIGN);
+	itgl_frame_init(&presenter->pending, mem, tgl->frame_size);
+	itgl_frame_init(&presenter->frame, mem + frame_bytes, tgl->frame_size);
+	/* Frames printed before the presenter existed are unknown, so all rows start dirty */
+	presenter->pending_dirty_rows = (RowRange *)(mem + 2u * frame_bytes);
+	presenter->dirty_rows = presenter->pending_dirty_rows + tgl->height;
+	itgl_rows_fill(presenter->pending_dirty_rows, 2u * tgl->height, 0, (int)tgl->width - 1);
+	if (MUTEX_INIT(&presenter->mutex)) {
+		itgl_free(tgl, presenter);
+		return -1;
+	}
+	if (COND_INIT(&presenter->cond)) {
+		MUTEX_DESTROY(&presenter->mutex);
+		itgl_free(tgl, presenter);
+		return -1;
+	}
+
+	/* The worker reads tgl->presenter, so it is set before the thread starts */
+	tgl->presenter = presenter;
+#ifdef TGL_OS_WINDOWS
+	presenter->handle = CreateThread(NULL, 0, &itgl_presenter_worker, tgl, 0, NULL);
+	const int err = presenter->handle ? 0 : GetLastError();
+#else
+	const int err = pthread_create(&presenter->handle, NULL, &itgl_presenter_worker, tgl);
+#endif
+	if (err) {
+		tgl->presenter = NULL;
+		COND_DESTROY(&presenter->cond);
+		MUTEX_DESTROY(&presenter->mutex);
+		itgl_free(tgl, presenter);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/* Waits for the pending frame to be printed */
+void itgl_presenter_delete(TGL *const tgl)
+{
+	Presenter *const presenter = tgl->presenter;
+	if (!presenter)
+		return;
+	MUTEX_LOCK(&presenter->mutex);
+	presenter->quit = true;
+	COND_BROADCAST(&presenter->cond);
+	MUTEX_UNLOCK(&presenter->mutex);
+#ifdef TGL_OS_WINDOWS
+	WaitForSingleObject(presenter->handle, INFINITE);
+	CloseHandle(presenter->handle);
+#else
+	pthread_join(presenter->handle, NULL);
+#endif
+	tgl->presenter = NULL;
+#ifdef TERMGL_PROFILE
+	itgl_stats_add(tgl->stats, &presenter->stats);
+#endif
+	COND_DESTROY(&presenter->cond);
+	MUTEX_DESTROY(&presenter->mutex);
+	itgl_free(tgl, presenter);
+}
+
+/* Prints the latest pending frame, at most once per frame_interval
+ * Frames are printed by a TGL with a copy of the state used for printing, so the calling thread can keep drawing. Output state changed by printing is copied back
+ **/
+THREAD_FUNC(itgl_presenter_worker, arg)
+{
+	TGL *const tgl = arg;
+	Presenter *const presenter = tgl->presenter;
+	uint64_t next = 0;
+	MUTEX_LOCK(&presenter->mutex);
+	while (true) {
+		while (!presenter->quit && !presenter->pending_valid)
+			COND_WAIT(&presenter->cond, &presenter->mutex);
+		if (!presenter->pending_valid)
+			break;
+		/* Frames submitted while waiting replace the pending frame */
+		const uint64_t now = itgl_time_ns();
+		if (!presenter->quit && now < next) {
+			MUTEX_UNLOCK(&presenter->mutex);
+			itgl_sleep_ns(next - now);
+			MUTEX_LOCK(&presenter->mutex);
+			continue;
+		}
+		next = now + tgl->frame_interval;
+
+#ifdef TERMGL_PROFILE
+		TGLStats stats = { 0 };
+#endif
+		SWAP(Frame, presenter->pending, presenter->frame);
+		/* Rows of a frame which failed to print stay dirty for the next one */
+		itgl_rows_merge(presenter->dirty_rows, presenter->pending_dirty_rows, tgl->height);
+		itgl_rows_fill(presenter->pending_dirty_rows, tgl->height, INT_MAX, -1);
+		presenter->pending_valid = false;
+		presenter->busy = true;
+		TGL present = {
+			.width = tgl->width,
+			.height = tgl->height,
+			.frame_size = tgl->frame_size,
+			.frame_buffer = presenter->frame,
+			.prev_frame_buffer = tgl->prev_frame_buffer,
+			.dirty_rows = tgl->dirty_rows ? presenter->dirty_rows : NULL,
+			.output_buffer = tgl->output_buffer,
+			.output_buffer_size = tgl->output_buffer_size,
+			.prev_frame_valid = tgl->prev_frame_valid,
+			.clear_screen = tgl->clear_screen,
+			.output_fd = tgl->output_fd,
+			.output_callback = tgl->output_callback,
+			.output_ctx = tgl->output_ctx,
+			.settings = tgl->settings,
+			.quantize_colors = tgl->quantize_colors,
+			.quantize_lut = tgl->quantize_lut,
+			.quantize_channels = tgl->quantize_channels,
+			.quantize_flags = tgl->quantize_flags,
+			.glyphs = tgl->glyphs,
+			.cells = tgl->cells,
+			.allocator = tgl->allocator,
+			.arena = tgl->arena,
+			.arena_size = tgl->arena_size,
+#ifdef TERMGL_PROFILE
+			.stats = &stats,
+			.n_stats = 1,
+#endif
+		};
+		MUTEX_UNLOCK(&presenter->mutex);
+
+		STATS_TIME_BEGIN(flush);
+		const int err = itgl_present(&present) ? errno : 0;
+		STATS_TIME_END(&present, flush_ns, flush);
+
+		MUTEX_LOCK(&presenter->mutex);
+#ifdef TERMGL_PROFILE
+		itgl_stats_add(&presenter->stats, &stats);
+#endif
+		tgl->output_buffer = present.output_buffer;
+		tgl->output_buffer_size = present.output_buffer_size;
+		tgl->prev_frame_valid = present.prev_frame_valid;
+		tgl->clear_screen = present.clear_screen;
+		if (err)
+			presenter->error = err;
+		presenter->busy = false;
+		COND_BROADCAST(&presenter->cond);
+	}
+	MUTEX_UNLOCK(&presenter->mutex);
+	THREAD_FUNC_RETURN;
+}
+
+/* Copies frame_buffer to be printed by the presenter, and reports an error of a previous print */
+int itgl_presenter_submit(TGL *const tgl)
+{
+	Presenter *const presenter = tgl->presenter;
+	MUTEX_LOCK(&presenter->mutex);
+	itgl_frame_copy(&presenter->pending, &tgl->frame_buffer, tgl->frame_size);
+	/* Pending frames replaced before printing are never seen by prev_frame_buffer, so their rows accumulate */
+	if (tgl->dirty_rows) {
+		itgl_rows_merge(presenter->pending_dirty_rows, tgl->dirty_rows, tgl->height);
+		itgl_rows_fill(tgl->dirty_rows, tgl->height, INT_MAX, -1);
+	}
+	presenter->pending_valid = true;
+	const int err = presenter->error;
+	presenter->error = 0;
+	COND_BROADCAST(&presenter->cond);
+	MUTEX_UNLOCK(&presenter->mutex);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/* Waits for the presenter to finish printing, and keeps it from printing until itgl_presenter_unlock */
+void itgl_presenter_lock(TGL *const tgl)
+{
+	Presenter *const presenter = tgl->presenter;
+	if (!presenter)
+		return;
+	MUTEX_LOCK(&presenter->mutex);
+	while (presenter->busy)
+		COND_WAIT(&presenter->cond, &presenter->mutex);
+}
+
+void itgl_presenter_unlock(TGL *const tgl)
+{
+	if (tgl->presenter)
+		MUTEX_UNLOCK(&tgl->presenter->mutex);
+}
+
+void tgl_set_fps(TGL *const tgl, const unsigned fps)
+{
+	itgl_presenter_lock(tgl);
+	tgl->frame_interval = fps ? 1000000000u / fps : 0;
+	itgl_presenter_unlock(tgl);
+}
+
+void itgl_sleep_ns(const uint64_t ns)
+{
+#ifdef TGL_OS_WINDOWS
+	Sleep((DWORD)((ns + 999999u) / 1000000u));
+#else
+	const struct timespec ts = {
+		.tv_sec = ns / 1000000000u,
+		.tv_nsec = ns % 1000000000u,
+	};
+	nanosleep(&ts, NULL);
+#endif
+}
+
+#endif /* TERMGL_THREADS */
+
+#if defined(TERMGL_THREADS) || defined(TERMGL_PROFILE) || defined(TERMGL_RECORD)
+uint64_t itgl_time_ns(void)
+{
+#ifdef TGL_OS_WINDOWS
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000u + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000u / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+#endif
+
+#ifdef TERMGL_PROFILE
+/* Replaces slots of stats by n_stats slots, the first of which holds their sum */
+int itgl_stats_resize(TGL *const tgl, const unsigned n_stats)
+{
+	TGLStats *const stats = itgl_alloc(tgl, sizeof(TGLStats) * n_stats);
+	if (!stats)
+		return -1;
+	memset(stats, 0, sizeof(TGLStats) * n_stats);
+	unsigned i;
+	for (i = 0; i < tgl->n_stats; i++)
+		itgl_stats_add(stats, &tgl->stats[i]);
+	itgl_free(tgl, tgl->stats);
+	tgl->stats = stats;
+	tgl->n_stats = n_stats;
+	return 0;
+}
+
+void itgl_stats_add(TGLStats *const dest, const TGLStats *const src)
+{
+	dest->vertex_ns += src->vertex_ns;
+	dest->clip_ns += src->clip_ns;
+	dest->raster_ns += src->raster_ns;
+	dest->shade_ns += src->shade_ns;
+	dest->flush_ns += src->flush_ns;
+	dest->write_ns += src->write_ns;
+	dest->triangles_submitted += src->triangles_submitted;
+	dest->triangles_culled += src->triangles_culled;
+	dest->triangles_clipped += src->triangles_clipped;
+	dest->triangles_occluded += src->triangles_occluded;
+	dest->pixels_shaded += src->pixels_shaded;
+	dest->pixels_depth_rejected += src->pixels_depth_rejected;
+	dest->sgr_codes += src->sgr_codes;
+	dest->bytes_flushed += src->bytes_flushed;
+}
+
+void tgl_get_stats(const TGL *const tgl, TGLStats *const stats)
+{
+	*stats = (TGLStats){ 0 };
+	unsigned i;
+	for (i = 0; i < tgl->n_stats; i++)
+		itgl_stats_add(stats, &tgl->stats[i]);
+#ifdef TERMGL_THREADS
+	if (tgl->presenter) {
+		MUTEX_LOCK(&tgl->presenter->mutex);
+		itgl_stats_add(stats, &tgl->presenter->stats);
+		MUTEX_UNLOCK(&tgl->presenter->mutex);
+	}
+#endif
+}
+
+void tgl_reset_stats(TGL *const tgl)
+{
+	memset(tgl->stats, 0, sizeof(TGLStats) * tgl->n_stats);
+#ifdef TERMGL_THREADS
+	if (tgl->presenter) {
+		MUTEX_LOCK(&tgl->presenter->mutex);
+		tgl->presenter->stats = (TGLStats){ 0 };
+		MUTEX_UNLOCK(&tgl->presenter->mutex);
+	}
+#endif
+}
+#endif /* TERMGL_PROFILE */
+
+#ifdef TERMGL3D
+
+#include <math.h>
+
+#ifndef TERMGL_MINIMAL
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TGL_SIMD_AVX
+#define TGL_SIMD_SSE
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define TGL_SIMD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TGL_SIMD_NEON
+#endif
+#endif /* ~TERMGL_MINIMAL */
+
+#define TGL_CULL_FACE_BIT 0x01
+#define TGL_WINDING_BIT 0x02
+
+#define MAP_COORD(half, val) (((val) * (half)) + (half))
+
+#define TGL_ROTATION_MATRIX(x, y, z)                                                                                                                   \
+	{                                                                                                                                              \
+		{ cosf(z) * cosf(y), -sinf(z) * cosf(x) + cosf(z) * sinf(y) * sinf(x), sinf(z) * sinf(x) + cosf(z) * sinf(y) * cosf(x), 0.f },         \
+			{ sinf(z) * cosf(y), cosf(z) * cosf(x) + sinf(z) * sinf(y) * sinf(x), -cosf(z) * sinf(x) + sinf(z) * sinf(y) * cosf(x), 0.f }, \
+			{ -sinf(y), cosf(y) * sinf(x), cosf(y) * cosf(x), 0.f },                                                                       \
+			{ 0.f, 0.f, 0.f, 1.f },                                                                                                        \
+	}
+
+#define TGL_SCALE_MATRIX(x, y, z)               \
+	{                                       \
+		{ x, 0.f, 0.f, 0.f },           \
+			{ 0.f, y, 0.f, 0.f },   \
+			{ 0.f, 0.f, z, 0.f },   \
+			{ 0.f, 0.f, 0.f, 1.f }, \
+	}
+
+#define TGL_TRANSLATE_MATRIX(x, y, z)           \
+	{                                       \
+		{ 1.f, 0.f, 0.f, x },           \
+			{ 0.f, 1.f, 0.f, y },   \
+			{ 0.f, 0.f, 1.f, z },   \
+			{ 0.f, 0.f, 0.f, 1.f }, \
+	}
+
+#define TGL_CAMERA_MATRIX(width, height, fov, near_val, far_val)                                                                                     \
+	{                                                                                                                                            \
+		{ (height) / (float)(width) / tanf((fov)*.5f), 0.f, 0.f, 0.f },                                                                      \
+			{ 0.f, 1.f / tanf((fov)*.5f), 0.f, 0.f },                                                                                    \
+			{ 0.f, 0.f, -((far_val) + (near_val)) / ((far_val) - (near_val)), 2.f * (far_val) * (near_val) / ((far_val) - (near_val)) }, \
+			{ 0.f, 0.f, 1.f, 0.f },                                                                                                      \
+	}
+
+enum ClipPlane {
+	CLIP_NEAR = 0,
+	CLIP_FAR,
+	CLIP_LEFT,
+	CLIP_RIGHT,
+	CLIP_TOP,
+	CLIP_BOTTOM,
+};
+
+#define CLIP_BIT(plane) (1u << (plane))
+#define CLIP_NEAR_FAR (CLIP_BIT(CLIP_NEAR) | CLIP_BIT(CLIP_FAR))
+
+/* Filled triangles are only clipped against the planes of the sides of the screen if they reach outside of
+ * CLIP_GUARD_BAND times the screen around its center. The rasterizer clips the rest while finding spans
+ **/
+#define CLIP_GUARD_BAND 4.f
+
+typedef struct ClipVertex {
+	TGLVec4 pos;
+	uint8_t uv[2];
+} ClipVertex;
+
+/* Clipping a convex polygon against a plane adds at most one vertex, and the result is split into a fan of triangles */
+#define CLIP_MAX_VERTS 9u
+#define CLIP_MAX_TRIANGLES (CLIP_MAX_VERTS - 2u)
+
+static void itgl_clip_line(float dot_i, const TGLVec4 vec_i, const uint8_t uv_i[2], float dot_o, const TGLVec4 vec_o, const uint8_t uv_o[2], TGLVec4 vec_out, uint8_t uv_out[2]);
+static unsigned itgl_clip_polygon_plane(enum ClipPlane plane, const ClipVertex *in, unsigned n, ClipVertex *out);
+static float itgl_clip_plane_dot(const TGLVec4 v, enum ClipPlane plane);
+static inline unsigned itgl_clip_outcode(const TGLVec4 v);
+static inline bool itgl_clip_guard_band(const TGLVec4 v);
+static inline TGLVert itgl_clip_map(const TGL *tgl, const TGLVec4 v, const uint8_t uv[2]);
+static unsigned itgl_triangle_3d_vertex(const TGL *tgl, const TGLTriangle in, const uint8_t (*uv)[2], bool fill, TGLVertexShader *vert_shader, const void *vert_data, TGLVert (*out)[3]);
+static unsigned itgl_triangle_3d_clip(const TGL *tgl, const float *const verts[3], const uint8_t (*uv)[2], bool fill, TGLVert (*out)[3]);
+static unsigned itgl_mesh_triangle(const TGL *tgl, const uint32_t *idx, const uint8_t (*uv)[2], bool fill, TGLVert (*out)[3]);
+static void itgl_triangle_3d_draw(TGL *tgl, const Rect *rect, const TGLVert (*v)[3], bool fill, TGLPixelShader *frag_shader, const void *frag_data);
+static int itgl_mesh_reserve(TGL *tgl, size_t n_verts);
+static void itgl_mesh_transform(TGL *tgl, const TGLVec3 *verts, size_t begin, size_t end, TGLVertexShader *vert_shader, const void *vert_data);
+#ifndef TERMGL_MINIMAL
+#ifdef TGL_SIMD_SSE
+static inline void itgl_load_soa4(const TGLVec3 *in, __m128 *x, __m128 *y, __m128 *z);
+static inline void itgl_store_aos4(__m128 v0, __m128 v1, __m128 v2, __m128 v3, TGLVec4 *out);
+#endif
+static void itgl_transform_simple(const TGLMat mat, const TGLVec3 *in, TGLVec4 *out, size_t count);
+#endif
+#ifdef TERMGL_THREADS
+static Batch *itgl_batch_get(TGL *tgl);
+static void itgl_batch_transform_job(void *ctx, unsigned thread);
+static void itgl_batch_vertex_job(void *ctx, unsigned thread);
+static void itgl_batch_raster_job(void *ctx, unsigned thread);
+static int itgl_batch_run(TGL *tgl, Batch *batch);
+#endif
+
+#ifndef TERMGL_MINIMAL
+float tgl_sqr(const float val)
+{
+	return val * val;
+}
+
+float tgl_mag3(const float vec[3])
+{
+	return sqrtf(tgl_sqr(vec[0]) + tgl_sqr(vec[1]) + tgl_sqr(vec[2]));
+}
+
+float tgl_magsqr3(const float vec[3])
+{
+	return tgl_sqr(vec[0]) + tgl_sqr(vec[1]) + tgl_sqr(vec[2]);
+}
+
+float tgl_dot3(const float vec1[3], const float vec2[3])
+{
+	return vec1[0] * vec2[0] + vec1[1] * vec2[1] + vec1[2] * vec2[2];
+}
+
+float tgl_dot4(const float vec1[4], const float vec2[4])
+{
+	return vec1[0] * vec2[0] + vec1[1] * vec2[1] + vec1[2] * vec2[2] + vec1[3] * vec2[3];
+}
+
+float tgl_dot43(const float vec1[4], const float vec2[3])
+{
+	return vec1[0] * vec2[0] + vec1[1] * vec2[1] + vec1[2] * vec2[2] + vec1[3];
+}
+
+void tgl_add3s(const float vec1[3], const float summand, float res[3])
+{
+	res[0] = vec1[0] + summand;
+	res[1] = vec1[1] + summand;
+	res[2] = vec1[2] + summand;
+}
+
+void tgl_sub3s(const float vec1[3], const float subtrahend, float res[3])
+{
+	res[0] = vec1[0] - subtrahend;
+	res[1] = vec1[1] - subtrahend;
+	res[2] = vec1[2] - subtrahend;
+}
+
+void tgl_add3v(const float vec1[3], const float vec2[3], float res[3])
+{
+	res[0] = vec1[0] + vec2[0];
+	res[1] = vec1[1] + vec2[1];
+	res[2] = vec1[2] + vec2[2];
+}
+
+void tgl_mul3v(const float vec1[3], const float vec2[3], float res[3])
+{
+	res[0] = vec1[0] * vec2[0];
+	res[1] = vec1[1] * vec2[1];
+	res[2] = vec1[2] * vec2[2];
+}
+
+void tgl_inv3(const float vec[3], float res[3])
+{
+	res[0] = 1.f / vec[0];
+	res[1] = 1.f / vec[1];
+	res[2] = 1.f / vec[2];
+}
+
+void tgl_norm3(float vec[3])
+{
+	tgl_mul3s(vec, 1.f / tgl_mag3(vec), vec);
+}
+
+void tgl_mulmatvec(const TGLMat mat, const TGLVec3 vec, TGLVec4 res)
+{
+	res[0] = tgl_dot43(mat[0], vec);
+	res[1] = tgl_dot43(mat[1], vec);
+	res[2] = tgl_dot43(mat[2], vec);
+	res[3] = tgl_dot43(mat[3], vec);
+}
+
+void tgl_mulmat(const TGLMat mat1, const TGLMat mat2, TGLMat res)
+{
+	unsigned c, d, k;
+	for (c = 0; c < 4u; c++)
+		for (d = 0; d < 4u; d++) {
+			res[c][d] = 0.f;
+			for (k = 0; k < 4u; k++)
+				res[c][d] += mat1[c][k] * mat2[k][d];
+		}
+}
+
+void tgl_vertex_shader_simple(const TGLVec3 vert, TGLVec4 out, const void *const data)
+{
+	const TGLVertexShaderSimple *simple = data;
+	tgl_mulmatvec(simple->mat, vert, out);
+}
+
+#ifdef TGL_SIMD_SSE
+/* Deinterleaves 4 consecutive vertices into vectors of each coordinate */
+inline void itgl_load_soa4(const TGLVec3 *const in, __m128 *const x, __m128 *const y, __m128 *const z)
+{
+	const __m128 a = _mm_loadu_ps(in[0]); /* x0 y0 z0 x1 */
+	const __m128 b = _mm_loadu_ps(in[0] + 4); /* y1 z1 x2 y2 */
+	const __m128 c = _mm_loadu_ps(in[0] + 8); /* z2 x3 y3 z3 */
+	*x = _mm_shuffle_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 0, 0)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+	*y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+	*z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+/* Interleaves vectors of each output coordinate into 4 consecutive vertices */
+inline void itgl_store_aos4(__m128 v0, __m128 v1, __m128 v2, __m128 v3, TGLVec4 *const out)
+{
+	_MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+	_mm_storeu_ps(out[0], v0);
+	_mm_storeu_ps(out[1], v1);
+	_mm_storeu_ps(out[2], v2);
+	_mm_storeu_ps(out[3], v3);
+}
+#endif
+
+/* Equivalent to calling tgl_vertex_shader_simple on each vertex, but processes several vertices at once where SIMD is available.
+ * Products are summed in the same order as tgl_mulmatvec, so the results are identical
+ **/
+void itgl_transform_simple(const TGLMat mat, const TGLVec3 *const in, TGLVec4 *const out, const size_t count)
+{
+	size_t i = 0;
+#if defined(TGL_SIMD_AVX)
+	for (; i + 8 <= count; i += 8) {
+		__m128 x_lo, y_lo, z_lo, x_hi, y_hi, z_hi;
+		itgl_load_soa4(in + i, &x_lo, &y_lo, &z_lo);
+		itgl_load_soa4(in + i + 4, &x_hi, &y_hi, &z_hi);
+		const __m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(x_lo), x_hi, 1);
+		const __m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(y_lo), y_hi, 1);
+		const __m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(z_lo), z_hi, 1);
+		__m256 res[4];
+		unsigned r;
+		for (r = 0; r < 4; r++) {
+			res[r] = _mm256_mul_ps(_mm256_set1_ps(mat[r][0]), x);
+			res[r] = _mm256_add_ps(res[r], _mm256_mul_ps(_mm256_set1_ps(mat[r][1]), y));
+			res[r] = _mm256_add_ps(res[r], _mm256_mul_ps(_mm256_set1_ps(mat[r][2]), z));
+			res[r] = _mm256_add_ps(res[r], _mm256_set1_ps(mat[r][3]));
+		}
+		itgl_store_aos4(_mm256_castps256_ps128(res[0]), _mm256_castps256_ps128(res[1]), _mm256_castps256_ps128(res[2]), _mm256_castps256_ps128(res[3]), out + i);
+		itgl_store_aos4(_mm256_extractf128_ps(res[0], 1), _mm256_extractf128_ps(res[1], 1), _mm256_extractf128_ps(res[2], 1), _mm256_extractf128_ps(res[3], 1), out + i + 4);
+	}
+#endif
+#if defined(TGL_SIMD_SSE)
+	for (; i + 4 <= count; i += 4) {
+		__m128 x, y, z;
+		itgl_load_soa4(in + i, &x, &y, &z);
+		__m128 res[4];
+		unsigned r;
+		for (r = 0; r < 4; r++) {
+			res[r] = _mm_mul_ps(_mm_set1_ps(mat[r][0]), x);
+			res[r] = _mm_add_ps(res[r], _mm_mul_ps(_mm_set1_ps(mat[r][1]), y));
+			res[r] = _mm_add_ps(res[r], _mm_mul_ps(_mm_set1_ps(mat[r][2]), z));
+			res[r] = _mm_add_ps(res[r], _mm_set1_ps(mat[r][3]));
+		}
+		itgl_store_aos4(res[0], res[1], res[2], res[3], out + i);
+	}
+#elif defined(TGL_SIMD_NEON)
+	for (; i + 4 <= count; i += 4) {
+		const float32x4x3_t v = vld3q_f32(in[i]);
+		float32x4x4_t res;
+		unsigned r;
+		for (r = 0; r < 4; r++) {
+			res.val[r] = vmulq_n_f32(v.val[0], mat[r][0]);
+			res.val[r] = vaddq_f32(res.val[r], vmulq_n_f32(v.val[1], mat[r][1]));
+			res.val[r] = vaddq_f32(res.val[r], vmulq_n_f32(v.val[2], mat[r][2]));
+			res.val[r] = vaddq_f32(res.val[r], vdupq_n_f32(mat[r][3]));
+		}
+		vst4q_f32(out[i], res);
+	}
+#endif
+	for (; i < count; i++)
+		tgl_mulmatvec(mat, in[i], out[i]);
+}
+
+void tgl_camera(TGLMat camera, const int width, const int height, const float fov, const float near_val, const float far_val)
+{
+	TGLMat projection = TGL_CAMERA_MATRIX(width, height, fov, near_val, far_val);
+	memcpy(camera, projection, sizeof(TGLMat));
+}
+
+/* Depth is n / z * (f - z) / (f - n), which approaches n / z as far_val approaches infinity */
+void tgl_camera_reversed(TGLMat camera, const int width, const int height, const float fov, const float near_val, const float far_val)
+{
+	tgl_camera(camera, width, height, fov, near_val, far_val);
+	const float ratio = near_val / far_val;
+	camera[2][2] = -ratio / (1.f - ratio);
+	camera[2][3] = near_val / (1.f - ratio);
+}
+
+void tgl_rotate(TGLMat rotate, const float x, const float y, const float z)
+{
+	const TGLMat mat = TGL_ROTATION_MATRIX(x, y, z);
+	memcpy(rotate, mat, sizeof(TGLMat));
+}
+
+void tgl_scale(TGLMat scale, const float x, const float y, const float z)
+{
+	const TGLMat mat = TGL_SCALE_MATRIX(x, y, z);
+	memcpy(scale, mat, sizeof(TGLMat));
+}
+
+void tgl_translate(TGLMat translate, const float x, const float y, const float z)
+{
+	const TGLMat mat = TGL_TRANSLATE_MATRIX(x, y, z);
+	memcpy(translate, mat, sizeof(TGLMat));
+}
+#endif /* ~TERMGL_MINIMAL */
+
+void tgl_mul3s(const float vec[3], const float mul, float res[3])
+{
+	res[0] = vec[0] * mul;
+	res[1] = vec[1] * mul;
+	res[2] = vec[2] * mul;
+}
+
+void tgl_sub3v(const float vec1[3], const float vec2[3], float res[3])
+{
+	res[0] = vec1[0] - vec2[0];
+	res[1] = vec1[1] - vec2[1];
+	res[2] = vec1[2] - vec2[2];
+}
+
+void tgl_cross(const float vec1[3], const float vec2[3], float res[3])
+{
+	res[0] = vec1[1] * vec2[2] - vec1[2] * vec2[1];
+	res[1] = vec1[2] * vec2[0] - vec1[0] * vec2[2];
+	res[2] = vec1[0] * vec2[1] - vec1[1] * vec2[0];
+}
+
+void itgl_clip_line(const float dot_i, const TGLVec4 vec_i, const uint8_t uv_i[2], const float dot_o, const TGLVec4 vec_o, const uint8_t uv_o[2], TGLVec4 vec_out, uint8_t uv_out[2])
+{
+	const float d = dot_i / (dot_i - dot_o);
+	vec_out[0] = MIX(vec_o[0], vec_i[0], d);
+	vec_out[1] = MIX(vec_o[1], vec_i[1], d);
+	vec_out[2] = MIX(vec_o[2], vec_i[2], d);
+	vec_out[3] = MIX(vec_o[3], vec_i[3], d);
+	uv_out[0] = MIX(uv_o[0], uv_i[0], d);
+	uv_out[1] = MIX(uv_o[1], uv_i[1], d);
+}
+
+float itgl_clip_plane_dot(const TGLVec4 v, const enum ClipPlane plane)
+{
+	switch (plane) {
+	case CLIP_LEFT:
+		return v[0] + v[3];
+	case CLIP_RIGHT:
+		return -v[0] + v[3];
+	case CLIP_BOTTOM:
+		return v[1] + v[3];
+	case CLIP_TOP:
+		return -v[1] + v[3];
+	case CLIP_NEAR:
+		return v[2] + v[3];
+	case CLIP_FAR:
+		return -v[2] + v[3];
 	default:
 		TGL_UNREACHABLE();
 		return 0;
 	}
 }
 
-void tgl_triangle_3d(TGL *const tgl, const TGLTriangle in, const uint8_t (*const uv)[2], const bool fill, TGLVertexShader *const vert_shader, const void *const vert_data, TGLPixelShader *frag_shader, const void *const frag_data)
+/* Bit i is set if v is outside of plane i */
+inline unsigned itgl_clip_outcode(const TGLVec4 v)
+{
+	unsigned code = 0;
+	unsigned p;
+	for (p = 0; p < 6; p++)
+		if (itgl_clip_plane_dot(v, p) < 0.f)
+			code |= CLIP_BIT(p);
+	return code;
+}
+
+/* Requires v[3] > 0, which holds inside of the near and far planes */
+inline bool itgl_clip_guard_band(const TGLVec4 v)
+{
+	const float limit = CLIP_GUARD_BAND * v[3];
+	return fabsf(v[0]) <= limit && fabsf(v[1]) <= limit;
+}
+
+/* Perspective divide and mapping to screen coordinates */
+inline TGLVert itgl_clip_map(const TGL *const tgl, const TGLVec4 v, const uint8_t uv[2])
+{
+	TGLVec3 ndc;
+	tgl_mul3s(v, 1.f / v[3], ndc);
+	return (TGLVert){
+		.x = MAP_COORD(tgl->width * .5f, ndc[0]),
+		.y = MAP_COORD(tgl->height * .5f, ndc[1]),
+		.z = ndc[2],
+		.u = uv[0],
+		.v = uv[1],
+	};
+}
+
+/* Sutherland-Hodgman: keeps the part of a convex polygon inside of plane, preserving the order of vertices */
+unsigned itgl_clip_polygon_plane(const enum ClipPlane plane, const ClipVertex *const in, const unsigned n, ClipVertex *const out)
+{
+	/* Polygons which were clipped away entirely by previous planes have no area */
+	if (n < 3)
+		return 0;
+	unsigned n_out = 0;
+	unsigned i;
+	float dot_prev = itgl_clip_plane_dot(in[n - 1].pos, plane);
+	for (i = 0; i < n; i++) {
+		const ClipVertex *const prev = &in[(i + n - 1) % n], *const cur = &in[i];
+		const float dot_cur = itgl_clip_plane_dot(cur->pos, plane);
+		/* Intersections are always interpolated from the inside vertex, so edges shared by triangles are split at the same point */
+		if ((dot_prev >= 0.f) != (dot_cur >= 0.f)) {
+			if (dot_cur >= 0.f)
+				itgl_clip_line(dot_cur, cur->pos, cur->uv, dot_prev, prev->pos, prev->uv, out[n_out].pos, out[n_out].uv);
+			else
+				itgl_clip_line(dot_prev, prev->pos, prev->uv, dot_cur, cur->pos, cur->uv, out[n_out].pos, out[n_out].uv);
+			n_out++;
+		}
+		if (dot_cur >= 0.f)
+			out[n_out++] = *cur;
+		dot_prev = dot_cur;
+	}
+	return n_out;
+}
+
+unsigned itgl_triangle_3d_vertex(const TGL *const tgl, const TGLTriangle in, const uint8_t (*const uv)[2], const bool fill, TGLVertexShader *const vert_shader, const void *const vert_data, TGLVert (*const out)[3])
+{
+	/* Vertex shader */
+	TGLVec4 verts[3];
+	unsigned i;
+	STATS_TIME_BEGIN(vertex);
+	for (i = 0; i < 3; i++)
+		vert_shader(in[i], verts[i], vert_data);
+	STATS_TIME_END(tgl, vertex_ns, vertex);
+
+	const float *const vert_ptrs[3] = { verts[0], verts[1], verts[2] };
+	return itgl_triangle_3d_clip(tgl, vert_ptrs, uv, fill, out);
+}
+
+/* Culls and clips a triangle in clip space, then maps it to screen coordinates
+ * Triangles entirely inside of the view volume, or filled and inside of the guard band, are mapped without copies.
+ * Lines are clamped to the screen by the drawing functions, so the outline of a triangle is always clipped exactly
+ **/
+unsigned itgl_triangle_3d_clip(const TGL *const tgl, const float *const verts[3], const uint8_t (*const uv)[2], const bool fill, TGLVert (*const out)[3])
+{
+	unsigned i;
+	STATS_TIME_BEGIN(clip);
+	STATS_ADD(tgl, triangles_submitted, 1);
+
+	const unsigned codes[3] = { itgl_clip_outcode(verts[0]), itgl_clip_outcode(verts[1]), itgl_clip_outcode(verts[2]) };
+	const unsigned code_any = codes[0] | codes[1] | codes[2];
+	if (code_any)
+		STATS_ADD(tgl, triangles_clipped, 1);
+	/* Trivial reject: all vertices outside of the same plane */
+	if (codes[0] & codes[1] & codes[2]) {
+		STATS_TIME_END(tgl, clip_ns, clip);
+		return 0;
+	}
+
+	/* Backface culling */
+	if (tgl->settings & TGL_CULL_FACE) {
+		TGLVec3 v0s, v1s, v2s, ab, ac, cp;
+		tgl_mul3s(verts[0], 1.f / verts[0][3], v0s);
+		tgl_mul3s(verts[1], 1.f / verts[1][3], v1s);
+		tgl_mul3s(verts[2], 1.f / verts[2][3], v2s);
+		tgl_sub3v(v1s, v0s, ab);
+		tgl_sub3v(v2s, v0s, ac);
+		tgl_cross(ab, ac, cp);
+		if (XOR(tgl->settings & TGL_CULL_BIT, signbit(cp[2]))) {
+			STATS_ADD(tgl, triangles_culled, 1);
+			STATS_TIME_END(tgl, clip_ns, clip);
+			return 0;
+		}
+	}
+
+	/* Trivial accept */
+	if (!(code_any & CLIP_NEAR_FAR)
+		&& (!code_any || (fill && itgl_clip_guard_band(verts[0]) && itgl_clip_guard_band(verts[1]) && itgl_clip_guard_band(verts[2])))) {
+		for (i = 0; i < 3; i++)
+			out[0][i] = itgl_clip_map(tgl, verts[i], uv[i]);
+		STATS_TIME_END(tgl, clip_ns, clip);
+		return 1;
+	}
+
+	/* Clipping of the triangle as a polygon, alternating between two buffers */
+	ClipVertex polys[2][CLIP_MAX_VERTS];
+	ClipVertex *poly = polys[0];
+	unsigned n = 3;
+	for (i = 0; i < 3; i++) {
+		memcpy(poly[i].pos, verts[i], sizeof(TGLVec4));
+		memcpy(poly[i].uv, uv[i], sizeof(uint8_t[2]));
+	}
+	unsigned p;
+	for (p = CLIP_NEAR; p <= CLIP_FAR; p++) {
+		if (!(code_any & CLIP_BIT(p)))
+			continue;
+		ClipVertex *const next = (poly == polys[0]) ? polys[1] : polys[0];
+		n = itgl_clip_polygon_plane(p, poly, n, next);
+		poly = next;
+	}
+	/* Vertices added on the near plane may reach far outside of the screen, so the guard band is tested after near and far clipping.
+	 * Planes which all vertices were inside of stay so, since added vertices lie on edges
+	 **/
+	bool clip_sides = !fill;
+	for (i = 0; i < n && !clip_sides; i++)
+		clip_sides = !itgl_clip_guard_band(poly[i].pos);
+	for (p = CLIP_LEFT; clip_sides && p <= CLIP_BOTTOM; p++) {
+		if (!(code_any & CLIP_BIT(p)))
+			continue;
+		ClipVertex *const next = (poly == polys[0]) ? polys[1] : polys[0];
+		n = itgl_clip_polygon_plane(p, poly, n, next);
+		poly = next;
+	}
+	if (n < 3) {
+		STATS_TIME_END(tgl, clip_ns, clip);
+		return 0;
+	}
+
+	/* Fan around the first vertex, which is only mapped once */
+	const TGLVert first = itgl_clip_map(tgl, poly[0].pos, poly[0].uv);
+	TGLVert last = itgl_clip_map(tgl, poly[1].pos, poly[1].uv);
+	for (i = 2; i < n; i++) {
+		out[i - 2][0] = first;
+		out[i - 2][1] = last;
+		out[i - 2][2] = last = itgl_clip_map(tgl, poly[i].pos, poly[i].uv);
+	}
+
+	STATS_TIME_END(tgl, clip_ns, clip);
+	return n - 2;
+}
+
+void itgl_triangle_3d_draw(TGL *const tgl, const Rect *const rect, const TGLVert (*const v)[3], const bool fill, TGLPixelShader *const frag_shader, const void *const frag_data)
+{
+	STATS_TIME_BEGIN(raster);
+	if (fill) {
+		itgl_triangle_fill(tgl, rect, (*v)[0], (*v)[1], (*v)[2], frag_shader, frag_data);
+	} else {
+		itgl_line(tgl, rect, (*v)[0], (*v)[1], frag_shader, frag_data);
+		itgl_line(tgl, rect, (*v)[0], (*v)[2], frag_shader, frag_data);
+		itgl_line(tgl, rect, (*v)[1], (*v)[2], frag_shader, frag_data);
+	}
+	STATS_TIME_END(tgl, raster_ns, raster);
+}
+
+/* Gathers a triangle of tgl_draw_mesh from transformed vertices */
+unsigned itgl_mesh_triangle(const TGL *const tgl, const uint32_t *const idx, const uint8_t (*const uv)[2], const bool fill, TGLVert (*const out)[3])
+{
+	const float *const verts[3] = { tgl->mesh_verts[idx[0]], tgl->mesh_verts[idx[1]], tgl->mesh_verts[idx[2]] };
+	uint8_t trig_uv[3][2] = { { 0 } };
+	if (uv) {
+		unsigned i;
+		for (i = 0; i < 3; i++)
+			memcpy(trig_uv[i], uv[idx[i]], sizeof(uint8_t[2]));
+	}
+	return itgl_triangle_3d_clip(tgl, verts, (const uint8_t(*)[2])trig_uv, fill, out);
+}
+
+/* Transforms vertices [begin, end) of tgl_draw_mesh into tgl->mesh_verts */
+void itgl_mesh_transform(TGL *const tgl, const TGLVec3 *const verts, const size_t begin, const size_t end, TGLVertexShader *const vert_shader, const void *const vert_data)
+{
+	STATS_TIME_BEGIN(vertex);
+#ifndef TERMGL_MINIMAL
+	if (vert_shader == &tgl_vertex_shader_simple) {
+		itgl_transform_simple(((const TGLVertexShaderSimple *)vert_data)->mat, verts + begin, tgl->mesh_verts + begin, end - begin);
+		STATS_TIME_END(tgl, vertex_ns, vertex);
+		return;
+	}
+#endif
+	size_t i;
+	for (i = begin; i < end; i++)
+		vert_shader(verts[i], tgl->mesh_verts[i], vert_data);
+	STATS_TIME_END(tgl, vertex_ns, vertex);
+}
+
+int itgl_mesh_reserve(TGL *const tgl, const size_t n_verts)
+{
+	if (n_verts <= tgl->mesh_verts_capacity)
+		return 0;
+	TGLVec4 *const mesh_verts = itgl_alloc(tgl, sizeof(TGLVec4) * n_verts);
+	if (!mesh_verts)
+		return -1;
+	itgl_free(tgl, tgl->mesh_verts);
+	tgl->mesh_verts = mesh_verts;
+	tgl->mesh_verts_capacity = n_verts;
+	return 0;
+}
+
+void tgl_triangle_3d(TGL *const tgl, const TGLTriangle in, const uint8_t (*const uv)[2], const bool fill, TGLVertexShader *const vert_shader, const void *const vert_data, TGLPixelShader *frag_shader, const void *const frag_data)
+{
+	TGLVert trigs[CLIP_MAX_TRIANGLES][3];
+	const unsigned n_trigs = itgl_triangle_3d_vertex(tgl, in, uv, fill, vert_shader, vert_data, trigs);
+	const Rect rect = SCREEN_RECT(tgl);
+	unsigned i;
+	for (i = 0; i < n_trigs; i++) {
+		itgl_triangle_3d_draw(tgl, &rect, (const TGLVert(*)[3])trigs[i], fill, frag_shader, frag_data);
+		itgl_dirty_verts(tgl, trigs[i], 3);
+	}
+}
+
+#ifdef TERMGL_THREADS
+
+/* Batches are split into tiles which are rasterized in parallel.
+ * Every tile draws its triangles in submission order, restricted to the tile, so the result is identical to drawing serially.
+ **/
+/* Multiples of Z_TILE_SIZE, so that threads never share z-buffer tiles */
+#define BATCH_TILE_WIDTH 32
+#define BATCH_TILE_HEIGHT 16
+
+typedef struct BatchTriangle {
+	TGLVert verts[3];
+	const void *frag_data;
+	/* inclusive range of tiles covered by bounding box */
+	uint16_t tile_x0;
+	uint16_t tile_y0;
+	uint16_t tile_x1;
+	uint16_t tile_y1;
+} BatchTriangle;
+
+/* Output of vertex stage for a single thread */
+typedef struct BatchList {
+	BatchTriangle *trigs;
+	size_t count;
+	size_t capacity;
+	bool failed;
+} BatchList;
+
+struct Batch {
+	unsigned n_lists;
+	BatchList *lists;
+	const BatchTriangle **bins;
+	size_t bins_capacity;
+	size_t *bin_offsets; /* start of each tile's bin, n_tiles + 1 entries */
+	unsigned n_tiles;
+	unsigned tiles_x;
+
+	/* Arguments of current call. If indices is set, triangles are read from tgl->mesh_verts */
+	TGL *tgl;
+	const TGLTriangle *in;
+	const uint8_t (*uv)[3][2];
+	const TGLVec3 *verts;
+	size_t n_verts;
+	const uint32_t *indices;
+	const uint8_t (*vert_uv)[2];
+	size_t count;
+	bool fill;
+	TGLVertexShader *vert_shader;
+	const void *vert_data;
+	TGLPixelShader *frag_shader;
+	const void *frag_data;
+	size_t frag_data_stride;
+};
+
+void itgl_batch_free(const TGL *const tgl, Batch *const batch)
+{
+	if (!batch)
+		return;
+	unsigned i;
+	for (i = 0; i < batch->n_lists; i++)
+		itgl_free(tgl, batch->lists[i].trigs);
+	itgl_free(tgl, batch->lists);
+	itgl_free(tgl, batch->bins);
+	itgl_free(tgl, batch->bin_offsets);
+	itgl_free(tgl, batch);
+}
+
+/* Vertex shader stage of tgl_draw_mesh: each thread transforms a contiguous range of vertices */
+void itgl_batch_transform_job(void *const ctx, const unsigned thread)
+{
+	const Batch *const batch = ctx;
+	TGL *const tgl = batch->tgl;
+	const size_t begin = batch->n_verts * thread / batch->n_lists;
+	const size_t end = batch->n_verts * (thread + 1) / batch->n_lists;
+	itgl_mesh_transform(tgl, batch->verts, begin, end, batch->vert_shader, batch->vert_data);
+}
+
+/* Vertex stage: each thread processes a contiguous range of the input into its own list */
+void itgl_batch_vertex_job(void *const ctx, const unsigned thread)
+{
+	Batch *const batch = ctx;
+	const TGL *const tgl = batch->tgl;
+	BatchList *const list = &batch->lists[thread];
+	const size_t begin = batch->count * thread / batch->n_lists;
+	const size_t end = batch->count * (thread + 1) / batch->n_lists;
+	static const uint8_t uv_zero[3][2] = { { 0 } };
+	list->count = 0;
+	list->failed = false;
+
+	size_t i;
+	for (i = begin; i < end; i++) {
+		if (list->capacity - list->count < CLIP_MAX_TRIANGLES) {
+			const size_t capacity = list->capacity ? list->capacity * 2u : 256u;
+			BatchTriangle *const trigs = itgl_realloc(tgl, list->trigs, sizeof(BatchTriangle) * list->count, sizeof(BatchTriangle) * capacity);
+			if (!trigs) {
+				list->failed = true;
+				return;
+			}
+			list->trigs = trigs;
+			list->capacity = capacity;
+		}
+
+		TGLVert out[CLIP_MAX_TRIANGLES][3];
+		const unsigned n_out = batch->indices
+			? itgl_mesh_triangle(tgl, batch->indices + i * 3, batch->vert_uv, batch->fill, out)
+			: itgl_triangle_3d_vertex(tgl, batch->in[i], batch->uv ? batch->uv[i] : uv_zero, batch->fill, batch->vert_shader, batch->vert_data, out);
+		unsigned j;
+		for (j = 0; j < n_out; j++) {
+			BatchTriangle *const trig = &list->trigs[list->count++];
+			memcpy(trig->verts, out[j], sizeof(TGLVert[3]));
+			trig->frag_data = (const char *)batch->frag_data + i * batch->frag_data_stride;
+
+			/* Bounding box of vertices as clipped by the drawing functions */
+			int x_min = tgl->max_x, y_min = tgl->max_y, x_max = 0, y_max = 0;
+			unsigned k;
+			for (k = 0; k < 3; k++) {
+				int x = out[j][k].x, y = out[j][k].y;
+				itgl_clip(tgl, &x, &y);
+				x_min = MIN(x_min, x);
+				y_min = MIN(y_min, y);
+				x_max = MAX(x_max, x);
+				y_max = MAX(y_max, y);
+			}
+			trig->tile_x0 = x_min / BATCH_TILE_WIDTH;
+			trig->tile_y0 = y_min / BATCH_TILE_HEIGHT;
+			trig->tile_x1 = x_max / BATCH_TILE_WIDTH;
+			trig->tile_y1 = y_max / BATCH_TILE_HEIGHT;
+		}
+	}
+}
+
+/* Raster stage: threads take tiles one at a time */
+void itgl_batch_raster_job(void *const ctx, const unsigned thread)
+{
+	Batch *const batch = ctx;
+	TGL *const tgl = batch->tgl;
+	unsigned tile;
+	(void)thread;
+	while ((tile = itgl_pool_next(tgl->pool)) < batch->n_tiles) {
+		const int x0 = (tile % batch->tiles_x) * BATCH_TILE_WIDTH;
+		const int y0 = (tile / batch->tiles_x) * BATCH_TILE_HEIGHT;
+		const Rect rect = {
+			.x0 = x0,
+			.y0 = y0,
+			.x1 = MIN(x0 + BATCH_TILE_WIDTH - 1, tgl->max_x),
+			.y1 = MIN(y0 + BATCH_TILE_HEIGHT - 1, tgl->max_y),
+		};
+		size_t i;
+		for (i = batch->bin_offsets[tile]; i < batch->bin_offsets[tile + 1]; i++)
+			itgl_triangle_3d_draw(tgl, &rect, (const TGLVert(*)[3])batch->bins[i]->verts, batch->fill, batch->frag_shader, batch->bins[i]->frag_data);
+	}
+}
+
+/* Returns batch with storage for current thread count and frame size, with arguments reset */
+Batch *itgl_batch_get(TGL *const tgl)
+{
+	const unsigned n_threads = itgl_pool_threads(tgl->pool);
+	const unsigned tiles_x = (tgl->width + BATCH_TILE_WIDTH - 1) / BATCH_TILE_WIDTH;
+	const unsigned n_tiles = tiles_x * ((tgl->height + BATCH_TILE_HEIGHT - 1) / BATCH_TILE_HEIGHT);
+
+	if (!tgl->batch) {
+		tgl->batch = itgl_alloc(tgl, sizeof(Batch));
+		if (!tgl->batch)
+			return NULL;
+		*tgl->batch = (Batch){ 0 };
+	}
+	Batch *const batch = tgl->batch;
+	if (batch->n_lists != n_threads) {
+		BatchList *const lists = itgl_alloc(tgl, sizeof(BatchList) * n_threads);
+		if (!lists)
+			return NULL;
+		unsigned i;
+		for (i = 0; i < batch->n_lists; i++)
+			itgl_free(tgl, batch->lists[i].trigs);
+		itgl_free(tgl, batch->lists);
+		for (i = 0; i < n_threads; i++)
+			lists[i] = (BatchList){ 0 };
+		batch->lists = lists;
+		batch->n_lists = n_threads;
+	}
+	if (batch->n_tiles != n_tiles) {
+		size_t *const bin_offsets = itgl_alloc(tgl, sizeof(size_t) * (n_tiles + 1));
+		if (!bin_offsets)
+			return NULL;
+		itgl_free(tgl, batch->bin_offsets);
+		batch->bin_offsets = bin_offsets;
+		batch->n_tiles = n_tiles;
+	}
+	batch->tiles_x = tiles_x;
+
+	batch->tgl = tgl;
+	batch->in = NULL;
+	batch->uv = NULL;
+	batch->verts = NULL;
+	batch->n_verts = 0;
+	batch->indices = NULL;
+	batch->vert_uv = NULL;
+	return batch;
+}
+
+/* Runs vertex stage, bins its output, and rasterizes all tiles */
+int itgl_batch_run(TGL *const tgl, Batch *const batch)
+{
+	const unsigned n_threads = batch->n_lists;
+	const unsigned n_tiles = batch->n_tiles;
+	const unsigned tiles_x = batch->tiles_x;
+
+	itgl_pool_run(tgl->pool, &itgl_batch_vertex_job, batch);
+
+	/* Binning */
+	unsigned l, tile;
+	size_t i, n_binned = 0;
+	memset(batch->bin_offsets, 0, sizeof(size_t) * (n_tiles + 1));
+	for (l = 0; l < n_threads; l++) {
+		const BatchList *const list = &batch->lists[l];
+		if (list->failed) {
+			errno = ENOMEM;
+			return -1;
+		}
+		for (i = 0; i < list->count; i++) {
+			const BatchTriangle *const trig = &list->trigs[i];
+			unsigned tx, ty;
+			for (ty = trig->tile_y0; ty <= trig->tile_y1; ty++)
+				for (tx = trig->tile_x0; tx <= trig->tile_x1; tx++)
+					batch->bin_offsets[ty * tiles_x + tx + 1]++;
+			n_binned += (trig->tile_x1 - trig->tile_x0 + 1u) * (trig->tile_y1 - trig->tile_y0 + 1u);
+		}
+	}
+	if (n_binned > batch->bins_capacity) {
+		const BatchTriangle **const bins = itgl_alloc(tgl, sizeof(BatchTriangle *) * n_binned);
+		if (!bins)
+			return -1;
+		itgl_free(tgl, batch->bins);
+		batch->bins = bins;
+		batch->bins_capacity = n_binned;
+	}
+	for (tile = 0; tile < n_tiles; tile++)
+		batch->bin_offsets[tile + 1] += batch->bin_offsets[tile];
+	/* bin_offsets[tile] is used as insertion point, then shifted back */
+	for (l = 0; l < n_threads; l++) {
+		const BatchList *const list = &batch->lists[l];
+		for (i = 0; i < list->count; i++) {
+			const BatchTriangle *const trig = &list->trigs[i];
+			unsigned tx, ty;
+			for (ty = trig->tile_y0; ty <= trig->tile_y1; ty++)
+				for (tx = trig->tile_x0; tx <= trig->tile_x1; tx++)
+					batch->bins[batch->bin_offsets[ty * tiles_x + tx]++] = trig;
+		}
+	}
+	for (tile = n_tiles; tile > 0; tile--)
+		batch->bin_offsets[tile] = batch->bin_offsets[tile - 1];
+	batch->bin_offsets[0] = 0;
+
+	itgl_pool_run(tgl->pool, &itgl_batch_raster_job, batch);
+
+	/* Tiles with triangles are marked as a whole, worker threads never touch dirty_rows */
+	for (tile = 0; tile < n_tiles; tile++) {
+		if (batch->bin_offsets[tile] == batch->bin_offsets[tile + 1])
+			continue;
+		const int x0 = (tile % tiles_x) * BATCH_TILE_WIDTH;
+		const int y0 = (tile / tiles_x) * BATCH_TILE_HEIGHT;
+		itgl_dirty_rect(tgl, x0, y0, MIN(x0 + BATCH_TILE_WIDTH - 1, tgl->max_x), MIN(y0 + BATCH_TILE_HEIGHT - 1, tgl->max_y));
+	}
+	return 0;
+}
+
+#endif /* TERMGL_THREADS */
+
+int tgl_triangles_3d(TGL *const tgl, const TGLTriangle *const in, const uint8_t (*const uv)[3][2], const size_t count, const bool fill, TGLVertexShader *const vert_shader, const void *const vert_data, TGLPixelShader *const frag_shader, const void *const frag_data, const size_t frag_data_stride)
+{
+#ifdef TERMGL_THREADS
+	if (tgl->pool) {
+		Batch *const batch = itgl_batch_get(tgl);
+		if (!batch)
+			return -1;
+		batch->in = in;
+		batch->uv = uv;
+		batch->count = count;
+		batch->fill = fill;
+		batch->vert_shader = vert_shader;
+		batch->vert_data = vert_data;
+		batch->frag_shader = frag_shader;
+		batch->frag_data = frag_data;
+		batch->frag_data_stride = frag_data_stride;
+		return itgl_batch_run(tgl, batch);
+	}
+#endif
+	static const uint8_t uv_zero[3][2] = { { 0 } };
+	size_t i;
+	for (i = 0; i < count; i++)
+		tgl_triangle_3d(tgl, in[i], uv ? uv[i] : uv_zero, fill, vert_shader, vert_data, frag_shader, (const char *)frag_data + i * frag_data_stride);
+	return 0;
+}
+
+int tgl_draw_mesh(TGL *const tgl, const TGLVec3 *const verts, const size_t n_verts, const uint32_t *const indices, const size_t n_idx, const uint8_t (*const uv)[2], const bool fill, TGLVertexShader *const vert_shader, const void *const vert_data, TGLPixelShader *const frag_shader, const void *const frag_data, const size_t frag_data_stride)
+{
+	if (itgl_mesh_reserve(tgl, n_verts))
+		return -1;
+	const size_t count = n_idx / 3;
+
+#ifdef TERMGL_THREADS
+	if (tgl->pool) {
+		Batch *const batch = itgl_batch_get(tgl);
+		if (!batch)
+			return -1;
+		batch->verts = verts;
+		batch->n_verts = n_verts;
+		batch->indices = indices;
+		batch->vert_uv = uv;
+		batch->count = count;
+		batch->fill = fill;
+		batch->vert_shader = vert_shader;
+		batch->vert_data = vert_data;
+		batch->frag_shader = frag_shader;
+		batch->frag_data = frag_data;
+		batch->frag_data_stride = frag_data_stride;
+		itgl_pool_run(tgl->pool, &itgl_batch_transform_job, batch);
+		return itgl_batch_run(tgl, batch);
+	}
+#endif
+
+	/* Each vertex is only transformed once, regardless of how many triangles share it */
+	itgl_mesh_transform(tgl, verts, 0, n_verts, vert_shader, vert_data);
+
+	const Rect rect = SCREEN_RECT(tgl);
+	size_t i;
+	for (i = 0; i < count; i++) {
+		TGLVert trigs[CLIP_MAX_TRIANGLES][3];
+		const unsigned n_trigs = itgl_mesh_triangle(tgl, indices + i * 3, uv, fill, trigs);
+		const void *const trig_frag_data = (const char *)frag_data + i * frag_data_stride;
+		unsigned j;
+		for (j = 0; j < n_trigs; j++) {
+			itgl_triangle_3d_draw(tgl, &rect, (const TGLVert(*)[3])trigs[j], fill, frag_shader, trig_frag_data);
+			itgl_dirty_verts(tgl, trigs[j], 3);
+		}
+	}
+	return 0;
+}
+
+void tgl_cull_face(TGL *const tgl, const uint8_t settings)
+{
+#ifdef TERMGL_THREADS
+	/* settings are read by the presenter when it starts printing, but printing is not waited for */
+	if (tgl->presenter)
+		MUTEX_LOCK(&tgl->presenter->mutex);
+#endif
+	tgl->settings = (tgl->settings & ~TGL_CULL_BIT) | (XOR(settings & TGL_CULL_FACE_BIT, settings & TGL_WINDING_BIT) ? TGL_CULL_BIT : 0);
+#ifdef TERMGL_THREADS
+	if (tgl->presenter)
+		MUTEX_UNLOCK(&tgl->presenter->mutex);
+#endif
+}
+
+#endif /* TERMGL3D */
+
+#ifdef TERMGLUTIL
+
+#ifdef __unix__
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef TERMGL_THREADS
+#include <fcntl.h>
+#include <poll.h>
+#endif
+#endif
+
+#ifdef __unix__
+#define MOUSE_SEQ_MAX 24u /* ESC [ < b ; x ; y M with 5 digit numbers fits */
+#define MOUSE_SGR_DIGITS 5u
+
+/* State of xterm mouse sequences parsed one byte at a time, so sequences may be split between reads */
+typedef struct MouseParser {
+	char pending[MOUSE_SEQ_MAX]; /* bytes of a possible sequence */
+	unsigned n_pending;
+	char keys[MOUSE_SEQ_MAX]; /* bytes found not to be part of a sequence, for caller to take */
+	unsigned n_keys;
+	uint32_t params[3]; /* SGR */
+	unsigned n_params;
+	unsigned n_digits;
+} MouseParser;
+
+static inline uint8_t itgl_xterm_button_conv(uint8_t button);
+static bool itgl_mouse_parse(MouseParser *parser, char c, TGLMouseEvent *event);
+static bool itgl_mouse_parse_sgr(MouseParser *parser, char c, TGLMouseEvent *event);
+static void itgl_mouse_parse_reject(MouseParser *parser, char c);
+static void itgl_mouse_parse_flush(MouseParser *parser);
+static void itgl_sigwinch_handler(int sig);
+static int itgl_sigwinch_install(void);
+
+static volatile sig_atomic_t itgl_console_resized;
+#ifdef TERMGL_THREADS
+static volatile sig_atomic_t itgl_input_resized;
+/* Write end of the pipe which wakes the input thread, or -1 */
+static volatile sig_atomic_t itgl_input_wake_fd = -1;
+#endif
+
+void itgl_sigwinch_handler(const int sig)
+{
+	(void)sig;
+	itgl_console_resized = 1;
+#ifdef TERMGL_THREADS
+	itgl_input_resized = 1;
+	const int fd = itgl_input_wake_fd;
+	if (fd >= 0) {
+		const int err = errno;
+		const char byte = 0;
+		if (write(fd, &byte, 1) < 0) {
+			/* Pipe is full, so the thread is woken anyway */
+		}
+		errno = err;
+	}
+#endif
+}
+
+/* Installs itgl_sigwinch_handler once */
+int itgl_sigwinch_install(void)
+{
+	static bool installed = false;
+	if (installed)
+		return 0;
+	struct sigaction action = { 0 };
+	action.sa_handler = &itgl_sigwinch_handler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	CALL(sigaction(SIGWINCH, &action, NULL), -1);
+	installed = true;
+	return 0;
+}
+
+inline uint8_t itgl_xterm_button_conv(const uint8_t button)
+{
+	const uint8_t mod = (button & 0x40) ? TGL_MOUSE_WHEEL_OR_MOVEMENT : 0x00;
+	switch ((button - 32) & 0x03) {
+	case 0x00:
+		return TGL_MOUSE_1 | mod;
+	case 0x01:
+		return TGL_MOUSE_3 | mod;
+	case 0x02:
+		return TGL_MOUSE_2 | mod;
+	case 0x03:
+		return TGL_MOUSE_RELEASE | mod;
+	}
+	TGL_UNREACHABLE();
+	return 0;
+}
+
+/* Moves pending bytes and c to keys, except an ESC c which may begin the next sequence */
+void itgl_mouse_parse_reject(MouseParser *const parser, const char c)
+{
+	memcpy(parser->keys + parser->n_keys, parser->pending, parser->n_pending);
+	parser->n_keys += parser->n_pending;
+	parser->n_pending = 0;
+	if (c == '\033')
+		parser->pending[parser->n_pending++] = c;
+	else
+		parser->keys[parser->n_keys++] = c;
+}
+
+/* Moves pending bytes to keys, e.g. at end of input */
+void itgl_mouse_parse_flush(MouseParser *const parser)
+{
+	memcpy(parser->keys + parser->n_keys, parser->pending, parser->n_pending);
+	parser->n_keys += parser->n_pending;
+	parser->n_pending = 0;
+}
+
+/**
+ * Parses c of X10 (ESC [ M b x y) or SGR (ESC [ < b ; x ; y M/m) mouse sequences, which are also used for pixel coordinates (1016)
+ * Returns true if c completes a mouse event, which is stored in *event. Bytes found not to be part of a sequence are appended to parser->keys, which the caller empties
+ */
+bool itgl_mouse_parse(MouseParser *const parser, const char c, TGLMouseEvent *const event)
+{
+	if (!parser->n_pending) {
+		if (c == '\033')
+			parser->pending[parser->n_pending++] = c;
+		else
+			parser->keys[parser->n_keys++] = c;
+		return false;
+	}
+	if (parser->n_pending == 1u) {
+		if (c == '[')
+			parser->pending[parser->n_pending++] = c;
+		else
+			itgl_mouse_parse_reject(parser, c);
+		return false;
+	}
+	if (parser->n_pending == 2u) {
+		if (c == 'M' || c == '<') {
+			parser->pending[parser->n_pending++] = c;
+			parser->params[0] = 0;
+			parser->n_params = 0;
+			parser->n_digits = 0;
+		} else {
+			itgl_mouse_parse_reject(parser, c);
+		}
+		return false;
+	}
+	if (parser->pending[2] == '<')
+		return itgl_mouse_parse_sgr(parser, c, event);
+
+	/* X10 encodes button and 1-based coordinates offset by 32 in one byte each */
+	parser->pending[parser->n_pending++] = c;
+	if (parser->n_pending < 6u)
+		return false;
+	parser->n_pending = 0;
+	if ((parser->pending[3] & 0x7f) != parser->pending[3])
+		return false;
+	*event = (TGLMouseEvent){
+		.button = itgl_xterm_button_conv(parser->pending[3]),
+		.x = (uint8_t)(parser->pending[4] - 32),
+		.y = (uint8_t)(parser->pending[5] - 32),
+	};
+	return true;
+}
+
+/* SGR encodes button and 1-based coordinates as decimal parameters, and release with final m */
+bool itgl_mouse_parse_sgr(MouseParser *const parser, const char c, TGLMouseEvent *const event)
+{
+	if (c >= '0' && c <= '9' && parser->n_digits < MOUSE_SGR_DIGITS) {
+		parser->pending[parser->n_pending++] = c;
+		parser->params[parser->n_params] = parser->params[parser->n_params] * 10u + (uint32_t)(c - '0');
+		parser->n_digits++;
+		return false;
+	}
+	if (!parser->n_digits || parser->params[parser->n_params] > UINT16_MAX) {
+		itgl_mouse_parse_reject(parser, c);
+		return false;
+	}
+	if (c == ';' && parser->n_params < 2u) {
+		parser->pending[parser->n_pending++] = c;
+		parser->params[++parser->n_params] = 0;
+		parser->n_digits = 0;
+		return false;
+	}
+	if ((c != 'M' && c != 'm') || parser->n_params != 2u) {
+		itgl_mouse_parse_reject(parser, c);
+		return false;
+	}
+	parser->n_pending = 0;
+	/* Offset by 32 like X10, so buttons convert alike */
+	const uint8_t button = itgl_xterm_button_conv((uint8_t)(parser->params[0] + 32u));
+	*event = (TGLMouseEvent){
+		.button = (c == 'm') ? TGL_MOUSE_RELEASE : button,
+		.x = (uint16_t)parser->params[1],
+		.y = (uint16_t)parser->params[2],
+	};
+	return true;
+}
+#endif /* __unix__ */
+
+#ifdef TGL_OS_WINDOWS
+static inline uint8_t itgl_windows_mouse_event_record_conv(MOUSE_EVENT_RECORD record, uint8_t *state);
+
+inline uint8_t itgl_windows_mouse_event_record_conv(const MOUSE_EVENT_RECORD record, uint8_t *const state)
+{
+	if (record.dwEventFlags & (MOUSE_WHEELED | 0x0008 | MOUSE_MOVED))
+		return TGL_MOUSE_WHEEL_OR_MOVEMENT | TGL_MOUSE_UNKNOWN;
+	const uint8_t changed = *state ^ record.dwButtonState;
+	if (changed & *state) {
+		*state = record.dwButtonState;
+		return TGL_MOUSE_RELEASE;
+	}
+	*state = record.dwButtonState;
+	if (changed & 0x01)
+		return TGL_MOUSE_1;
+	if (changed & 0x02)
+		return TGL_MOUSE_2;
+	if (changed & 0x04)
+		return TGL_MOUSE_3;
+	return TGL_MOUSE_WHEEL_OR_MOVEMENT | TGL_MOUSE_UNKNOWN;
+}
+#endif /* TGL_OS_WINDOWS */
+
+TGL_SSIZE_T tglutil_read(char *const buf, const size_t count, TGLMouseEvent *const event_buf, const size_t count_events, size_t *const count_read_events)
+{
+#ifdef __unix__
+	struct termios oldt, newt;
+
+	/* Disable canonical mode */
+	CALL(tcgetattr(STDIN_FILENO, &oldt), -2);
+	newt = oldt;
+	newt.c_lflag &= ~(ICANON);
+	newt.c_cc[VMIN] = 0;
+	newt.c_cc[VTIME] = 0;
+	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &newt), -3);
+
+	const TGL_SSIZE_T retval = read(2, buf, count);
+
+	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &oldt), -3);
+
+	/* Flush input buffer to prevent read of previous unread input */
+	CALL(tcflush(STDIN_FILENO, TCIFLUSH), -4);
+
+	if (!event_buf || retval <= 0)
+		return retval;
+
+	/* Parse mouse events. Bytes of an incomplete sequence at the end are kept in buf */
+	*count_read_events = 0;
+	MouseParser parser = { .n_pending = 0, .n_keys = 0 };
+	size_t rd, wr = 0;
+	for (rd = 0; rd < (size_t)retval; rd++) {
+		TGLMouseEvent event;
+		const bool is_event = itgl_mouse_parse(&parser, buf[rd], &event);
+		/* Keys are bytes already read, so they never overtake rd */
+		memcpy(buf + wr, parser.keys, parser.n_keys);
+		wr += parser.n_keys;
+		parser.n_keys = 0;
+		if (is_event && *count_read_events < count_events)
+			event_buf[(*count_read_events)++] = event;
+	}
+	itgl_mouse_parse_flush(&parser);
+	memcpy(buf + wr, parser.keys, parser.n_keys);
+	wr += parser.n_keys;
+
+	return wr;
+#else /* defined(TGL_OS_WINDOWS) */
+	static uint8_t mouse_state = 0x00;
+
+	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
+	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, -1);
+
+	/* Disable canonical mode */
+	DWORD old_mode, new_mode;
+	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &old_mode), -1);
+	new_mode = old_mode;
+	new_mode &= ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT);
+	WINDOWS_CALL(!SetConsoleMode(hInputHandle, new_mode), -1);
+
+	DWORD event_cnt;
+	WINDOWS_CALL(!GetNumberOfConsoleInputEvents(hInputHandle, &event_cnt), -1);
+
+	if (count_events)
+		*count_read_events = 0;
+
+	/* ReadConsole is blocking so must manually process events */
+	size_t retval = 0;
+	if (event_cnt) {
+		INPUT_RECORD input_records[128];
+		WINDOWS_CALL(!ReadConsoleInput(hInputHandle, input_records, 32, &event_cnt), -1);
+
+		DWORD i;
+		for (i = 0; i < event_cnt; i++) {
+			switch (input_records[i].EventType) {
+			case KEY_EVENT:
+				if (input_records[i].Event.KeyEvent.bKeyDown && retval < count)
+					buf[retval++] = input_records[i].Event.KeyEvent.uChar.AsciiChar;
+				break;
+			case MOUSE_EVENT:
+				if (event_buf && *count_read_events < count_events)
+					event_buf[(*count_read_events)++] = (TGLMouseEvent){
+						.button = itgl_windows_mouse_event_record_conv(input_records[i].Event.MouseEvent, &mouse_state),
+						.x = input_records[i].Event.MouseEvent.dwMousePosition.X,
+						.y = input_records[i].Event.MouseEvent.dwMousePosition.Y,
+					};
+			}
+		}
+	}
+
+	WINDOWS_CALL(!SetConsoleMode(hInputHandle, old_mode), -1);
+#endif
+	return retval;
+}
+
+int tglutil_get_console_size(unsigned *const col, unsigned *const row, const bool screen_buffer)
+{
+#ifdef __unix__
+	(void)screen_buffer;
+	struct winsize w;
+	const int retval = ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+	*col = w.ws_col;
+	*row = w.ws_row;
+	return retval;
+#else /* defined(TGL_OS_WINDOWS) */
+	const HANDLE hOutputHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+	WINDOWS_CALL(hOutputHandle == INVALID_HANDLE_VALUE, -1);
+
+	CONSOLE_SCREEN_BUFFER_INFO csbi;
+	WINDOWS_CALL(!GetConsoleScreenBufferInfo(hOutputHandle, &csbi), -1);
+	if (screen_buffer) {
+		*col = csbi.dwSize.X;
+		*row = csbi.dwSize.Y;
+	} else {
+		*col = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+		*row = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+	}
+	return 0;
+#endif
+}
+
+int tglutil_poll_console_resize(unsigned *const col, unsigned *const row, const bool screen_buffer)
+{
+#ifdef __unix__
+	static bool polled = false;
+	if (polled && !itgl_console_resized)
+		return 0;
+	CALL(itgl_sigwinch_install(), -1);
+	polled = true;
+	/* Cleared before reading the size, so a resize during the read is reported by the next call */
+	itgl_console_resized = 0;
+	CALL(tglutil_get_console_size(col, row, screen_buffer), -1);
+	return 1;
+#else /* defined(TGL_OS_WINDOWS) */
+	static bool polled = false;
+	static unsigned prev_col, prev_row;
+	CALL(tglutil_get_console_size(col, row, screen_buffer), -1);
+	if (polled && *col == prev_col && *row == prev_row)
+		return 0;
+	polled = true;
+	prev_col = *col;
+	prev_row = *row;
+	return 1;
+#endif
+}
+
+int tglutil_set_console_size(const unsigned col, const unsigned row)
+{
+#ifdef __unix__
+	const struct winsize w = (struct winsize){
+		.ws_row = row,
+		.ws_col = col,
+	};
+	return ioctl(STDOUT_FILENO, TIOCSWINSZ, &w);
+#else /* defined(TGL_OS_WINDOWS) */
+	const HANDLE hOutputHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+	WINDOWS_CALL(hOutputHandle == INVALID_HANDLE_VALUE, -1);
+
+	const COORD size = (COORD){
+		.Y = row,
+		.X = col,
+	};
+	WINDOWS_CALL(!SetConsoleScreenBufferSize(hOutputHandle, size), -1);
+	return 0;
+#endif
+}
+
+int tglutil_set_window_title(const char *title)
+{
+	CALL_STDOUT(fputs("\033]2;", stdout), -1);
+	CALL_STDOUT(fputs(title, stdout), -1);
+	CALL_STDOUT(fputs("\033\\", stdout), -1);
+	return 0;
+}
+
+int tglutil_set_echo_input(const bool enabled)
+{
+#ifdef __unix__
+	struct termios t;
+	CALL(tcgetattr(STDIN_FILENO, &t), -1);
+	t.c_lflag = (enabled) ? (t.c_lflag | (ECHO)) : (t.c_lflag & ~(ECHO));
+	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &t), -2);
+#else /* defined(TGL_OS_WINDOWS) */
+	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
+	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, -1);
+
+	DWORD mode;
+	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &mode), -1);
+	mode = (enabled) ? (mode | (ENABLE_ECHO_INPUT)) : (mode & ~(ENABLE_ECHO_INPUT));
+	WINDOWS_CALL(!SetConsoleMode(hInputHandle, mode), -1);
+#endif
+	return 0;
+}
+
+int tglutil_set_mouse_tracking_enabled(const bool enabled)
+{
+	return tglutil_set_mouse_tracking_ex(enabled, 0);
+}
+
+int tglutil_set_mouse_tracking_ex(const bool enabled, const uint8_t encoding)
+{
+#ifdef __unix__
+	if (enabled) {
+		CALL_STDOUT(fputs("\033[?1003h", stdout), -1);
+		/* SGR is also enabled for pixels, so terminals without 1016 report cells */
+		if (encoding & (TGL_MOUSE_SGR | TGL_MOUSE_SGR_PIXELS))
+			CALL_STDOUT(fputs("\033[?1006h", stdout), -1);
+		if (encoding & TGL_MOUSE_SGR_PIXELS)
+			CALL_STDOUT(fputs("\033[?1016h", stdout), -1);
+	} else {
+		CALL_STDOUT(fputs("\033[?1003l\033[?1006l\033[?1016l", stdout), -1);
+	}
+	CALL_STDOUT(fflush(stdout), -2);
+#else /* defined(TGL_OS_WINDOWS) */
+	(void)encoding;
+	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
+	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, -1);
+
+	DWORD mode;
+	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &mode), -1);
+	mode = (enabled) ? (mode | (ENABLE_MOUSE_INPUT)) : (mode & ~(ENABLE_MOUSE_INPUT));
+	WINDOWS_CALL(!SetConsoleMode(hInputHandle, mode), -1);
+#endif
+	return 0;
+}
+
+#ifdef TERMGL_THREADS
+
+/* Acquire loads and release stores of queue indices, which are shared by one producer and one consumer */
+#ifdef __GNUC__
+#define ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#elif defined(TGL_OS_WINDOWS)
+#define ATOMIC_LOAD(ptr) ((uint32_t)InterlockedCompareExchange((volatile LONG *)(ptr), 0, 0))
+#define ATOMIC_STORE(ptr, val) ((void)InterlockedExchange((volatile LONG *)(ptr), (LONG)(val)))
+#else
+#error "Input queue of TermGLUtil requires GCC-compatible atomic builtins or Windows."
+#endif
+
+#define INPUT_READ_SIZE 256u /* bytes on UNIX, records on Windows */
+#define INPUT_ESC_TIMEOUT_MS 25
+#define INPUT_FULL_WAIT_NS 1000000u
+
+static bool itgl_input_active = false;
+
+/* Events are written at head by the input thread and read at tail by tglutil_input_poll. Indices wrap and are masked */
+struct TGLInput {
+	uint32_t head;
+	char pad_head[ARENA_ALIGN - sizeof(uint32_t)];
+	uint32_t tail;
+	char pad_tail[ARENA_ALIGN - sizeof(uint32_t)];
+	uint32_t mask;
+	uint32_t quit;
+	int error;
+	Thread handle;
+#ifdef __unix__
+	MouseParser parser;
+	int wake[2];
+	bool tty;
+	tcflag_t lflag;
+	cc_t vmin;
+	cc_t vtime;
+#else /* defined(TGL_OS_WINDOWS) */
+	HANDLE input_handle;
+	HANDLE stop_event;
+	DWORD mode;
+	uint8_t mouse_state;
+#endif
+	TGLInputEvent events[];
+};
+
+static THREAD_FUNC(itgl_input_worker, arg);
+static bool itgl_input_push(TGLInput *input, TGLInputEvent event);
+static bool itgl_input_push_key(TGLInput *input, char key);
+#ifdef __unix__
+static bool itgl_input_push_keys(TGLInput *input);
+static bool itgl_input_parse(TGLInput *input, char c);
+static bool itgl_input_read(TGLInput *input, struct pollfd *fd);
+#endif
+static void itgl_input_free(TGLInput *input);
+
+/* Waits while queue is full, and returns false if the thread is stopped meanwhile */
+bool itgl_input_push(TGLInput *const input, const TGLInputEvent event)
+{
+	const uint32_t head = input->head;
+	while (head - ATOMIC_LOAD(&input->tail) > input->mask) {
+		if (ATOMIC_LOAD(&input->quit))
+			return false;
+		itgl_sleep_ns(INPUT_FULL_WAIT_NS);
+	}
+	input->events[head & input->mask] = event;
+	ATOMIC_STORE(&input->head, head + 1u);
+	return true;
+}
+
+bool itgl_input_push_key(TGLInput *const input, const char key)
+{
+	return itgl_input_push(input, (TGLInputEvent){
+		.type = TGL_INPUT_KEY,
+		.key = key,
+	});
+}
+
+#ifdef __unix__
+/* Pushes and empties keys of parser */
+bool itgl_input_push_keys(TGLInput *const input)
 {
-	/* Vertex shader */
-	TGLVec4 verts[3];
 	unsigned i;
-	for (i = 0; i < 3; i++)
-		vert_shader(in[i], verts[i], vert_data);
+	for (i = 0; i < input->parser.n_keys; i++)
+		if (!itgl_input_push_key(input, input->parser.keys[i]))
+			return false;
+	input->parser.n_keys = 0;
+	return true;
+}
 
-	/* Backface culling */
-	if (tgl->settings & TGL_CULL_FACE) {
-		TGLVec3 v0s, v1s, v2s, ab, ac, cp;
-		tgl_mul3s(verts[0], 1.f / verts[0][3], v0s);
-		tgl_mul3s(verts[1], 1.f / verts[1][3], v1s);
-		tgl_mul3s(verts[2], 1.f / verts[2][3], v2s);
-		tgl_sub3v(v1s, v0s, ab);
-		tgl_sub3v(v2s, v0s, ac);
-		tgl_cross(ab, ac, cp);
-		if (XOR(tgl->settings & TGL_CULL_BIT, signbit(cp[2])))
-			return;
+/* Parses one byte of input like tglutil_read, but a mouse sequence split between reads is joined */
+bool itgl_input_parse(TGLInput *const input, const char c)
+{
+	TGLMouseEvent event;
+	const bool is_event = itgl_mouse_parse(&input->parser, c, &event);
+	if (!itgl_input_push_keys(input))
+		return false;
+	return !is_event || itgl_input_push(input, (TGLInputEvent){ .type = TGL_INPUT_MOUSE, .mouse = event });
+}
+
+/* Reads available bytes of fd, which stops being polled at end of input */
+bool itgl_input_read(TGLInput *const input, struct pollfd *const fd)
+{
+	char buf[INPUT_READ_SIZE];
+	const ssize_t len = (fd->revents & POLLNVAL) ? 0 : read(fd->fd, buf, sizeof(buf));
+	if (len < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return true;
+		input->error = errno;
+		return false;
 	}
+	if (!len) {
+		fd->fd = -1;
+		itgl_mouse_parse_flush(&input->parser);
+		return itgl_input_push_keys(input);
+	}
+	ssize_t i;
+	for (i = 0; i < len; i++)
+		if (!itgl_input_parse(input, buf[i]))
+			return false;
+	return true;
+}
 
-	/* Clipping */
-	TGLUVTriangle trig_buffer[127]; /* the size of this buffer assumes a pathological case which is probably impossible */
-	memcpy(&(trig_buffer[0].verts), verts, sizeof(TGLVec4[3]));
-	memcpy(&(trig_buffer[0].uv), uv, sizeof(uint8_t[3][2]));
-	unsigned buffer_offset = 0;
-	unsigned n_cur_stage = 1;
-	unsigned p;
-	for (p = 0; p < 6; p++) {
-		unsigned n_next_stage = 0;
-		for (i = 0; i < n_cur_stage; i++) {
-			n_next_stage += itgl_clip_triangle_plane(p, &trig_buffer[i + buffer_offset], &trig_buffer[buffer_offset + n_cur_stage + n_next_stage]);
+THREAD_FUNC(itgl_input_worker, arg)
+{
+	TGLInput *const input = arg;
+	struct pollfd fds[2] = {
+		{ .fd = input->wake[0], .events = POLLIN },
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+	};
+	while (!ATOMIC_LOAD(&input->quit)) {
+		/* Lone ESC is a key if the rest of a mouse sequence does not follow in time. Longer prefixes wait for the next byte */
+		const int n = poll(fds, 2, (input->parser.n_pending == 1u) ? INPUT_ESC_TIMEOUT_MS : -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			input->error = errno;
+			break;
+		}
+		if (!n) {
+			itgl_mouse_parse_flush(&input->parser);
+			if (!itgl_input_push_keys(input))
+				break;
+			continue;
+		}
+		if (fds[0].revents & POLLIN) {
+			char buf[INPUT_READ_SIZE];
+			while (read(input->wake[0], buf, sizeof(buf)) > 0)
+				;
 		}
-		buffer_offset += n_cur_stage;
-		n_cur_stage = n_next_stage;
+		if (itgl_input_resized) {
+			itgl_input_resized = 0;
+			unsigned col, row;
+			if (!tglutil_get_console_size(&col, &row, true)
+				&& !itgl_input_push(input, (TGLInputEvent){ .type = TGL_INPUT_RESIZE, .col = col, .row = row }))
+				break;
+		}
+		if (fds[1].revents && !itgl_input_read(input, &fds[1]))
+			break;
+	}
+	THREAD_FUNC_RETURN;
+}
+#else /* defined(TGL_OS_WINDOWS) */
+THREAD_FUNC(itgl_input_worker, arg)
+{
+	TGLInput *const input = arg;
+	const HANDLE handles[2] = { input->stop_event, input->input_handle };
+	for (;;) {
+		const DWORD wait = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+		if (wait == WAIT_FAILED)
+			input->error = GetLastError();
+		if (wait != WAIT_OBJECT_0 + 1)
+			break;
+
+		INPUT_RECORD records[INPUT_READ_SIZE];
+		DWORD n;
+		if (!ReadConsoleInput(input->input_handle, records, INPUT_READ_SIZE, &n)) {
+			input->error = GetLastError();
+			break;
+		}
+		bool pushed = true;
+		DWORD i;
+		for (i = 0; i < n && pushed; i++) {
+			switch (records[i].EventType) {
+			case KEY_EVENT:
+				if (records[i].Event.KeyEvent.bKeyDown)
+					pushed = itgl_input_push_key(input, records[i].Event.KeyEvent.uChar.AsciiChar);
+				break;
+			case MOUSE_EVENT:
+				pushed = itgl_input_push(input, (TGLInputEvent){
+					.type = TGL_INPUT_MOUSE,
+					.mouse = (TGLMouseEvent){
+						.button = itgl_windows_mouse_event_record_conv(records[i].Event.MouseEvent, &input->mouse_state),
+						.x = records[i].Event.MouseEvent.dwMousePosition.X,
+						.y = records[i].Event.MouseEvent.dwMousePosition.Y,
+					},
+				});
+				break;
+			case WINDOW_BUFFER_SIZE_EVENT:
+				pushed = itgl_input_push(input, (TGLInputEvent){
+					.type = TGL_INPUT_RESIZE,
+					.col = records[i].Event.WindowBufferSizeEvent.dwSize.X,
+					.row = records[i].Event.WindowBufferSizeEvent.dwSize.Y,
+				});
+			}
+		}
+		if (!pushed)
+			break;
 	}
+	THREAD_FUNC_RETURN;
+}
+#endif
 
-	float half_width = tgl->width * .5f;
-	float half_height = tgl->height * .5f;
+/* Restores input mode and releases what tglutil_input_start acquired */
+void itgl_input_free(TGLInput *const input)
+{
+#ifdef __unix__
+	itgl_input_wake_fd = -1;
+	if (input->tty) {
+		struct termios t;
+		if (!tcgetattr(STDIN_FILENO, &t)) {
+			t.c_lflag = (t.c_lflag & ~(ICANON)) | (input->lflag & ICANON);
+			t.c_cc[VMIN] = input->vmin;
+			t.c_cc[VTIME] = input->vtime;
+			(void)tcsetattr(STDIN_FILENO, TCSANOW, &t);
+		}
+	}
+	if (input->wake[0] >= 0)
+		close(input->wake[0]);
+	if (input->wake[1] >= 0)
+		close(input->wake[1]);
+#else /* defined(TGL_OS_WINDOWS) */
+	if (input->mode)
+		SetConsoleMode(input->input_handle, input->mode);
+	if (input->stop_event)
+		CloseHandle(input->stop_event);
+#endif
+	TGL_FREE(input);
+	itgl_input_active = false;
+}
 
-	/* Drawing */
-	for (i = 0; i < n_cur_stage; i++) {
-		TGLVec3 v[3];
-		unsigned j;
-		for (j = 0; j < 3; j++)
-			tgl_mul3s(trig_buffer[i + buffer_offset].verts[j], 1.f / trig_buffer[i + buffer_offset].verts[j][3], v[j]);
-
-		if (fill)
-			tgl_triangle_fill(tgl,
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[0][0]),
-					.y = MAP_COORD(half_height, v[0][1]),
-					.z = v[0][2],
-					.u = trig_buffer[i + buffer_offset].uv[0][0],
-					.v = trig_buffer[i + buffer_offset].uv[0][1],
-				},
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[1][0]),
-					.y = MAP_COORD(half_height, v[1][1]),
-					.z = v[1][2],
-					.u = trig_buffer[i + buffer_offset].uv[1][0],
-					.v = trig_buffer[i + buffer_offset].uv[1][1],
-				},
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[2][0]),
-					.y = MAP_COORD(half_height, v[2][1]),
-					.z = v[2][2],
-					.u = trig_buffer[i + buffer_offset].uv[2][0],
-					.v = trig_buffer[i + buffer_offset].uv[2][1],
-				},
-				frag_shader,
-				frag_data);
+TGLInput *tglutil_input_start(const size_t capacity)
+{
+	if (!capacity || capacity > (UINT32_MAX >> 1) + 1u) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (itgl_input_active) {
+		errno = EBUSY;
+		return NULL;
+	}
+	uint32_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	TGLInput *const input = TGL_MALLOC(sizeof(TGLInput) + size * sizeof(TGLInputEvent));
+	if (!input)
+		return NULL;
+	itgl_input_active = true;
+	input->head = 0;
+	input->tail = 0;
+	input->mask = size - 1u;
+	input->quit = 0;
+	input->error = 0;
+#ifdef __unix__
+	input->parser.n_pending = 0;
+	input->parser.n_keys = 0;
+	input->tty = false;
+	input->wake[0] = -1;
+	input->wake[1] = -1;
+	/* Wake pipe does not block, so the SIGWINCH handler never waits on it */
+	if (pipe(input->wake)
+		|| fcntl(input->wake[0], F_SETFL, O_NONBLOCK)
+		|| fcntl(input->wake[1], F_SETFL, O_NONBLOCK)
+		|| itgl_sigwinch_install()) {
+		const int err = errno;
+		itgl_input_free(input);
+		errno = err;
+		return NULL;
+	}
+	/* Disable canonical mode, so input is read as it is typed */
+	struct termios t;
+	if (isatty(STDIN_FILENO)) {
+		if (tcgetattr(STDIN_FILENO, &t)) {
+			const int err = errno;
+			itgl_input_free(input);
+			errno = err;
+			return NULL;
+		}
+		input->lflag = t.c_lflag;
+		input->vmin = t.c_cc[VMIN];
+		input->vtime = t.c_cc[VTIME];
+		t.c_lflag &= ~(ICANON);
+		t.c_cc[VMIN] = 1;
+		t.c_cc[VTIME] = 0;
+		if (tcsetattr(STDIN_FILENO, TCSANOW, &t)) {
+			const int err = errno;
+			itgl_input_free(input);
+			errno = err;
+			return NULL;
+		}
+		input->tty = true;
+	}
+	itgl_input_wake_fd = input->wake[1];
+	const int err = pthread_create(&input->handle, NULL, &itgl_input_worker, input);
+#else /* defined(TGL_OS_WINDOWS) */
+	input->mode = 0;
+	input->mouse_state = 0x00;
+	input->input_handle = GetStdHandle(STD_INPUT_HANDLE);
+	input->stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	DWORD mode;
+	if (input->input_handle == INVALID_HANDLE_VALUE
+		|| !input->stop_event
+		|| !GetConsoleMode(input->input_handle, &mode)
+		|| !SetConsoleMode(input->input_handle, (mode & ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT)) | ENABLE_WINDOW_INPUT)) {
+		const int err = GetLastError();
+		itgl_input_free(input);
+		errno = err;
+		return NULL;
+	}
+	input->mode = mode;
+	input->handle = CreateThread(NULL, 0, &itgl_input_worker, input, 0, NULL);
+	const int err = input->handle ? 0 : GetLastError();
+#endif
+	if (err) {
+		itgl_input_free(input);
+		errno = err;
+		return NULL;
+	}
+	return input;
+}
+
+size_t tglutil_input_poll(TGLInput *const input, TGLInputEvent *const events, const size_t count)
+{
+	const uint32_t tail = input->tail;
+	const size_t n = MIN(count, (size_t)(ATOMIC_LOAD(&input->head) - tail));
+	size_t i;
+	for (i = 0; i < n; i++)
+		events[i] = input->events[(tail + i) & input->mask];
+	ATOMIC_STORE(&input->tail, tail + (uint32_t)n);
+	return n;
+}
+
+int tglutil_input_stop(TGLInput *const input)
+{
+	ATOMIC_STORE(&input->quit, 1u);
+#ifdef __unix__
+	const char byte = 0;
+	if (write(input->wake[1], &byte, 1) < 0) {
+		/* Pipe is full, so the thread is woken anyway */
+	}
+	pthread_join(input->handle, NULL);
+#else /* defined(TGL_OS_WINDOWS) */
+	SetEvent(input->stop_event);
+	WaitForSingleObject(input->handle, INFINITE);
+	CloseHandle(input->handle);
+#endif
+	const int err = input->error;
+	itgl_input_free(input);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+#endif /* TERMGL_THREADS */
+
+#endif /* TERMGLUTIL */
+
+#ifdef TERMGLMESH
+
+#ifndef TGL_OS_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define STL_HEADER_SIZE 84
+#define STL_VERTS_OFFSET 12
+
+/* Cache files hold this header, then vertices at verts_offset and indices at indices_offset, both multiples of TGLMESH_ALIGN */
+#define MESH_CACHE_MAGIC "TGLMESH"
+#define MESH_CACHE_VERSION 1
+
+typedef struct MeshCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t n_verts;
+	uint64_t n_indices;
+	uint64_t verts_offset;
+	uint64_t indices_offset;
+} MeshCacheHeader;
+
+static int itgl_mesh_map(TGLMesh *mesh, const char *path);
+static void *itgl_mesh_alloc(TGLMesh *mesh, size_t size);
+static inline uint32_t itgl_mesh_hash(const TGLVec3 vert);
+
+/* Maps the whole file at path to mesh->map, after clearing mesh */
+int itgl_mesh_map(TGLMesh *const mesh, const char *const path)
+{
+	*mesh = (TGLMesh){ 0 };
+#ifdef TGL_OS_WINDOWS
+	const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	WINDOWS_CALL(file == INVALID_HANDLE_VALUE, -1);
+	LARGE_INTEGER size = { 0 };
+	const bool sized = GetFileSizeEx(file, &size);
+	/* Empty files cannot be mapped, and are not meshes */
+	const bool mappable = sized && size.QuadPart > 0 && (uint64_t)size.QuadPart <= SIZE_MAX;
+	HANDLE mapping = NULL;
+	if (mappable) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
+			mesh->map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	const DWORD err = GetLastError();
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+	if (!mesh->map) {
+		errno = (sized && !mappable) ? EINVAL : (int)err;
+		return -1;
+	}
+	mesh->map_size = size.QuadPart;
+#else
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (!fstat(fd, &st)) {
+		/* Empty files cannot be mapped, and are not meshes */
+		if (st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX)
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 		else
-			tgl_triangle(tgl,
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[0][0]),
-					.y = MAP_COORD(half_height, v[0][1]),
-					.z = v[0][2],
-					.u = trig_buffer[i + buffer_offset].uv[0][0],
-					.v = trig_buffer[i + buffer_offset].uv[0][1],
-				},
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[1][0]),
-					.y = MAP_COORD(half_height, v[1][1]),
-					.z = v[1][2],
-					.u = trig_buffer[i + buffer_offset].uv[1][0],
-					.v = trig_buffer[i + buffer_offset].uv[1][1],
-				},
-				(TGLVert){
-					.x = MAP_COORD(half_width, v[2][0]),
-					.y = MAP_COORD(half_height, v[2][1]),
-					.z = v[2][2],
-					.u = trig_buffer[i + buffer_offset].uv[2][0],
-					.v = trig_buffer[i + buffer_offset].uv[2][1],
-				},
-				frag_shader,
-				frag_data);
+			errno = EINVAL;
 	}
+	const int err = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		errno = err;
+		return -1;
+	}
+	mesh->map = map;
+	mesh->map_size = st.st_size;
+#endif
+	return 0;
 }
 
-void tgl_cull_face(TGL *const tgl, const uint8_t settings)
+/* Allocates mesh->alloc with size bytes starting at an address aligned to TGLMESH_ALIGN, which is returned */
+void *itgl_mesh_alloc(TGLMesh *const mesh, const size_t size)
 {
-	tgl->settings = (tgl->settings & ~TGL_CULL_BIT) | (XOR(settings & TGL_CULL_FACE_BIT, settings & TGL_WINDING_BIT) ? TGL_CULL_BIT : 0);
+	mesh->alloc = TGL_MALLOC(size + TGLMESH_ALIGN - 1);
+	if (!mesh->alloc)
+		return NULL;
+	return (void *)ALIGN_UP((uintptr_t)mesh->alloc, TGLMESH_ALIGN);
 }
 
-#endif /* TERMGL3D */
+inline uint32_t itgl_mesh_hash(const TGLVec3 vert)
+{
+	uint32_t bits[3];
+	memcpy(bits, vert, sizeof(bits));
+	uint32_t hash = bits[0] * 0x9E3779B1u;
+	hash = (hash ^ bits[1]) * 0x85EBCA77u;
+	hash = (hash ^ bits[2]) * 0xC2B2AE3Du;
+	return hash ^ (hash >> 16);
+}
 
-#ifdef TERMGLUTIL
+int tglmesh_load_stl(TGLMesh *const mesh, const char *const path)
+{
+	CALL(itgl_mesh_map(mesh, path), -1);
+	/* ASCII STL is rejected by its size, as it starts with "solid", which some binary files do too */
+	const unsigned char *const map = mesh->map;
+	uint32_t n_triangles = 0;
+	if (mesh->map_size >= STL_HEADER_SIZE)
+		memcpy(&n_triangles, map + 80, sizeof(uint32_t));
+	if (mesh->map_size < STL_HEADER_SIZE || (mesh->map_size - STL_HEADER_SIZE) / TGLMESH_STL_STRIDE < n_triangles) {
+		tglmesh_free(mesh);
+		errno = EINVAL;
+		return -1;
+	}
+	mesh->stl = map + STL_HEADER_SIZE;
+	mesh->n_triangles = n_triangles;
+	return 0;
+}
 
-#ifdef __unix__
-#include <sys/ioctl.h>
-#include <termios.h>
-#include <unistd.h>
+void tglmesh_stl_triangle(const TGLMesh *const mesh, const size_t i, TGLTriangle out)
+{
+	memcpy(out, mesh->stl + i * TGLMESH_STL_STRIDE + STL_VERTS_OFFSET, sizeof(TGLTriangle));
+}
+
+int tglmesh_index(TGLMesh *const mesh)
+{
+	if (mesh->verts)
+		return 0;
+	if (mesh->n_triangles > UINT32_MAX / 3) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+	const size_t n_indices = mesh->n_triangles * 3;
+
+	/* Open addressing table of vertex indices, at most half full */
+	size_t table_size = 16;
+	while (table_size < 2 * n_indices)
+		table_size *= 2;
+	const size_t mask = table_size - 1;
+	uint32_t *const table = TGL_MALLOC(sizeof(uint32_t) * table_size);
+	/* Vertices are gathered with space for all of them being unique, then copied into a block of the exact size */
+	TGLVec3 *const verts = TGL_MALLOC(sizeof(TGLVec3) * MAX(n_indices, 1u));
+	uint32_t *const indices = TGL_MALLOC(sizeof(uint32_t) * MAX(n_indices, 1u));
+	if (!table || !verts || !indices) {
+		TGL_FREE(table);
+		TGL_FREE(verts);
+		TGL_FREE(indices);
+		return -1;
+	}
+	memset(table, 0xFF, sizeof(uint32_t) * table_size);
+
+	uint32_t n_verts = 0;
+	size_t i;
+	for (i = 0; i < n_indices; i++) {
+		TGLVec3 vert;
+		memcpy(vert, mesh->stl + (i / 3) * TGLMESH_STL_STRIDE + STL_VERTS_OFFSET + (i % 3) * sizeof(TGLVec3), sizeof(TGLVec3));
+		/* -0 and 0 are the same vertex */
+		vert[0] += 0.f;
+		vert[1] += 0.f;
+		vert[2] += 0.f;
+		size_t slot = itgl_mesh_hash(vert) & mask;
+		while (table[slot] != UINT32_MAX && memcmp(verts[table[slot]], vert, sizeof(TGLVec3)))
+			slot = (slot + 1) & mask;
+		if (table[slot] == UINT32_MAX) {
+			memcpy(verts[n_verts], vert, sizeof(TGLVec3));
+			table[slot] = n_verts++;
+		}
+		indices[i] = table[slot];
+	}
+	TGL_FREE(table);
+
+	const size_t verts_size = ALIGN_UP(sizeof(TGLVec3) * n_verts, TGLMESH_ALIGN);
+	unsigned char *const block = itgl_mesh_alloc(mesh, verts_size + sizeof(uint32_t) * n_indices);
+	if (block) {
+		memcpy(block, verts, sizeof(TGLVec3) * n_verts);
+		memcpy(block + verts_size, indices, sizeof(uint32_t) * n_indices);
+		mesh->verts = (const TGLVec3 *)block;
+		mesh->n_verts = n_verts;
+		mesh->indices = (const uint32_t *)(block + verts_size);
+		mesh->n_indices = n_indices;
+	}
+	TGL_FREE(verts);
+	TGL_FREE(indices);
+	return block ? 0 : -1;
+}
+
+int tglmesh_save_cache(const TGLMesh *const mesh, const char *const path)
+{
+	if (!mesh->verts) {
+		errno = EINVAL;
+		return -1;
+	}
+	const size_t verts_size = sizeof(TGLVec3) * mesh->n_verts;
+	MeshCacheHeader header = {
+		.magic = MESH_CACHE_MAGIC,
+		.version = MESH_CACHE_VERSION,
+		.n_verts = mesh->n_verts,
+		.n_indices = mesh->n_indices,
+		.verts_offset = TGLMESH_ALIGN,
+		.indices_offset = TGLMESH_ALIGN + ALIGN_UP(verts_size, TGLMESH_ALIGN),
+	};
+	static const char padding[TGLMESH_ALIGN] = { 0 };
+
+	FILE *const file = fopen(path, "wb");
+	if (!file)
+		return -1;
+	const bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(padding, TGLMESH_ALIGN - sizeof(header), 1, file) == 1
+		&& fwrite(mesh->verts, sizeof(TGLVec3), mesh->n_verts, file) == mesh->n_verts
+		&& fwrite(padding, 1, header.indices_offset - header.verts_offset - verts_size, file) == header.indices_offset - header.verts_offset - verts_size
+		&& fwrite(mesh->indices, sizeof(uint32_t), mesh->n_indices, file) == mesh->n_indices;
+	const int err = errno;
+	if (fclose(file) || !ok) {
+		if (!ok)
+			errno = err;
+		(void)remove(path);
+		return -1;
+	}
+	return 0;
+}
+
+int tglmesh_load_cache(TGLMesh *const mesh, const char *const path)
+{
+	CALL(itgl_mesh_map(mesh, path), -1);
+	const unsigned char *const map = mesh->map;
+	const size_t size = mesh->map_size;
+	MeshCacheHeader header;
+	bool valid = size >= sizeof(header);
+	if (valid) {
+		memcpy(&header, map, sizeof(header));
+		/* Offsets are checked against the size without overflowing, and indices against the number of vertices */
+		valid = !memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic))
+			&& header.version == MESH_CACHE_VERSION
+			&& header.n_indices % 3 == 0
+			&& header.n_verts <= UINT32_MAX
+			&& header.verts_offset % TGLMESH_ALIGN == 0
+			&& header.indices_offset % TGLMESH_ALIGN == 0
+			&& header.verts_offset >= sizeof(header)
+			&& header.verts_offset <= size
+			&& header.n_verts <= (size - header.verts_offset) / sizeof(TGLVec3)
+			&& header.indices_offset <= size
+			&& header.n_indices <= (size - header.indices_offset) / sizeof(uint32_t);
+	}
+	if (valid) {
+		mesh->verts = (const TGLVec3 *)(map + header.verts_offset);
+		mesh->n_verts = header.n_verts;
+		mesh->indices = (const uint32_t *)(map + header.indices_offset);
+		mesh->n_indices = header.n_indices;
+		mesh->n_triangles = header.n_indices / 3;
+		size_t i;
+		for (i = 0; i < mesh->n_indices && valid; i++)
+			valid = mesh->indices[i] < mesh->n_verts;
+	}
+	if (!valid) {
+		tglmesh_free(mesh);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+void tglmesh_free(TGLMesh *const mesh)
+{
+	if (mesh->map) {
+#ifdef TGL_OS_WINDOWS
+		UnmapViewOfFile(mesh->map);
+#else
+		munmap(mesh->map, mesh->map_size);
 #endif
+	}
+	TGL_FREE(mesh->alloc);
+	*mesh = (TGLMesh){ 0 };
+}
 
-#ifdef __unix__
-static inline uint8_t itgl_xterm_button_conv(uint8_t button);
+#endif /* TERMGLMESH */
+
+#ifdef TERMGL_RECORD
+
+/* Recordings start with RECORD_MAGIC, RECORD_VERSION, then width and height as 16-bit little-endian
+ * Each frame is the time since the previous frame in nanoseconds, the length of its delta, the length of the delta compressed by itgl_lz_compress or 0 if it is stored uncompressed, all as varints, then the delta
+ * A delta is a sequence of runs of changed cells: the number of unchanged cells before the run and the number of cells in it as varints, then each cell as its char and the varint code of its color
+ * A code below the size of the palette indexes it. A code equal to it is followed by a color which is added to the palette, and RECORD_PALETTE_MAX by a color which is not
+ **/
+#define RECORD_MAGIC "TGLR"
+#define RECORD_VERSION 1
+#define RECORD_HEADER_SIZE 9
+#define RECORD_COLOR_SIZE 8
+#define RECORD_PALETTE_MAX 4096u
+#define RECORD_PALETTE_HASH_BITS 13 /* twice as many slots as RECORD_PALETTE_MAX */
+#define RECORD_PALETTE_HASH (1u << RECORD_PALETTE_HASH_BITS)
+#define VARINT_MAX 10 /* bytes of a 64-bit varint */
+#define RECORD_BLOCK 64 /* cells compared at once when encoding */
+/* Largest delta of a frame: a run per cell, each with a color which is not in the palette */
+#define RECORD_DELTA_MAX(size) ((size_t)(size) * (2u * 5u + 1u + 2u + RECORD_COLOR_SIZE))
+
+/* LZ77 with a single-entry hash table of positions of 4-byte sequences
+ * Compressed data is a sequence of the number of literals, the literals, then the length of a match minus LZ_MIN_MATCH - 1 and its offset minus 1, all as varints. A match length of 0 ends the data
+ **/
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+struct TGLRecorder {
+	unsigned width;
+	unsigned height;
+	unsigned frame_size;
+	TGLOutputCallback *callback;
+	void *ctx;
+	Frame prev_frame_buffer; /* last encoded frame, which starts cleared */
+	uint64_t time_prev; /* of last encoded frame */
+	uint64_t n_frames;
+	uint32_t n_colors;
+	uint16_t palette_hash[RECORD_PALETTE_HASH]; /* index + 1 of palette colors, or 0 */
+	TGLPixFmt palette[RECORD_PALETTE_MAX];
+	uint32_t lz_table[1u << LZ_HASH_BITS];
+	uint8_t *delta; /* RECORD_DELTA_MAX bytes */
+	uint8_t *packed; /* RECORD_DELTA_MAX bytes */
+	int error; /* errno of last failed write of the encoding thread */
+#ifdef TERMGL_THREADS
+	/* Frames are encoded by a thread, like frames printed by Presenter, but none are dropped */
+	Thread handle;
+	Mutex mutex;
+	Cond cond; /* broadcast when a frame is submitted or taken, and when quitting */
+	Frame pending; /* copy of frame_buffer made by tgl_recorder_frame */
+	Frame frame; /* frame being encoded */
+	uint64_t pending_time;
+	bool pending_valid;
+	bool quit;
+#endif
+};
+
+struct TGLPlayer {
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	unsigned width;
+	unsigned height;
+	unsigned frame_size;
+	uint64_t time_ns;
+	uint32_t n_colors;
+	TGLPixFmt palette[RECORD_PALETTE_MAX];
+	uint8_t *delta; /* RECORD_DELTA_MAX bytes */
+};
+
+static int itgl_recorder_encode(TGLRecorder *recorder, const Frame *frame, uint64_t time);
+static size_t itgl_recorder_color(TGLRecorder *recorder, uint8_t *buf, size_t pos, TGLPixFmt color);
+static int itgl_recorder_write(TGLRecorder *recorder, const void *buf, size_t len);
+#ifdef TERMGL_THREADS
+static THREAD_FUNC(itgl_recorder_worker, arg);
+#endif
+static int itgl_player_apply(TGLPlayer *player, TGL *tgl, const uint8_t *delta, size_t len);
+static void itgl_player_dirty(TGL *tgl, unsigned begin, unsigned end);
+static int itgl_asciicast_escape(BroadcastChunk *chunk, const char *str, size_t len);
+static size_t itgl_lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity, uint32_t *table);
+static int itgl_lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t size);
+static inline size_t itgl_varint_write(uint8_t *buf, size_t pos, uint64_t value);
+static int itgl_varint_read(const uint8_t *buf, size_t len, size_t *pos, uint64_t *value);
+static inline void itgl_color_write(uint8_t *buf, TGLPixFmt color);
+static inline TGLPixFmt itgl_color_read(const uint8_t *buf);
+
+TGLRecorder *tgl_recorder_create(const TGL *const tgl, TGLOutputCallback *const callback, void *const ctx)
+{
+	if (tgl->width > UINT16_MAX || tgl->height > UINT16_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+#ifdef TERMGL_THREADS
+	const unsigned n_frames = 3;
+#else
+	const unsigned n_frames = 1;
+#endif
+	/* Frames and buffers are allocated in the same block, after the struct */
+	const size_t frame_bytes = FRAME_BYTES(tgl->frame_size), delta_bytes = RECORD_DELTA_MAX(tgl->frame_size);
+	TGLRecorder *const recorder = TGL_MALLOC(sizeof(TGLRecorder) + frame_bytes * n_frames + delta_bytes * 2u);
+	if (!recorder)
+		return NULL;
+	char *const mem = (char *)(recorder + 1);
+	recorder->width = tgl->width;
+	recorder->height = tgl->height;
+	recorder->frame_size = tgl->frame_size;
+	recorder->callback = callback;
+	recorder->ctx = ctx;
+	itgl_frame_init(&recorder->prev_frame_buffer, mem, tgl->frame_size);
+	/* Frames are decoded onto a cleared frame buffer */
+	memset(recorder->prev_frame_buffer.colors, 0, sizeof(TGLPixFmt) * tgl->frame_size);
+	memset(recorder->prev_frame_buffer.chars, ' ', tgl->frame_size);
+	recorder->time_prev = 0;
+	recorder->n_frames = 0;
+	recorder->n_colors = 0;
+	memset(recorder->palette_hash, 0, sizeof(recorder->palette_hash));
+	recorder->delta = (uint8_t *)mem + frame_bytes * n_frames;
+	recorder->packed = recorder->delta + delta_bytes;
+	recorder->error = 0;
+
+	const uint8_t header[RECORD_HEADER_SIZE] = {
+		RECORD_MAGIC[0], RECORD_MAGIC[1], RECORD_MAGIC[2], RECORD_MAGIC[3], RECORD_VERSION,
+		tgl->width & 0xff, tgl->width >> 8, tgl->height & 0xff, tgl->height >> 8
+	};
+	if (itgl_recorder_write(recorder, header, sizeof(header))) {
+		TGL_FREE(recorder);
+		return NULL;
+	}
+
+#ifdef TERMGL_THREADS
+	itgl_frame_init(&recorder->pending, mem + frame_bytes, tgl->frame_size);
+	itgl_frame_init(&recorder->frame, mem + 2u * frame_bytes, tgl->frame_size);
+	recorder->pending_valid = false;
+	recorder->quit = false;
+	if (MUTEX_INIT(&recorder->mutex)) {
+		TGL_FREE(recorder);
+		return NULL;
+	}
+	if (COND_INIT(&recorder->cond)) {
+		MUTEX_DESTROY(&recorder->mutex);
+		TGL_FREE(recorder);
+		return NULL;
+	}
+#ifdef TGL_OS_WINDOWS
+	recorder->handle = CreateThread(NULL, 0, &itgl_recorder_worker, recorder, 0, NULL);
+	const int err = recorder->handle ? 0 : GetLastError();
+#else
+	const int err = pthread_create(&recorder->handle, NULL, &itgl_recorder_worker, recorder);
+#endif
+	if (err) {
+		COND_DESTROY(&recorder->cond);
+		MUTEX_DESTROY(&recorder->mutex);
+		TGL_FREE(recorder);
+		errno = err;
+		return NULL;
+	}
+#endif
+	return recorder;
+}
 
-inline uint8_t itgl_xterm_button_conv(const uint8_t button)
+int tgl_recorder_frame(TGLRecorder *const recorder, const TGL *const tgl)
 {
-	const uint8_t mod = (button & 0x40) ? TGL_MOUSE_WHEEL_OR_MOVEMENT : 0x00;
-	switch ((button - 32) & 0x03) {
-	case 0x00:
-		return TGL_MOUSE_1 | mod;
-	case 0x01:
-		return TGL_MOUSE_3 | mod;
-	case 0x02:
-		return TGL_MOUSE_2 | mod;
-	case 0x03:
-		return TGL_MOUSE_RELEASE | mod;
+	if (tgl->width != recorder->width || tgl->height != recorder->height) {
+		errno = EINVAL;
+		return -1;
+	}
+	const uint64_t now = itgl_time_ns();
+#ifdef TERMGL_THREADS
+	MUTEX_LOCK(&recorder->mutex);
+	while (recorder->pending_valid)
+		COND_WAIT(&recorder->cond, &recorder->mutex);
+	itgl_frame_copy(&recorder->pending, &tgl->frame_buffer, tgl->frame_size);
+	recorder->pending_time = now;
+	recorder->pending_valid = true;
+	const int err = recorder->error;
+	recorder->error = 0;
+	COND_BROADCAST(&recorder->cond);
+	MUTEX_UNLOCK(&recorder->mutex);
+	if (err) {
+		errno = err;
+		return -1;
 	}
-	TGL_UNREACHABLE();
 	return 0;
+#else
+	return itgl_recorder_encode(recorder, &tgl->frame_buffer, now);
+#endif
 }
-#endif /* __unix__ */
-
-#ifdef TGL_OS_WINDOWS
-static inline uint8_t itgl_windows_mouse_event_record_conv(MOUSE_EVENT_RECORD record, uint8_t *state);
 
-inline uint8_t itgl_windows_mouse_event_record_conv(const MOUSE_EVENT_RECORD record, uint8_t *const state)
+int tgl_recorder_delete(TGLRecorder *const recorder)
 {
-	if (record.dwEventFlags & (MOUSE_WHEELED | 0x0008 | MOUSE_MOVED))
-		return TGL_MOUSE_WHEEL_OR_MOVEMENT | TGL_MOUSE_UNKNOWN;
-	const uint8_t changed = *state ^ record.dwButtonState;
-	if (changed & *state) {
-		*state = record.dwButtonState;
-		return TGL_MOUSE_RELEASE;
+	if (!recorder)
+		return 0;
+#ifdef TERMGL_THREADS
+	MUTEX_LOCK(&recorder->mutex);
+	recorder->quit = true;
+	COND_BROADCAST(&recorder->cond);
+	MUTEX_UNLOCK(&recorder->mutex);
+#ifdef TGL_OS_WINDOWS
+	WaitForSingleObject(recorder->handle, INFINITE);
+	CloseHandle(recorder->handle);
+#else
+	pthread_join(recorder->handle, NULL);
+#endif
+	COND_DESTROY(&recorder->cond);
+	MUTEX_DESTROY(&recorder->mutex);
+#endif
+	const int err = recorder->error;
+	TGL_FREE(recorder);
+	if (err) {
+		errno = err;
+		return -1;
 	}
-	*state = record.dwButtonState;
-	if (changed & 0x01)
-		return TGL_MOUSE_1;
-	if (changed & 0x02)
-		return TGL_MOUSE_2;
-	if (changed & 0x04)
-		return TGL_MOUSE_3;
-	return TGL_MOUSE_WHEEL_OR_MOVEMENT | TGL_MOUSE_UNKNOWN;
+	return 0;
 }
-#endif /* TGL_OS_WINDOWS */
 
-TGL_SSIZE_T tglutil_read(char *const buf, const size_t count, TGLMouseEvent *const event_buf, const size_t count_events, size_t *const count_read_events)
+#ifdef TERMGL_THREADS
+/* Encodes each pending frame. The pending frame is swapped out before encoding, so the next one can be submitted meanwhile */
+THREAD_FUNC(itgl_recorder_worker, arg)
 {
-#ifdef __unix__
-	struct termios oldt, newt;
-
-	/* Disable canonical mode */
-	CALL(tcgetattr(STDIN_FILENO, &oldt), -2);
-	newt = oldt;
-	newt.c_lflag &= ~(ICANON);
-	newt.c_cc[VMIN] = 0;
-	newt.c_cc[VTIME] = 0;
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &newt), -3);
-
-	const TGL_SSIZE_T retval = read(2, buf, count);
-
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &oldt), -3);
+	TGLRecorder *const recorder = arg;
+	MUTEX_LOCK(&recorder->mutex);
+	while (true) {
+		while (!recorder->quit && !recorder->pending_valid)
+			COND_WAIT(&recorder->cond, &recorder->mutex);
+		if (!recorder->pending_valid)
+			break;
+		SWAP(Frame, recorder->pending, recorder->frame);
+		const uint64_t time = recorder->pending_time;
+		recorder->pending_valid = false;
+		COND_BROADCAST(&recorder->cond);
+		MUTEX_UNLOCK(&recorder->mutex);
 
-	/* Flush input buffer to prevent read of previous unread input */
-	CALL(tcflush(STDIN_FILENO, TCIFLUSH), -4);
+		const int err = itgl_recorder_encode(recorder, &recorder->frame, time) ? errno : 0;
 
-	if (!event_buf || retval <= 0)
-		return retval;
+		MUTEX_LOCK(&recorder->mutex);
+		if (err)
+			recorder->error = err;
+	}
+	MUTEX_UNLOCK(&recorder->mutex);
+	THREAD_FUNC_RETURN;
+}
+#endif
 
-	/* Parse mouse events */
-	*count_read_events = 0;
-	size_t rd, wr = 0;
-	for (rd = 0; rd < (size_t)retval; rd++) {
-		if (buf[rd] == '\033' && buf[rd + 1] == '[' && buf[rd + 2] == 'M') {
-			if (*count_read_events < count_events
-				&& ((buf[rd + 3] & 0x7f) == buf[rd + 3]))
-				event_buf[(*count_read_events)++] = (TGLMouseEvent){
-					.button = itgl_xterm_button_conv(buf[rd + 3]),
-					.x = buf[rd + 4] - 32,
-					.y = buf[rd + 5] - 32,
-				};
-			rd += 5;
+/* Writes frame as a delta from prev_frame_buffer, which is then updated */
+int itgl_recorder_encode(TGLRecorder *const recorder, const Frame *const frame, const uint64_t time)
+{
+	Frame *const prev = &recorder->prev_frame_buffer;
+	uint8_t *const delta = recorder->delta;
+	size_t len = 0;
+	unsigned i = 0, run_end = 0;
+	while (i < recorder->frame_size) {
+		/* Frames mostly stay the same, so unchanged blocks are skipped with memcmp */
+		if (recorder->frame_size - i >= RECORD_BLOCK && !memcmp(frame->chars + i, prev->chars + i, RECORD_BLOCK)
+			&& !memcmp(frame->colors + i, prev->colors + i, sizeof(TGLPixFmt) * RECORD_BLOCK)) {
+			i += RECORD_BLOCK;
+			continue;
+		}
+		if (frame->chars[i] == prev->chars[i] && PIXFMT_EQ(frame->colors[i], prev->colors[i])) {
+			i++;
 			continue;
 		}
-		buf[wr++] = buf[rd];
+		unsigned end = i + 1;
+		while (end < recorder->frame_size && (frame->chars[end] != prev->chars[end] || !PIXFMT_EQ(frame->colors[end], prev->colors[end])))
+			end++;
+		len = itgl_varint_write(delta, len, i - run_end);
+		len = itgl_varint_write(delta, len, end - i);
+		for (; i < end; i++) {
+			delta[len++] = (uint8_t)frame->chars[i];
+			len = itgl_recorder_color(recorder, delta, len, frame->colors[i]);
+			prev->chars[i] = frame->chars[i];
+			prev->colors[i] = frame->colors[i];
+		}
+		run_end = end;
 	}
 
-	return wr;
-#else /* defined(TGL_OS_WINDOWS) */
-	static uint8_t mouse_state = 0x00;
+	/* Deltas which do not get smaller are stored uncompressed */
+	const size_t packed_len = itgl_lz_compress(delta, len, recorder->packed, len, recorder->lz_table);
+	uint8_t header[3 * VARINT_MAX];
+	size_t header_len = itgl_varint_write(header, 0, recorder->n_frames ? time - recorder->time_prev : 0);
+	header_len = itgl_varint_write(header, header_len, len);
+	header_len = itgl_varint_write(header, header_len, packed_len);
+	recorder->time_prev = time;
+	recorder->n_frames++;
+	CALL(itgl_recorder_write(recorder, header, header_len), -1);
+	return itgl_recorder_write(recorder, packed_len ? recorder->packed : delta, packed_len ? packed_len : len);
+}
 
-	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
-	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, -1);
+/* Writes the code of color, and the color if it is not in the palette */
+size_t itgl_recorder_color(TGLRecorder *const recorder, uint8_t *const buf, size_t pos, const TGLPixFmt color)
+{
+	uint8_t key[RECORD_COLOR_SIZE];
+	itgl_color_write(key, color);
+	uint64_t hash;
+	memcpy(&hash, key, sizeof(hash));
+	unsigned slot = (unsigned)((hash * 0x9e3779b97f4a7c15u) >> (64 - RECORD_PALETTE_HASH_BITS));
+	while (recorder->palette_hash[slot]) {
+		const unsigned idx = recorder->palette_hash[slot] - 1u;
+		if (PIXFMT_EQ(recorder->palette[idx], color))
+			return itgl_varint_write(buf, pos, idx);
+		slot = (slot + 1u) & (RECORD_PALETTE_HASH - 1u);
+	}
+	if (recorder->n_colors < RECORD_PALETTE_MAX) {
+		pos = itgl_varint_write(buf, pos, recorder->n_colors);
+		recorder->palette[recorder->n_colors] = color;
+		recorder->palette_hash[slot] = (uint16_t)++recorder->n_colors;
+	} else {
+		pos = itgl_varint_write(buf, pos, RECORD_PALETTE_MAX);
+	}
+	memcpy(buf + pos, key, RECORD_COLOR_SIZE);
+	return pos + RECORD_COLOR_SIZE;
+}
 
-	/* Disable canonical mode */
-	DWORD old_mode, new_mode;
-	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &old_mode), -1);
-	new_mode = old_mode;
-	new_mode &= ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT);
-	WINDOWS_CALL(!SetConsoleMode(hInputHandle, new_mode), -1);
+/* Errors of callbacks which do not set errno are reported as EIO */
+int itgl_recorder_write(TGLRecorder *const recorder, const void *const buf, const size_t len)
+{
+	errno = 0;
+	if (recorder->callback(buf, len, recorder->ctx)) {
+		if (!errno)
+			errno = EIO;
+		return -1;
+	}
+	return 0;
+}
 
-	DWORD event_cnt;
-	WINDOWS_CALL(!GetNumberOfConsoleInputEvents(hInputHandle, &event_cnt), -1);
+TGLPlayer *tgl_player_create(const void *const data, const size_t len)
+{
+	const uint8_t *const header = data;
+	if (len < RECORD_HEADER_SIZE || memcmp(header, RECORD_MAGIC, 4) || header[4] != RECORD_VERSION) {
+		errno = EINVAL;
+		return NULL;
+	}
+	const unsigned width = header[5] | (unsigned)header[6] << 8, height = header[7] | (unsigned)header[8] << 8;
+	TGLPlayer *const player = TGL_MALLOC(sizeof(TGLPlayer) + RECORD_DELTA_MAX(width * height));
+	if (!player)
+		return NULL;
+	player->data = data;
+	player->len = len;
+	player->pos = RECORD_HEADER_SIZE;
+	player->width = width;
+	player->height = height;
+	player->frame_size = width * height;
+	player->time_ns = 0;
+	player->n_colors = 0;
+	player->delta = (uint8_t *)(player + 1);
+	return player;
+}
 
-	if (count_events)
-		*count_read_events = 0;
+void tgl_player_delete(TGLPlayer *const player)
+{
+	TGL_FREE(player);
+}
 
-	/* ReadConsole is blocking so must manually process events */
-	size_t retval = 0;
-	if (event_cnt) {
-		INPUT_RECORD input_records[128];
-		WINDOWS_CALL(!ReadConsoleInput(hInputHandle, input_records, 32, &event_cnt), -1);
+void tgl_player_size(const TGLPlayer *const player, unsigned *const width, unsigned *const height)
+{
+	*width = player->width;
+	*height = player->height;
+}
 
-		DWORD i;
-		for (i = 0; i < event_cnt; i++) {
-			switch (input_records[i].EventType) {
-			case KEY_EVENT:
-				if (input_records[i].Event.KeyEvent.bKeyDown && retval < count)
-					buf[retval++] = input_records[i].Event.KeyEvent.uChar.AsciiChar;
+int tgl_player_next(TGLPlayer *const player, TGL *const tgl, uint64_t *const time_ns)
+{
+	if (tgl->width != player->width || tgl->height != player->height) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (player->pos == player->len)
+		return 0;
+	size_t pos = player->pos;
+	uint64_t time, len, packed_len;
+	if (itgl_varint_read(player->data, player->len, &pos, &time)
+		|| itgl_varint_read(player->data, player->len, &pos, &len)
+		|| itgl_varint_read(player->data, player->len, &pos, &packed_len)
+		|| len > RECORD_DELTA_MAX(player->frame_size)
+		|| (packed_len ? packed_len : len) > player->len - pos) {
+		errno = EINVAL;
+		return -1;
+	}
+	const uint8_t *delta = player->data + pos;
+	if (packed_len) {
+		if (itgl_lz_decompress(delta, packed_len, player->delta, len)) {
+			errno = EINVAL;
+			return -1;
+		}
+		delta = player->delta;
+	}
+	CALL(itgl_player_apply(player, tgl, delta, len), -1);
+	player->pos = pos + (packed_len ? packed_len : len);
+	player->time_ns += time;
+	*time_ns = player->time_ns;
+	return 1;
+}
+
+/* Writes runs of changed cells of delta into frame_buffer of tgl */
+int itgl_player_apply(TGLPlayer *const player, TGL *const tgl, const uint8_t *const delta, const size_t len)
+{
+	size_t pos = 0;
+	uint64_t i = 0;
+	while (pos < len) {
+		uint64_t skip, count;
+		if (itgl_varint_read(delta, len, &pos, &skip) || itgl_varint_read(delta, len, &pos, &count)
+			|| !count || skip > player->frame_size - i || count > player->frame_size - i - skip) {
+			errno = EINVAL;
+			return -1;
+		}
+		i += skip;
+		const uint64_t end = i + count;
+		itgl_player_dirty(tgl, (unsigned)i, (unsigned)end);
+		for (; i < end; i++) {
+			uint64_t code;
+			if (pos == len)
 				break;
-			case MOUSE_EVENT:
-				if (event_buf && *count_read_events < count_events)
-					event_buf[(*count_read_events)++] = (TGLMouseEvent){
-						.button = itgl_windows_mouse_event_record_conv(input_records[i].Event.MouseEvent, &mouse_state),
-						.x = input_records[i].Event.MouseEvent.dwMousePosition.X,
-						.y = input_records[i].Event.MouseEvent.dwMousePosition.Y,
-					};
+			const char c = (char)delta[pos++];
+			if (itgl_varint_read(delta, len, &pos, &code) || code > RECORD_PALETTE_MAX || (code > player->n_colors && code < RECORD_PALETTE_MAX))
+				break;
+			TGLPixFmt color;
+			if (code < player->n_colors) {
+				color = player->palette[code];
+			} else {
+				if (len - pos < RECORD_COLOR_SIZE)
+					break;
+				color = itgl_pixfmt_norm(itgl_color_read(delta + pos));
+				pos += RECORD_COLOR_SIZE;
+				if (code < RECORD_PALETTE_MAX)
+					player->palette[player->n_colors++] = color;
 			}
+			tgl->frame_buffer.chars[i] = c;
+			tgl->frame_buffer.colors[i] = color;
+		}
+		if (i < end) {
+			errno = EINVAL;
+			return -1;
 		}
 	}
-
-	WINDOWS_CALL(!SetConsoleMode(hInputHandle, old_mode), -1);
-#endif
-	return retval;
+	return 0;
 }
 
-int tglutil_get_console_size(unsigned *const col, unsigned *const row, const bool screen_buffer)
+/* Records that cells begin to end - 1, in order from the upper left, were drawn */
+void itgl_player_dirty(TGL *const tgl, const unsigned begin, const unsigned end)
 {
-#ifdef __unix__
-	(void)screen_buffer;
-	struct winsize w;
-	const int retval = ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-	*col = w.ws_col;
-	*row = w.ws_row;
-	return retval;
-#else /* defined(TGL_OS_WINDOWS) */
-	const HANDLE hOutputHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-	WINDOWS_CALL(hOutputHandle == INVALID_HANDLE_VALUE, -1);
-
-	CONSOLE_SCREEN_BUFFER_INFO csbi;
-	WINDOWS_CALL(!GetConsoleScreenBufferInfo(hOutputHandle, &csbi), -1);
-	if (screen_buffer) {
-		*col = csbi.dwSize.X;
-		*row = csbi.dwSize.Y;
-	} else {
-		*col = csbi.srWindow.Right - csbi.srWindow.Left + 1;
-		*row = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+	const unsigned y0 = begin / tgl->width, y1 = (end - 1u) / tgl->width;
+	const int x0 = begin % tgl->width, x1 = (end - 1u) % tgl->width;
+	if (y0 == y1) {
+		itgl_dirty_rect(tgl, x0, y0, x1, y0);
+		return;
 	}
-	return 0;
+	itgl_dirty_rect(tgl, x0, y0, tgl->max_x, y0);
+	if (y1 > y0 + 1u)
+		itgl_dirty_rect(tgl, 0, y0 + 1u, tgl->max_x, y1 - 1u);
+	itgl_dirty_rect(tgl, 0, y1, x1, y1);
+}
+
+int tgl_player_asciicast(TGLPlayer *const player, TGL *const tgl, TGLOutputCallback *const callback, void *const ctx)
+{
+	if (!tgl->output_buffer_size
+#ifdef TERMGL_THREADS
+		|| tgl->presenter
 #endif
+	) {
+		errno = EINVAL;
+		return -1;
+	}
+	unsigned columns = tgl->width, rows = tgl->height;
+	if (tgl->settings & (TGL_HALF_BLOCK | TGL_BRAILLE)) {
+		columns = (columns + CELL_W(tgl->settings) - 1u) / CELL_W(tgl->settings);
+		rows = (rows + CELL_H(tgl->settings) - 1u) / CELL_H(tgl->settings);
+	}
+	if (tgl->settings & TGL_DOUBLE_CHARS)
+		columns *= 2u;
+	char header[64];
+	const int header_len = snprintf(header, sizeof(header), "{\"version\": 2, \"width\": %u, \"height\": %u}\n", columns, rows);
+	CALL(callback(header, header_len, ctx), -1);
+
+	/* Each frame is printed into output, then escaped into an event */
+	TGLOutputCallback *const output_callback = tgl->output_callback;
+	void *const output_ctx = tgl->output_ctx;
+	BroadcastChunk output = { 0 }, event = { 0 };
+	uint64_t time_ns;
+	int ret;
+	while ((ret = tgl_player_next(player, tgl, &time_ns)) > 0) {
+		output.len = 0;
+		tgl->output_callback = &itgl_broadcast_append;
+		tgl->output_ctx = &output;
+		ret = itgl_present(tgl);
+		tgl->output_callback = output_callback;
+		tgl->output_ctx = output_ctx;
+		if (ret)
+			break;
+		char prefix[48];
+		const int prefix_len = snprintf(prefix, sizeof(prefix), "[%.6f, \"o\", \"", (double)time_ns / 1e9);
+		event.len = 0;
+		ret = -1;
+		if (itgl_broadcast_append(prefix, prefix_len, &event)
+			|| itgl_asciicast_escape(&event, output.data, output.len)
+			|| itgl_broadcast_append("\"]\n", 3, &event)
+			|| callback(event.data, event.len, ctx))
+			break;
+		ret = 0;
+	}
+	TGL_FREE(output.data);
+	TGL_FREE(event.data);
+	return ret;
 }
 
-int tglutil_set_console_size(const unsigned col, const unsigned row)
+/* Appends str as the contents of a JSON string */
+int itgl_asciicast_escape(BroadcastChunk *const chunk, const char *const str, const size_t len)
 {
-#ifdef __unix__
-	const struct winsize w = (struct winsize){
-		.ws_row = row,
-		.ws_col = col,
-	};
-	return ioctl(STDOUT_FILENO, TIOCSWINSZ, &w);
-#else /* defined(TGL_OS_WINDOWS) */
-	const HANDLE hOutputHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-	WINDOWS_CALL(hOutputHandle == INVALID_HANDLE_VALUE, -1);
+	char buf[256];
+	size_t buf_len = 0, i;
+	for (i = 0; i < len; i++) {
+		const unsigned char c = str[i];
+		if (sizeof(buf) - buf_len < 6u) {
+			CALL(itgl_broadcast_append(buf, buf_len, chunk), -1);
+			buf_len = 0;
+		}
+		if (c == '"' || c == '\\') {
+			buf[buf_len++] = '\\';
+			buf[buf_len++] = c;
+		} else if (c < 0x20) {
+			static const char hex[] = "0123456789abcdef";
+			memcpy(buf + buf_len, "\\u00", 4);
+			buf[buf_len + 4] = hex[c >> 4];
+			buf[buf_len + 5] = hex[c & 0xf];
+			buf_len += 6;
+		} else {
+			buf[buf_len++] = c;
+		}
+	}
+	return itgl_broadcast_append(buf, buf_len, chunk);
+}
 
-	const COORD size = (COORD){
-		.Y = row,
-		.X = col,
-	};
-	WINDOWS_CALL(!SetConsoleScreenBufferSize(hOutputHandle, size), -1);
-	return 0;
-#endif
+/* Compresses src into dst, using table of 1 << LZ_HASH_BITS entries
+ * @return size of compressed data, or 0 if it does not fit into capacity
+ **/
+size_t itgl_lz_compress(const uint8_t *const src, const size_t len, uint8_t *const dst, const size_t capacity, uint32_t *const table)
+{
+	/* Positions are stored + 1, so 0 is empty */
+	memset(table, 0, sizeof(uint32_t) << LZ_HASH_BITS);
+	size_t pos = 0, literals = 0, i = 0;
+	while (i + LZ_MIN_MATCH <= len) {
+		uint32_t word;
+		memcpy(&word, src + i, sizeof(word));
+		const uint32_t hash = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+		const size_t match = table[hash];
+		table[hash] = (uint32_t)i + 1u;
+		if (!match || memcmp(src + match - 1u, src + i, LZ_MIN_MATCH)) {
+			i++;
+			continue;
+		}
+		size_t match_len = LZ_MIN_MATCH;
+		while (i + match_len < len && src[match - 1u + match_len] == src[i + match_len])
+			match_len++;
+		if (capacity - pos < 3u * VARINT_MAX + (i - literals))
+			return 0;
+		pos = itgl_varint_write(dst, pos, i - literals);
+		memcpy(dst + pos, src + literals, i - literals);
+		pos += i - literals;
+		pos = itgl_varint_write(dst, pos, match_len - LZ_MIN_MATCH + 1u);
+		pos = itgl_varint_write(dst, pos, i - match);
+		i += match_len;
+		literals = i;
+	}
+	if (capacity - pos < 2u * VARINT_MAX + (len - literals))
+		return 0;
+	pos = itgl_varint_write(dst, pos, len - literals);
+	memcpy(dst + pos, src + literals, len - literals);
+	pos += len - literals;
+	return itgl_varint_write(dst, pos, 0);
 }
 
-int tglutil_set_window_title(const char *title)
+/* Decompresses src into dst, which must be filled exactly
+ * @return 0 on success, -1 if src is corrupt
+ **/
+int itgl_lz_decompress(const uint8_t *const src, const size_t len, uint8_t *const dst, const size_t size)
 {
-	CALL_STDOUT(fputs("\033]2;", stdout), -1);
-	CALL_STDOUT(fputs(title, stdout), -1);
-	CALL_STDOUT(fputs("\033\\", stdout), -1);
-	return 0;
+	size_t pos = 0, out = 0;
+	while (true) {
+		uint64_t literals, match_len, offset;
+		if (itgl_varint_read(src, len, &pos, &literals) || literals > len - pos || literals > size - out)
+			return -1;
+		memcpy(dst + out, src + pos, literals);
+		pos += literals;
+		out += literals;
+		if (itgl_varint_read(src, len, &pos, &match_len))
+			return -1;
+		if (!match_len)
+			return (pos == len && out == size) ? 0 : -1;
+		match_len += LZ_MIN_MATCH - 1u;
+		if (itgl_varint_read(src, len, &pos, &offset) || offset >= out || match_len > size - out)
+			return -1;
+		/* Matches may overlap the bytes they produce */
+		const uint8_t *from = dst + out - offset - 1u;
+		const uint8_t *const end = dst + out + match_len;
+		uint8_t *to = dst + out;
+		while (to < end)
+			*to++ = *from++;
+		out += match_len;
+	}
 }
 
-int tglutil_set_echo_input(const bool enabled)
+inline size_t itgl_varint_write(uint8_t *const buf, size_t pos, uint64_t value)
 {
-#ifdef __unix__
-	struct termios t;
-	CALL(tcgetattr(STDIN_FILENO, &t), -1);
-	t.c_lflag = (enabled) ? (t.c_lflag | (ECHO)) : (t.c_lflag & ~(ECHO));
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &t), -2);
-#else /* defined(TGL_OS_WINDOWS) */
-	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
-	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, -1);
+	while (value >= 0x80u) {
+		buf[pos++] = (uint8_t)(value | 0x80u);
+		value >>= 7;
+	}
+	buf[pos++] = (uint8_t)value;
+	return pos;
+}
 
-	DWORD mode;
-	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &mode), -1);
-	mode = (enabled) ? (mode | (ENABLE_ECHO_INPUT)) : (mode & ~(ENABLE_ECHO_INPUT));
-	WINDOWS_CALL(!SetConsoleMode(hInputHandle, mode), -1);
-#endif
-	return 0;
+int itgl_varint_read(const uint8_t *const buf, const size_t len, size_t *const pos, uint64_t *const value)
+{
+	uint64_t result = 0;
+	unsigned shift;
+	for (shift = 0; shift < 64u; shift += 7u) {
+		if (*pos == len)
+			return -1;
+		const uint8_t byte = buf[(*pos)++];
+		result |= (uint64_t)(byte & 0x7fu) << shift;
+		if (!(byte & 0x80u)) {
+			*value = result;
+			return 0;
+		}
+	}
+	return -1;
 }
 
-int tglutil_set_mouse_tracking_enabled(const bool enabled)
+/* Colors are stored as flags and RGB of foreground, then of background. Indexed colors are in the first channel */
+inline void itgl_color_write(uint8_t *const buf, const TGLPixFmt color)
 {
-#ifdef __unix__
-	if (enabled)
-		CALL_STDOUT(fputs("\033[?1003h", stdout), -1);
-	else
-		CALL_STDOUT(fputs("\033[?1003l", stdout), -1);
-	CALL_STDOUT(fflush(stdout), -2);
-#else /* defined(TGL_OS_WINDOWS) */
-	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
-	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, -1);
+	buf[0] = color.fg.flags;
+	buf[1] = color.fg.color.rgb.r;
+	buf[2] = color.fg.color.rgb.g;
+	buf[3] = color.fg.color.rgb.b;
+	buf[4] = color.bkg.flags;
+	buf[5] = color.bkg.color.rgb.r;
+	buf[6] = color.bkg.color.rgb.g;
+	buf[7] = color.bkg.color.rgb.b;
+}
 
-	DWORD mode;
-	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &mode), -1);
-	mode = (enabled) ? (mode | (ENABLE_MOUSE_INPUT)) : (mode & ~(ENABLE_MOUSE_INPUT));
-	WINDOWS_CALL(!SetConsoleMode(hInputHandle, mode), -1);
-#endif
-	return 0;
+inline TGLPixFmt itgl_color_read(const uint8_t *const buf)
+{
+	return (TGLPixFmt){
+		.fg = { .flags = buf[0], .color.rgb = { .r = buf[1], .g = buf[2], .b = buf[3] } },
+		.bkg = { .flags = buf[4], .color.rgb = { .r = buf[5], .g = buf[6], .b = buf[7] } },
+	};
 }
 
-#endif /* TERMGLUTIL */
+#endif /* TERMGL_RECORD */
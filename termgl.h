@@ -14,9 +14,10 @@ extern "C" {
 #endif
 
 #define TGL_VERSION_MAJOR 1
-#define TGL_VERSION_MINOR 5
+#define TGL_VERSION_MINOR 6
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #if defined(_WIN32) || defined(WIN32)
@@ -59,6 +60,21 @@ enum {
 	/* internal - DO NOT USE */
 	TGL_CULL_BIT = 0x80,
 #endif
+	TGL_DIFF_FLUSH = 0x100,
+	TGL_DIRECT_WRITE = 0x200,
+#ifdef TERMGL_THREADS
+	TGL_PARALLEL_FLUSH = 0x400,
+#endif
+	TGL_QUANTIZE_256 = 0x800,
+	TGL_QUANTIZE_16 = 0x1000,
+	TGL_DITHER = 0x2000,
+#ifdef TERMGL_THREADS
+	TGL_ASYNC_FLUSH = 0x4000,
+#endif
+	TGL_HALF_BLOCK = 0x8000,
+	TGL_BRAILLE = 0x10000,
+	TGL_Z_BUFFER_16 = 0x20000,
+	TGL_REVERSED_Z = 0x40000,
 };
 
 /**
@@ -129,6 +145,52 @@ typedef struct TGLPixFmt {
  */
 typedef void TGLPixelShader(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
 
+/**
+ * Horizontal run of pixels in a filled triangle which passed the depth test
+ * u and v of pixel i are TGL_SPAN_UV(u + i * du) and TGL_SPAN_UV(v + i * dv)
+ */
+typedef struct TGLSpan {
+	unsigned length;
+	int32_t u; /**< 16.16 fixed point */
+	int32_t v; /**< 16.16 fixed point */
+	int32_t du;
+	int32_t dv;
+} TGLSpan;
+
+/**
+ * Converts 16.16 fixed point u or v of a TGLSpan to uint8_t
+ */
+#define TGL_SPAN_UV(val) ((uint8_t)(((val) < 0) ? 0 : ((val) >= (255 << 16)) ? 255 : ((val) >> 16)))
+
+/**
+ * Span shader that is called instead of a pixel shader for runs of pixels in filled triangles
+ * Writes span->length colors and chars
+ */
+typedef void TGLSpanShader(const TGLSpan *span, TGLPixFmt *colors, char *chars, const void *data);
+
+#ifdef TERMGL_PROFILE
+/**
+ * Counters and timings accumulated by a TGL since it was created or tgl_reset_stats was called
+ * Times are in nanoseconds, summed over all threads
+ */
+typedef struct TGLStats {
+	uint64_t vertex_ns; /**< vertex shaders */
+	uint64_t clip_ns; /**< culling, clipping and mapping triangles to the screen */
+	uint64_t raster_ns; /**< drawing lines and triangles, including shade_ns */
+	uint64_t shade_ns; /**< shaders of filled triangles */
+	uint64_t flush_ns; /**< printing frames, including write_ns */
+	uint64_t write_ns; /**< writing output */
+	uint64_t triangles_submitted; /**< 3D triangles */
+	uint64_t triangles_culled; /**< 3D triangles removed by backface culling */
+	uint64_t triangles_clipped; /**< 3D triangles which were not entirely inside the view volume */
+	uint64_t triangles_occluded; /**< filled triangles rejected as entirely behind the z-buffer */
+	uint64_t pixels_shaded;
+	uint64_t pixels_depth_rejected;
+	uint64_t sgr_codes;
+	uint64_t bytes_flushed;
+} TGLStats;
+#endif
+
 #ifndef TERMGL_MINIMAL
 
 /**
@@ -166,6 +228,13 @@ void tgl_pixel_shader_simple(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, co
  */
 void tgl_pixel_shader_texture(uint8_t u, uint8_t v, TGLPixFmt *color, char *c, const void *data);
 
+/**
+ * Span shaders equivalent to tgl_pixel_shader_simple and tgl_pixel_shader_texture
+ * Used automatically by filled triangles drawn with those pixel shaders
+ */
+void tgl_span_shader_simple(const TGLSpan *span, TGLPixFmt *colors, char *chars, const void *data);
+void tgl_span_shader_texture(const TGLSpan *span, TGLPixFmt *colors, char *chars, const void *data);
+
 /**
  * Gets a gradient's character corresponding to an intensity (i.e. u or v value)
  */
@@ -191,6 +260,37 @@ int tgl_boot(void);
  */
 TGL *tgl_init(unsigned width, unsigned height);
 
+/**
+ * Allocator of the memory of a TGL
+ * @param alloc: returns size bytes aligned for any type, or NULL after setting errno
+ * @param free: frees memory returned by alloc. Never called with NULL
+ * Both may be called by threads of tgl_set_threads and TGL_ASYNC_FLUSH, also concurrently
+ */
+typedef struct TGLAllocator {
+	void *(*alloc)(size_t size, void *ctx);
+	void (*free)(void *ptr, void *ctx);
+	void *ctx;
+} TGLAllocator;
+
+/**
+ * Initializes a TGL struct like tgl_init, allocating all of its memory through allocator
+ * @param allocator: copied, NULL to use malloc and free
+ * @param arena_settings: settings whose buffers are reserved along with the TGL struct and frame buffer in one cache-line aligned block, so that tgl_enable and tgl_disable of them do not allocate or free. 0 to allocate each buffer separately
+ *   Buffers are reserved for TGL_Z_BUFFER, TGL_OUTPUT_BUFFER, TGL_DIFF_FLUSH, TGL_QUANTIZE_256, TGL_QUANTIZE_16, and TGL_ASYNC_FLUSH (TERMGL_THREADS only). An output buffer which grows beyond its initial size is moved out of the block
+ * @return: pointer to a TGL struct, NULL on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS, or by allocator
+ */
+TGL *tgl_init_ex(unsigned width, unsigned height, const TGLAllocator *allocator, uint32_t arena_settings);
+
+/**
+ * Changes size of the frame buffer, keeping the settings. Buffers are reused if they are large enough, and replacements grow geometrically
+ * The frame buffer and z buffer are cleared, and the next frame is printed in full after clearing the screen, also if TGL_PROGRESSIVE is enabled
+ * If TGL_ASYNC_FLUSH is enabled, the last flushed frame is printed at the old size first
+ * @return 0 on success, -1 on failure, in which case the size is unchanged. If the presenter of TGL_ASYNC_FLUSH cannot be restarted, the size is changed, but TGL_ASYNC_FLUSH is disabled
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS, or by allocator
+ */
+int tgl_resize(TGL *tgl, unsigned width, unsigned height);
+
 /**
  * Frees a TGL context
  */
@@ -199,16 +299,82 @@ void tgl_delete(TGL *tgl);
 /**
  * Prints frame buffer to terminal
  * @return 0 on success, -1 on failure
- * On failure, errno is set to value specified by: https://man7.org/linux/man-pages/man3/fputc.3p.html#ERRORS
+ * On failure, errno is set to value specified by:
+ *   stdio: https://man7.org/linux/man-pages/man3/fputc.3p.html#ERRORS
+ *   TGL_DIRECT_WRITE:
+ *     UNIX: https://man7.org/linux/man-pages/man2/write.2.html#ERRORS
+ *     Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ *   Output callback: EINVAL if TGL_OUTPUT_BUFFER is disabled, otherwise set by callback
  */
 int tgl_flush(TGL *tgl);
 
+/**
+ * Sets the file descriptor written to by tgl_flush if TGL_DIRECT_WRITE is enabled
+ * Default is 1 (stdout)
+ */
+void tgl_set_output_fd(TGL *tgl, int fd);
+
+/**
+ * Callback which receives output of tgl_flush
+ * @param buf: only valid during call
+ * @return 0 on success, nonzero on failure after setting errno
+ */
+typedef int TGLOutputCallback(const char *buf, size_t len, void *ctx);
+
+/**
+ * Sets callback which tgl_flush writes to instead of stdout or the file descriptor. Requires TGL_OUTPUT_BUFFER
+ * Output of a frame is usually passed in a single call, directly from the output buffer
+ * If TGL_ASYNC_FLUSH is enabled, callback is called on the thread which prints frames
+ * @param callback: NULL to write to stdout or the file descriptor
+ */
+void tgl_set_output_callback(TGL *tgl, TGLOutputCallback *callback, void *ctx);
+
+/**
+ * Prints frame buffer like tgl_flush, but into buf. The frame is printed before returning, also if TGL_ASYNC_FLUSH is enabled. Requires TGL_OUTPUT_BUFFER
+ * @param len: set to length of output, also if it is larger than size
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to EINVAL if TGL_OUTPUT_BUFFER is disabled, or ENOBUFS if the output is larger than size, in which case the next flush prints the whole frame
+ */
+int tgl_flush_to_memory(TGL *tgl, char *buf, size_t size, size_t *len);
+
+/**
+ * Encoder which prints frames of a TGL once for any number of viewers
+ * Each frame is encoded as a delta from the previous frame, and every keyframe_interval frames also as a keyframe which prints it in full
+ * Viewers read encoded frames in order, and viewers which fell behind resync from the latest keyframe
+ */
+typedef struct TGLBroadcast TGLBroadcast;
+
+/**
+ * @param tgl: TGL whose frames are encoded
+ * @param keyframe_interval: number of frames from one keyframe to the next, which are all kept until the next keyframe is encoded
+ * @return NULL on failure
+ */
+TGLBroadcast *tgl_broadcast_create(const TGL *tgl, unsigned keyframe_interval);
+
+void tgl_broadcast_delete(TGLBroadcast *broadcast);
+
+/**
+ * Encodes frame buffer as the next frame. Settings of tgl which affect printing are used, and TGL_DIFF_FLUSH is ignored
+ * Independent of tgl_flush, whose output does not change
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to ENOMEM, or EINVAL if size of tgl differs from that of the TGL broadcast was created with, e.g. after tgl_resize
+ */
+int tgl_broadcast_encode(TGLBroadcast *broadcast, TGL *tgl);
+
+/**
+ * Gets next encoded frame of a viewer
+ * @param seq: number of next frame of viewer, starting from 0. Set to number of the frame after the returned one
+ * @param buf: set to encoded frame, which stays valid while it is one of the last keyframe_interval frames
+ * @return true if a frame was returned, false if viewer has every encoded frame
+ */
+bool tgl_broadcast_read(const TGLBroadcast *broadcast, uint64_t *seq, const char **buf, size_t *len);
+
 /**
  * Clears buffers
  * @param buffers: bitwise combination of buffers:
  *   TGL_FRAME_BUFFER - frame buffer
  *   TGL_Z_BUFFER - depth buffer
- *   TGL_OUTPUT_BUFFER - output buffer
+ *   TGL_OUTPUT_BUFFER - output buffer (no-op, the output buffer never needs to be cleared)
  */
 void tgl_clear(TGL *tgl, uint8_t buffers);
 
@@ -226,11 +392,65 @@ void tgl_clear_screen(void);
  *   TGL_CULL_FACE - (3D ONLY) cull specified triangle faces
  *   TGL_OUTPUT_BUFFER - output buffer allowing for just one print to flush. Much faster on most terminals, but requires a few hundred kilobytes of memory
  *   TGL_PROGRESSIVE - Over-write previous frame. Eliminates strobing but requires call to tgl_clear_screen before drawing smaller image and after resizing terminal if terminal size was smaller than frame size
- * @return 0 on success, -1 on failure
+ *   TGL_DIFF_FLUSH - Only print pixels which changed since the previous flush. Only the columns of each row drawn to since the previous flush are compared, and tgl_clear counts as drawing wherever was drawn since the previous clear. Requires memory for a copy of the frame buffer. The first flush after enabling prints the whole frame. Enabling again while already enabled forces the next flush to print the whole frame (e.g. after the terminal was cleared or resized)
+ *   TGL_DIRECT_WRITE - Write output buffer to file descriptor set by tgl_set_output_fd using write (UNIX) or WriteConsoleA/WriteFile (Windows) instead of stdio. Requires TGL_OUTPUT_BUFFER
+ *   TGL_PARALLEL_FLUSH - (TERMGL_THREADS ONLY) Assemble output of flushes which print the whole frame in bands of rows on threads set by tgl_set_threads. Output is unchanged. Requires TGL_OUTPUT_BUFFER, which grows to fit the largest possible frame
+ *   TGL_QUANTIZE_256 - Print TGL_RGB24 colors as the nearest of the 240 colors of the xterm-256 color cube and grayscale ramp, for terminals without 24-bit color support. Requires memory for a copy of the colors of the frame buffer and a 36KiB lookup table
+ *   TGL_QUANTIZE_16 - Print TGL_RGB24 colors as the nearest indexed color. Takes precedence over TGL_QUANTIZE_256
+ *   TGL_DITHER - Apply ordered dithering to colors quantized by TGL_QUANTIZE_256 or TGL_QUANTIZE_16. Smooths gradients, but changes colors more often, which increases output size
+ *   TGL_ASYNC_FLUSH - (TERMGL_THREADS ONLY) tgl_flush copies the frame buffer and returns, and the frame is printed on a separate thread. Frames flushed before the previous one was printed replace it. Errors of printing are reported by the next tgl_flush. TGL_PARALLEL_FLUSH is ignored. Other functions which print, such as tgl_clear_screen, must not be used while enabled. Disabling prints the last frame. Requires memory for two copies of the frame buffer
+ *   TGL_HALF_BLOCK - Print each 1x2 pixels as one cell of upper half block (U+2580), in the colors the two pixels show. A pixel shows its foreground color if its char is not a space, otherwise its background color. Colors are printed like TGL_RGB24 or indexed colors, without other flags. Requires a UTF-8 terminal and memory for a frame of cells
+ *   TGL_BRAILLE - Print each 2x4 pixels as one cell of a braille pattern (U+2800 - U+28FF) with a dot for each pixel whose char is not a space, in the foreground color of the first of those and the background color of the first of the others. Takes precedence over TGL_HALF_BLOCK. Requires a UTF-8 terminal and memory for a frame of cells
+ *   TGL_Z_BUFFER_16 - Store depth in the depth buffer as 16-bit unsigned normalized integers instead of floats, which halves its memory. Depths from -1 (0 with TGL_REVERSED_Z) to 1 are mapped onto 65536 steps. Depths above are clamped to 1, and depths below fail the depth test. Depths within a step are equal, in which case the later pixel passes
+ *   TGL_REVERSED_Z - Clear the depth buffer to 0 instead of -1, for depths of tgl_camera_reversed. Pixels with negative depth fail the depth test
+ *   Enabling or disabling TGL_Z_BUFFER_16 or TGL_REVERSED_Z while TGL_Z_BUFFER is enabled clears the depth buffer. If memory for a float depth buffer cannot be allocated when disabling TGL_Z_BUFFER_16, TGL_Z_BUFFER is disabled
+ * @return 0 on success, -1 on failure. TGL_DIFF_FLUSH, TGL_HALF_BLOCK and TGL_BRAILLE stay disabled if memory for them cannot be allocated
  * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
  */
-int tgl_enable(TGL *tgl, uint8_t settings);
-void tgl_disable(TGL *tgl, uint8_t settings);
+int tgl_enable(TGL *tgl, uint32_t settings);
+void tgl_disable(TGL *tgl, uint32_t settings);
+
+/**
+ * Makes filled triangles drawn with pixel_shader shade runs of pixels with span_shader, which receives the same data
+ * Pixel shaders without a span shader are called for each pixel
+ * Must not be called while drawing
+ * @param span_shader: NULL to remove span shader of pixel_shader
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to ENOSPC if span shaders were set for too many pixel shaders
+ */
+int tgl_set_span_shader(TGL *tgl, TGLPixelShader *pixel_shader, TGLSpanShader *span_shader);
+
+#ifdef TERMGL_THREADS
+/**
+ * Sets number of threads used for rendering, including the calling thread
+ * Used by tgl_triangles_3d and tgl_draw_mesh, and by tgl_flush if TGL_PARALLEL_FLUSH is enabled. Shaders passed to them must be thread-safe when more than one thread is used
+ * @param threads: 0 or 1 to only render on the calling thread
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to value specified by:
+ *   UNIX: https://man7.org/linux/man-pages/man3/pthread_create.3.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ */
+int tgl_set_threads(TGL *tgl, unsigned threads);
+
+/**
+ * Limits the rate at which frames flushed with TGL_ASYNC_FLUSH are printed. Frames flushed faster than that are dropped
+ * @param fps: 0 to print frames as soon as possible
+ */
+void tgl_set_fps(TGL *tgl, unsigned fps);
+#endif
+
+#ifdef TERMGL_PROFILE
+/**
+ * Gets statistics of rendering and printing. Must not be called while drawing
+ * Frames printed with TGL_ASYNC_FLUSH are counted once they have been printed
+ */
+void tgl_get_stats(const TGL *tgl, TGLStats *stats);
+
+/**
+ * Sets all statistics to 0. Must not be called while drawing
+ */
+void tgl_reset_stats(TGL *tgl);
+#endif
 
 /**
  * Printing functions similar to those provided by stdio.h
@@ -238,6 +458,45 @@ void tgl_disable(TGL *tgl, uint8_t settings);
 void tgl_putchar(TGL *tgl, int x, int y, char c, TGLPixFmt color);
 void tgl_puts(TGL *tgl, int x, int y, const char *str, TGLPixFmt color);
 
+/**
+ * Char of glyph id, which may be drawn like any other char once set with tgl_set_glyph
+ */
+#define TGL_GLYPH(id) ((char)(0x80 | (id)))
+
+/**
+ * Sets the UTF-8 encoding printed for chars TGL_GLYPH(id), e.g. box-drawing characters or shading blocks
+ * Chars of the frame buffer stay one byte, so each glyph is printed as one cell. Glyphs must be one column wide. Not used by TGL_HALF_BLOCK and TGL_BRAILLE
+ * The next flush prints the whole frame
+ * @param id: 0 to 127
+ * @param utf8: 1 to 4 bytes, or NULL to print the char itself again
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to EINVAL if id or utf8 is invalid, or to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tgl_set_glyph(TGL *tgl, uint8_t id, const char *utf8);
+
+/**
+ * Image of chars and colors, of which pixels with a transparent char are not drawn
+ */
+typedef struct TGLSprite TGLSprite;
+
+/**
+ * Creates a sprite from chars and colors laid out like those of TGLPixelShaderTexture
+ * Opaque pixels are stored in runs with normalized colors, which tgl_blit copies without shading
+ * @param width, height: at most 65535
+ * @param transparent: char of pixels which are not drawn
+ * @return NULL on failure
+ * On failure, errno is set to EINVAL if width or height is too large, or to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLSprite *tgl_sprite_create(unsigned width, unsigned height, const char *chars, const TGLPixFmt *colors, char transparent);
+void tgl_sprite_delete(TGLSprite *sprite);
+
+/**
+ * Draws sprite with its upper left corner at (x, y)
+ * Unlike other drawing functions, pixels outside of the screen are discarded instead of moved onto its edge, so sprites may be partly or fully outside of it
+ * The depth buffer is neither tested nor written, like by tgl_putchar
+ */
+void tgl_blit(TGL *tgl, const TGLSprite *sprite, int x, int y);
+
 /**
  * Drawing functions
  */
@@ -287,6 +546,13 @@ void tgl_rotate(TGLMat rotate, float x, float y, float z);
 void tgl_scale(TGLMat scale, float x, float y, float z);
 void tgl_translate(TGLMat translate, float x, float y, float z);
 
+/**
+ * Like tgl_camera, but depth falls from 1 at the near plane to 0 at the far plane, for use with TGL_REVERSED_Z. far_val may be INFINITY
+ * Depth is nearly inversely proportional to distance, which floats store with nearly the same relative precision at any distance
+ * Geometry beyond the far plane is not clipped, but has negative depth, which fails the depth test
+ */
+void tgl_camera_reversed(TGLMat camera, int width, int height, float fov, float near_val, float far_val);
+
 float tgl_sqr(float val);
 float tgl_mag3(const float vec[3]);
 float tgl_magsqr3(const float vec[3]);
@@ -325,6 +591,28 @@ void tgl_cull_face(TGL *tgl, uint8_t settings);
  */
 void tgl_triangle_3d(TGL *tgl, const TGLTriangle in, const uint8_t (*uv)[2], bool fill, TGLVertexShader *vert_shader, const void *vert_data, TGLPixelShader *frag_shader, const void *frag_data);
 
+/**
+ * Renders count triangles onto framebuffer, producing the same result as calling tgl_triangle_3d for each of them in order
+ * If TERMGL_THREADS is defined, work is split between threads set by tgl_set_threads
+ * @param uv: uv of each triangle, or NULL for all zero
+ * @param frag_data_stride: frag_data of triangle i is ((const char *)frag_data + i * frag_data_stride)
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tgl_triangles_3d(TGL *tgl, const TGLTriangle *in, const uint8_t (*uv)[3][2], size_t count, bool fill, TGLVertexShader *vert_shader, const void *vert_data, TGLPixelShader *frag_shader, const void *frag_data, size_t frag_data_stride);
+
+/**
+ * Renders indexed triangle mesh onto framebuffer, producing the same result as tgl_triangles_3d
+ * Every vertex is passed through vert_shader exactly once, rather than once per triangle using it. Vertices are passed in order, unless more than one thread is set by tgl_set_threads (TERMGL_THREADS only), in which case ranges of them are passed on several threads at once
+ * @param verts: n_verts vertices
+ * @param indices: 3 indices into verts per triangle, n_idx / 3 triangles are rendered
+ * @param uv: uv of each vertex, or NULL for all zero
+ * @param frag_data_stride: frag_data of triangle i is ((const char *)frag_data + i * frag_data_stride)
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tgl_draw_mesh(TGL *tgl, const TGLVec3 *verts, size_t n_verts, const uint32_t *indices, size_t n_idx, const uint8_t (*uv)[2], bool fill, TGLVertexShader *vert_shader, const void *vert_data, TGLPixelShader *frag_shader, const void *frag_data, size_t frag_data_stride);
+
 #endif /* TERMGL3D */
 
 #ifdef TERMGLUTIL
@@ -355,14 +643,20 @@ typedef struct TGLMouseEvent {
 	 *   optionally OR'd with TGL_MOUSE_WHEEL_OR_MOVEMENT
 	 */
 	uint8_t button;
-	uint8_t x; /* Coordinates might have constant offset */
-	uint8_t y;
+	uint16_t x; /* Coordinates might have constant offset. Cells or pixels, see tglutil_set_mouse_tracking_ex */
+	uint16_t y;
 } TGLMouseEvent;
 
+enum /* mouse tracking encoding */ {
+	TGL_MOUSE_SGR = 0x01, /* SGR (1006), which reports coordinates beyond 223 */
+	TGL_MOUSE_SGR_PIXELS = 0x02, /* SGR of pixel coordinates (1016). Terminals without it report cells with SGR */
+};
+
 /**
  * Reads up to count bytes from raw terminal input into buf and optionally reads count_events mouse events
  * If mouse tracking is enabled but event_buf==NULL, buf may contain Xterm control sequences
- * If mouse tracking is enabled, ensure sizeof(buf) >= count_events * 6
+ * If mouse tracking is enabled, ensure sizeof(buf) >= count_events * 6, or count_events * 21 with SGR encoding
+ * Bytes of a mouse sequence which is incomplete at the end of the read are kept in buf
  * @param event_buf: Pass NULL if mouse tracking is disabled
  * @param count_events: Length of event_buf
  * @param count_read_events: Gets set to number of mouse events read
@@ -387,6 +681,17 @@ TGL_SSIZE_T tglutil_read(char *buf, size_t count, TGLMouseEvent *event_buf, size
  */
 int tglutil_get_console_size(unsigned *col, unsigned *row, bool screen_buffer);
 
+/**
+ * Checks if console was resized since the previous call, and if so, stores its size like tglutil_get_console_size, e.g. for tgl_resize
+ * UNIX: the first call installs a SIGWINCH handler, replacing any previous one. Windows: size is compared with the one of the previous call
+ * The first call always reports a resize
+ * @return 1 if resized, 0 if not, -1 on failure
+ * On failure, errno is set to value specified by:
+ *   UNIX: https://man7.org/linux/man-pages/man2/sigaction.2.html#ERRORS or https://man7.org/linux/man-pages/man2/ioctl.2.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ */
+int tglutil_poll_console_resize(unsigned *col, unsigned *row, bool screen_buffer);
+
 /**
  * Sets console size
  * Only changes printable area and will not change window size if new size is larger than window
@@ -417,7 +722,7 @@ int tglutil_set_window_title(const char *title);
 int tglutil_set_echo_input(bool enabled);
 
 /**
- * Sets if mouse is tracked
+ * Sets if mouse is tracked, like tglutil_set_mouse_tracking_ex(enabled, 0)
  * It is recommended to call tglutil_set_echo_input(false) when using mouse tracking
  * @return 0 on success, negative value on failure
  * On failure, errno is set to value specified by:
@@ -428,8 +733,228 @@ int tglutil_set_echo_input(bool enabled);
  */
 int tglutil_set_mouse_tracking_enabled(bool enabled);
 
+/**
+ * Sets if mouse is tracked, and how terminal encodes events, which tglutil_read and the queue of tglutil_input_start parse
+ * Disabling also disables the encodings
+ * @param encoding: 0 for X10, which only reports coordinates up to 223, or ONE of TGL_MOUSE_SGR, TGL_MOUSE_SGR_PIXELS. Ignored on Windows, which reports cells
+ * @return 0 on success, negative value on failure
+ * On failure, errno is set to value specified by:
+ *   UNIX:
+ *     -1: https://man7.org/linux/man-pages/man3/fputc.3p.html#ERRORS
+ *     -2: https://man7.org/linux/man-pages/man3/fflush.3p.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ */
+int tglutil_set_mouse_tracking_ex(bool enabled, uint8_t encoding);
+
+#ifdef TERMGL_THREADS
+enum /* input event type */ {
+	TGL_INPUT_KEY = 0x01,
+	TGL_INPUT_MOUSE = 0x02,
+	TGL_INPUT_RESIZE = 0x04,
+};
+
+typedef struct TGLInputEvent {
+	uint8_t type; /* ONE of TGL_INPUT_KEY, TGL_INPUT_MOUSE, TGL_INPUT_RESIZE */
+	char key; /* TGL_INPUT_KEY: byte of input like tglutil_read stores in buf */
+	TGLMouseEvent mouse; /* TGL_INPUT_MOUSE */
+	unsigned col; /* TGL_INPUT_RESIZE: size like tglutil_get_console_size(&col, &row, true) */
+	unsigned row;
+} TGLInputEvent;
+
+/**
+ * Queue of input events which is filled by a separate thread
+ */
+typedef struct TGLInput TGLInput;
+
+/**
+ * Starts a thread which reads key and mouse input, and console resizes, into a queue
+ * Input is not lost when the queue is full; the thread waits until events are polled
+ * Mouse sequences split between reads are joined. ESC which is not followed by another byte within 25 ms is a key
+ * Canonical input mode is disabled until tglutil_input_stop. tglutil_read must not be used meanwhile. Only one may exist at a time
+ * UNIX: the SIGWINCH handler of tglutil_poll_console_resize is installed. stdin need not be a terminal
+ * @param capacity: number of events queued, rounded up to power of 2
+ * @return NULL on failure
+ * On failure, errno is set to EINVAL if capacity is 0 or above 2^31, EBUSY if another exists, or value specified by:
+ *   UNIX: https://man7.org/linux/man-pages/man3/malloc.3.html#ERRORS, https://man7.org/linux/man-pages/man2/pipe.2.html#ERRORS, https://www.man7.org/linux/man-pages/man3/tcsetattr.3p.html#ERRORS or https://man7.org/linux/man-pages/man3/pthread_create.3.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ */
+TGLInput *tglutil_input_start(size_t capacity);
+
+/**
+ * Moves up to count of the oldest queued events to events, in order they were read
+ * Does not make system calls or wait, so may be called every frame. Must not be called from multiple threads at once
+ * @return number of events moved
+ */
+size_t tglutil_input_poll(TGLInput *input, TGLInputEvent *events, size_t count);
+
+/**
+ * Stops the thread, restores input mode, discards queued events and frees input
+ * @return 0 on success, -1 if reading input failed, which stopped the thread earlier
+ * On failure, errno is set to value specified by:
+ *   UNIX: https://man7.org/linux/man-pages/man2/poll.2.html#ERRORS or https://man7.org/linux/man-pages/man2/read.2.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ */
+int tglutil_input_stop(TGLInput *input);
+#endif /* TERMGL_THREADS */
+
 #endif /* TERMGLUTIL */
 
+#ifdef TERMGLMESH
+
+#ifndef TERMGL3D
+#error "TermGLMesh requires TERMGL3D."
+#endif
+
+/* Size in bytes of a triangle in binary STL: normal, 3 vertices, attribute byte count */
+#define TGLMESH_STL_STRIDE 50
+
+/* Alignment in bytes of vertices and indices of indexed meshes */
+#define TGLMESH_ALIGN 64
+
+/**
+ * Triangle mesh loaded from a file. Data is mapped from the file where possible, and must not be modified
+ * All data is little-endian, and only loaded correctly on little-endian machines
+ */
+typedef struct TGLMesh {
+	/**
+	 * Binary STL triangles, n_triangles records of TGLMESH_STL_STRIDE bytes, read with tglmesh_stl_triangle
+	 * NULL if the mesh was loaded by tglmesh_load_cache
+	 */
+	const unsigned char *stl;
+	size_t n_triangles;
+
+	/**
+	 * Deduplicated vertices, and 3 indices into verts per triangle, which can be passed to tgl_draw_mesh
+	 * NULL until set by tglmesh_index or tglmesh_load_cache
+	 */
+	const TGLVec3 *verts;
+	size_t n_verts;
+	const uint32_t *indices;
+	size_t n_indices;
+
+	/* FOR INTERNAL USE ONLY */
+	void *map;
+	size_t map_size;
+	void *alloc;
+} TGLMesh;
+
+/**
+ * Maps a binary STL file into memory. ASCII STL is not supported
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to EINVAL if the file is not binary STL, otherwise to value specified by:
+ *   UNIX: https://man7.org/linux/man-pages/man2/open.2.html#ERRORS, https://man7.org/linux/man-pages/man2/mmap.2.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ */
+int tglmesh_load_stl(TGLMesh *mesh, const char *path);
+
+/**
+ * Copies vertices of triangle i of a mesh loaded by tglmesh_load_stl
+ */
+void tglmesh_stl_triangle(const TGLMesh *mesh, size_t i, TGLTriangle out);
+
+/**
+ * Builds verts and indices of a mesh loaded by tglmesh_load_stl, merging vertices with identical coordinates
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to EOVERFLOW if the mesh has more than UINT32_MAX vertices, otherwise to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tglmesh_index(TGLMesh *mesh);
+
+/**
+ * Writes verts and indices of an indexed mesh to a cache file, which is loaded faster than STL
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to EINVAL if the mesh is not indexed, otherwise to value specified by: https://man7.org/linux/man-pages/man3/fopen.3.html#ERRORS
+ */
+int tglmesh_save_cache(const TGLMesh *mesh, const char *path);
+
+/**
+ * Maps a cache file written by tglmesh_save_cache into memory. n_triangles is set to the number of indexed triangles
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to EINVAL if the file is not a valid cache, otherwise to value specified by:
+ *   UNIX: https://man7.org/linux/man-pages/man2/open.2.html#ERRORS, https://man7.org/linux/man-pages/man2/mmap.2.html#ERRORS
+ *   Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ */
+int tglmesh_load_cache(TGLMesh *mesh, const char *path);
+
+/**
+ * Unmaps and frees all data of a mesh
+ */
+void tglmesh_free(TGLMesh *mesh);
+
+#endif /* TERMGLMESH */
+
+#ifdef TERMGL_RECORD
+
+/**
+ * Recording of frames of a TGL in a compact binary stream
+ * Each frame is stored as the cells which changed since the previous one, with colors indexed into a palette built during recording, compressed with LZ77, and the time since the previous frame
+ * With TERMGL_THREADS, frames are encoded and written on a separate thread
+ */
+typedef struct TGLRecorder TGLRecorder;
+
+/**
+ * Writes the header of a recording of frames of the size of tgl
+ * @param callback: called with each part of the recording, which may be written to a file. Called on the thread which encodes frames. Returns 0 on success, or -1 on failure with errno set
+ * @return NULL on failure
+ * On failure, errno is set to EINVAL if width or height of tgl is larger than 65535, by callback, or to value specified by:
+ *   https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ *   (TERMGL_THREADS ONLY) UNIX: https://man7.org/linux/man-pages/man3/pthread_create.3.html#ERRORS
+ *   (TERMGL_THREADS ONLY) Windows: https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes
+ */
+TGLRecorder *tgl_recorder_create(const TGL *tgl, TGLOutputCallback *callback, void *ctx);
+
+/**
+ * Records frame buffer of tgl as the next frame, at the current time
+ * With TERMGL_THREADS, the frame buffer is copied and encoded later. Only waits if the previous frame was not yet taken by the encoder. Errors of encoding and writing are reported by the next call
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set to EINVAL if size of tgl differs from that of the TGL recorder was created with, or by callback of tgl_recorder_create
+ */
+int tgl_recorder_frame(TGLRecorder *recorder, const TGL *tgl);
+
+/**
+ * Encodes the last recorded frame and frees recorder
+ * @return 0 on success, -1 if a frame failed to be written since the last tgl_recorder_frame, in which case errno is set by callback of tgl_recorder_create
+ */
+int tgl_recorder_delete(TGLRecorder *recorder);
+
+/**
+ * Decoder of a recording written by TGLRecorder
+ */
+typedef struct TGLPlayer TGLPlayer;
+
+/**
+ * @param data: complete recording, which must stay valid and unchanged until player is deleted
+ * @return NULL on failure
+ * On failure, errno is set to EINVAL if data does not start with the header of a recording, or to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+TGLPlayer *tgl_player_create(const void *data, size_t len);
+
+void tgl_player_delete(TGLPlayer *player);
+
+/**
+ * Gets size of recorded frames, which the TGL passed to tgl_player_next and tgl_player_asciicast must have
+ */
+void tgl_player_size(const TGLPlayer *player, unsigned *width, unsigned *height);
+
+/**
+ * Decodes the next frame into frame buffer of tgl, which can then be printed by tgl_flush
+ * Cells which did not change since the previous frame are not written, so the frame buffer must not be drawn on between frames
+ * @param time_ns: set to time of frame in nanoseconds since the first frame
+ * @return 1 if a frame was decoded, 0 at the end of the recording, -1 on failure
+ * On failure, errno is set to EINVAL if size of tgl differs from that of the recording, or if the recording is corrupt
+ */
+int tgl_player_next(TGLPlayer *player, TGL *tgl, uint64_t *time_ns);
+
+/**
+ * Converts the remaining frames to an asciicast v2 recording, printing each frame like tgl_flush would with the settings of tgl. Requires TGL_OUTPUT_BUFFER
+ * Frames are decoded into frame buffer of tgl, and its diff state is updated as if they were flushed
+ * @param callback: called with each part of the asciicast
+ * @return 0 on success, -1 on failure
+ * On failure, errno is set like by tgl_player_next, to EINVAL if TGL_OUTPUT_BUFFER is disabled, by callback, or to value specified by: https://www.man7.org/linux/man-pages/man3/malloc.3.html#ERRORS
+ */
+int tgl_player_asciicast(TGLPlayer *player, TGL *tgl, TGLOutputCallback *callback, void *ctx);
+
+#endif /* TERMGL_RECORD */
+
 /**
  * FOR INTERNAL USE ONLY
  */